@@ -0,0 +1,294 @@
+#define _POSIX_C_SOURCE 200809L
+#include "batch.h"
+#include "machine.h"
+#include "loader.h"
+#include "memory.h"
+#include "jit.h"
+#include "devices.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <limits.h>
+#include <pthread.h>
+#include <unistd.h> // for sysconf
+
+// Outcome of one program, written out once all workers are done
+typedef struct {
+    bool loaded;
+    StopReason reason;
+    CPU cpu;
+    ExecCounters counters;
+    int pages_used;
+} BatchResult;
+
+// A worker's share of the programs, as a range of indices into the file
+// list. The owner takes from the head; a thief takes the upper half. A
+// program runs far longer than the lock is held, so a mutex is cheap enough.
+typedef struct {
+    pthread_mutex_t lock;
+    int head;
+    int tail; // One past the last program
+} JobQueue;
+
+typedef struct Batch Batch;
+
+typedef struct {
+    Batch* batch;
+    int id;
+    Machine* machine; // Reset between programs, so memory is allocated once
+    JobQueue queue;
+    pthread_t thread;
+    bool started;
+} Worker;
+
+struct Batch {
+    const BatchConfig* config;
+    ExecOptions options;
+    BatchResult* results;
+    Worker* workers;
+    int num_workers;
+};
+
+// --- Scheduling ---
+
+// Moves the upper half of a victim's range into 'w'. Returns the first
+// stolen program, or -1 if the victim has nothing left.
+static int steal(Worker* w, Worker* victim) {
+    pthread_mutex_lock(&victim->queue.lock);
+    int count = victim->queue.tail - victim->queue.head;
+    int start = -1;
+    int end = 0;
+    if (count > 0) {
+        end = victim->queue.tail;
+        start = end - (count + 1) / 2;
+        victim->queue.tail = start;
+    }
+    pthread_mutex_unlock(&victim->queue.lock);
+    if (start < 0) return -1;
+
+    pthread_mutex_lock(&w->queue.lock);
+    w->queue.head = start + 1;
+    w->queue.tail = end;
+    pthread_mutex_unlock(&w->queue.lock);
+    return start;
+}
+
+// Returns the next program for 'w', or -1 when every queue is empty. No
+// work is ever added, so an empty scan means the batch is handed out.
+static int next_job(Worker* w) {
+    pthread_mutex_lock(&w->queue.lock);
+    int job = (w->queue.head < w->queue.tail) ? w->queue.head++ : -1;
+    pthread_mutex_unlock(&w->queue.lock);
+    if (job >= 0) return job;
+
+    Batch* b = w->batch;
+    for (int i = 1; i < b->num_workers; ++i) {
+        job = steal(w, &b->workers[(w->id + i) % b->num_workers]);
+        if (job >= 0) return job;
+    }
+    return -1;
+}
+
+// --- Workers ---
+
+static void run_job(Worker* w, int index) {
+    Batch* b = w->batch;
+    Machine* m = w->machine;
+    BatchResult* result = &b->results[index];
+
+    machine_reset(m);
+    if (b->config->devices) devices_attach_standard(m, NULL);
+    uint32_t start_address = b->config->load_address;
+    if (load_program(m, b->config->files[index], &start_address) != 0) {
+        result->loaded = false;
+        return;
+    }
+    cpu_pulse_reset(&m->cpu);
+    m->cpu.pc = start_address;
+
+    executor_start(m, &b->options);
+    unsigned long budget = b->options.budget ? b->options.budget : ULONG_MAX;
+    result->reason = executor_run(m, budget, &b->options.stop);
+    result->counters = *executor_counters(m);
+    executor_finish(m);
+    result->cpu = m->cpu;
+    result->pages_used = mem_pages_used(m);
+    result->loaded = true;
+}
+
+static void* worker_main(void* arg) {
+    Worker* w = (Worker*)arg;
+    int job;
+    while ((job = next_job(w)) >= 0) run_job(w, job);
+    return NULL;
+}
+
+// --- Output ---
+
+// Stable names for scripts, unlike executor_stop_reason_name()
+static const char* stop_token(StopReason reason) {
+    switch (reason) {
+        case STOP_NONE: return "none";
+        case STOP_HALT: return "halt";
+        case STOP_BUDGET: return "budget";
+        case STOP_ADDRESS: return "address";
+        case STOP_CYCLES: return "cycles";
+        case STOP_UNKNOWN_OPCODE: return "unknown_opcode";
+        case STOP_BREAKPOINT: return "breakpoint";
+        case STOP_WATCHPOINT: return "watchpoint";
+    }
+    return "unknown";
+}
+
+static void write_json_string(FILE* out, const char* s) {
+    fputc('"', out);
+    for (; *s; ++s) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\') fprintf(out, "\\%c", c);
+        else if (c < 0x20) fprintf(out, "\\u%04x", c);
+        else fputc(c, out);
+    }
+    fputc('"', out);
+}
+
+static void write_result(FILE* out, const char* file, const BatchResult* r) {
+    fprintf(out, "{\"file\": ");
+    write_json_string(out, file);
+    if (!r->loaded) {
+        fprintf(out, ", \"status\": \"load_error\"}\n");
+        return;
+    }
+    fprintf(out, ", \"status\": \"ok\", \"stop\": \"%s\", \"pc\": %u, \"sr\": %u",
+            stop_token(r->reason), r->cpu.pc, cpu_get_sr(&r->cpu));
+    fprintf(out, ", \"d\": [");
+    for (int i = 0; i < NUM_DATA_REGISTERS; ++i) fprintf(out, "%s%u", i ? ", " : "", r->cpu.d[i]);
+    fprintf(out, "], \"a\": [");
+    for (int i = 0; i < NUM_ADDRESS_REGISTERS; ++i) fprintf(out, "%s%u", i ? ", " : "", r->cpu.a[i]);
+    fprintf(out, "], \"instructions\": %lu, \"blocks\": %lu, \"pages\": %d",
+            r->counters.instructions, r->counters.blocks_entered, r->pages_used);
+    if (r->counters.native_ops || r->counters.lockstep_mismatches) {
+        fprintf(out, ", \"native_ops\": %lu, \"lockstep_mismatches\": %lu",
+                r->counters.native_ops, r->counters.lockstep_mismatches);
+    }
+#ifdef CYCLE_TIMING
+    fprintf(out, ", \"cycles\": %llu", (unsigned long long)r->cpu.cycles);
+#endif
+    fprintf(out, "}\n");
+}
+
+// --- Batch API ---
+
+int batch_run(const BatchConfig* config, FILE* out) {
+    Batch b;
+    memset(&b, 0, sizeof(b));
+    b.config = config;
+    b.options = config->options;
+    b.options.headless = true;
+    b.options.trace_file = NULL;
+    b.options.profile_file = NULL;
+
+    int threads = config->num_threads;
+    if (threads <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? (int)cpus : 1;
+    }
+    if (threads > config->num_files) threads = config->num_files;
+    if (threads < 1) threads = 1;
+    b.num_workers = threads;
+
+    b.results = (BatchResult*)calloc(config->num_files > 0 ? config->num_files : 1, sizeof(BatchResult));
+    b.workers = (Worker*)calloc(threads, sizeof(Worker));
+    if (!b.results || !b.workers) {
+        perror("Failed to allocate batch");
+        free(b.results);
+        free(b.workers);
+        return -1;
+    }
+
+    // Shared tables are built here, before any worker can race on them
+    executor_init();
+    for (int i = 0; i < threads; ++i) {
+        Worker* w = &b.workers[i];
+        w->batch = &b;
+        w->id = i;
+        w->machine = machine_create();
+        w->machine->quiet = true;
+        pthread_mutex_init(&w->queue.lock, NULL);
+        w->queue.head = (int)((long long)config->num_files * i / threads);
+        w->queue.tail = (int)((long long)config->num_files * (i + 1) / threads);
+    }
+    if (b.options.use_jit || b.options.jit_lockstep) jit_init(b.workers[0].machine);
+
+    // The calling thread is worker 0. A worker that fails to start loses
+    // its share to the others by stealing.
+    for (int i = 1; i < threads; ++i) {
+        Worker* w = &b.workers[i];
+        w->started = pthread_create(&w->thread, NULL, worker_main, w) == 0;
+        if (!w->started) fprintf(stderr, "WARN: Could not start batch worker %d.\n", i);
+    }
+    worker_main(&b.workers[0]);
+
+    // Every worker must be done before any queue goes, thieves visit them all
+    for (int i = 1; i < threads; ++i) {
+        if (b.workers[i].started) pthread_join(b.workers[i].thread, NULL);
+    }
+    int failures = 0;
+    for (int i = 0; i < threads; ++i) {
+        Worker* w = &b.workers[i];
+        pthread_mutex_destroy(&w->queue.lock);
+        machine_destroy(w->machine);
+    }
+    for (int i = 0; i < config->num_files; ++i) {
+        write_result(out, config->files[i], &b.results[i]);
+        if (!b.results[i].loaded) failures++;
+    }
+
+    free(b.results);
+    free(b.workers);
+    return failures;
+}
+
+char** batch_read_list(const char* filename, int* count) {
+    FILE* f = fopen(filename, "r");
+    if (!f) {
+        perror("Could not open file list");
+        return NULL;
+    }
+    int capacity = 64;
+    char** files = (char**)malloc(capacity * sizeof(char*));
+    *count = 0;
+    if (!files) {
+        perror("Failed to allocate file list");
+        fclose(f);
+        return NULL;
+    }
+
+    char* line = NULL;
+    size_t line_size = 0;
+    while (getline(&line, &line_size, f) != -1) {
+        char* start = line;
+        while (*start == ' ' || *start == '\t') start++;
+        char* end = start + strlen(start);
+        while (end > start && (end[-1] == '\n' || end[-1] == '\r' || end[-1] == ' ' || end[-1] == '\t')) end--;
+        *end = '\0';
+        if (*start == '\0' || *start == '#') continue;
+
+        if (*count == capacity) {
+            capacity *= 2;
+            char** grown = (char**)realloc(files, capacity * sizeof(char*));
+            if (!grown) break;
+            files = grown;
+        }
+        files[*count] = strdup(start);
+        if (!files[*count]) break;
+        (*count)++;
+    }
+    free(line);
+    fclose(f);
+    return files;
+}
+
+void batch_free_list(char** files, int count) {
+    for (int i = 0; i < count; ++i) free(files[i]);
+    free(files);
+}
@@ -0,0 +1,38 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "executor.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Runs many programs on a pool of worker threads, each with its own machine.
+// Programs are handed out with work stealing: every worker starts with an
+// equal share and takes from the others once its own share is used up.
+//
+// Results go to 'out' as JSON Lines, one object per program in input order:
+//   {"file": "...", "status": "ok", "stop": "halt", "pc": 65658, "sr": 9988,
+//    "d": [...], "a": [...], "instructions": 27, "blocks": 3, "pages": 2,
+//    "cycles": 312}
+// "status" is "load_error" for a program that could not be loaded; such a
+// line has no other fields. "pages" counts the 4 KB memory pages in use and
+// "cycles" is missing without cycle timing.
+
+typedef struct {
+    const char* const* files; // Assembly sources, or images ending in .bin/.img
+    int num_files;
+    int num_threads;          // 0 for one per online CPU
+    uint32_t load_address;    // Default start address, as with -a
+    bool devices;             // Attach the standard devices, as with -I; UART output is dropped
+    ExecOptions options;      // trace_file is ignored, output is always quiet
+} BatchConfig;
+
+// Returns the number of programs that could not be loaded, or -1 on error
+int batch_run(const BatchConfig* config, FILE* out);
+
+// Reads a file list, one path per line; blank lines and '#' comments are
+// skipped. The list and its strings are freed with batch_free_list().
+char** batch_read_list(const char* filename, int* count);
+void batch_free_list(char** files, int count);
+
+#endif // BATCH_H
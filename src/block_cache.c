@@ -0,0 +1,120 @@
+#include "block_cache.h"
+#include "memory.h"
+#include "idle.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BLOCK_CACHE_SIZE 4096 // Number of hash buckets, must be a power of 2
+
+struct BlockCache {
+    Block* buckets[BLOCK_CACHE_SIZE];
+    Block* retired;
+    BlockCacheStats stats;
+};
+
+static unsigned int hash(uint32_t pc) {
+    return (pc >> 1) & (BLOCK_CACHE_SIZE - 1); // Instructions are word aligned
+}
+
+void block_cache_init(Machine* m) {
+    block_cache_shutdown(m);
+    m->blocks = (struct BlockCache*)calloc(1, sizeof(struct BlockCache));
+    if (m->blocks == NULL) {
+        perror("Failed to allocate block cache");
+        exit(EXIT_FAILURE);
+    }
+}
+
+void block_cache_shutdown(Machine* m) {
+    struct BlockCache* cache = m->blocks;
+    if (cache == NULL) return;
+    for (int i = 0; i < BLOCK_CACHE_SIZE; ++i) {
+        Block* current = cache->buckets[i];
+        while (current != NULL) {
+            Block* temp = current;
+            current = current->next;
+            free(temp);
+        }
+    }
+    block_cache_reclaim(m);
+    free(cache);
+    m->blocks = NULL;
+}
+
+Block* block_cache_lookup(Machine* m, uint32_t pc) {
+    Block* current = m->blocks->buckets[hash(pc)];
+    while (current != NULL) {
+        if (current->start_pc == pc) {
+            return current;
+        }
+        current = current->next;
+    }
+    return NULL;
+}
+
+Block* block_cache_insert(Machine* m, const DecodedOp* ops, int num_ops) {
+    Block* block = (Block*)malloc(sizeof(Block) + num_ops * sizeof(DecodedOp));
+    if (block == NULL) {
+        perror("Failed to allocate block");
+        return NULL;
+    }
+    block->start_pc = ops[0].pc;
+    block->end_pc = ops[num_ops - 1].next_pc;
+    block->num_ops = num_ops;
+    block->exec_count = 0;
+    block->max_cycles = 0;
+    block->breakpoint = false;
+    for (int i = 0; i < num_ops; ++i) {
+        block->max_cycles += ops[i].cycles > ops[i].taken_cycles ? ops[i].cycles : ops[i].taken_cycles;
+        if (ops[i].flags & OPF_BREAKPOINT) block->breakpoint = true;
+    }
+    block->native = NULL;
+    block->native_ops = 0;
+    block->native_cycles = 0;
+    block->jit_tried = false;
+    memcpy(block->ops, ops, num_ops * sizeof(DecodedOp));
+    block->idle = (uint8_t)idle_classify(block);
+
+    unsigned int index = hash(block->start_pc);
+    block->next = m->blocks->buckets[index];
+    m->blocks->buckets[index] = block;
+
+    // Ask memory to report stores into the bytes this block was decoded from
+    mem_mark_code(m, block->start_pc, block->end_pc);
+    m->blocks->stats.blocks_built++;
+    return block;
+}
+
+void block_cache_invalidate(Machine* m, uint32_t start, uint32_t end) {
+    struct BlockCache* cache = m->blocks;
+    // Stores into code are rare, so a full sweep is cheaper than keeping
+    // per-page block lists up to date on every insert.
+    for (int i = 0; i < BLOCK_CACHE_SIZE; ++i) {
+        Block** link = &cache->buckets[i];
+        while (*link != NULL) {
+            Block* block = *link;
+            if (block->start_pc < end && block->end_pc > start) {
+                *link = block->next;
+                block->next = cache->retired;
+                cache->retired = block;
+                cache->stats.blocks_invalidated++;
+            } else {
+                link = &block->next;
+            }
+        }
+    }
+}
+
+void block_cache_reclaim(Machine* m) {
+    struct BlockCache* cache = m->blocks;
+    while (cache->retired != NULL) {
+        Block* temp = cache->retired;
+        cache->retired = temp->next;
+        free(temp);
+    }
+}
+
+const BlockCacheStats* block_cache_stats(Machine* m) {
+    return &m->blocks->stats;
+}
@@ -0,0 +1,49 @@
+#ifndef BLOCK_CACHE_H
+#define BLOCK_CACHE_H
+
+#include "executor.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+#define MAX_BLOCK_OPS 32 // Longest straight-line run decoded into one block
+
+// Native translation of a block prefix, see jit.h
+typedef void (*NativeBlock)(CPU* cpu);
+
+// A straight-line run of predecoded instructions, ending at a branch, an
+// undecodable opcode or MAX_BLOCK_OPS.
+typedef struct Block {
+    uint32_t start_pc;
+    uint32_t end_pc;     // Address after the last instruction
+    int num_ops;
+    unsigned long exec_count;
+    uint32_t max_cycles; // Clock cycles with every branch taken, an upper bound
+    NativeBlock native;  // Translated prefix, or NULL
+    int native_ops;      // Number of ops covered by 'native'
+    uint32_t native_cycles; // Their clock cycles, not counting a taken branch
+    bool jit_tried;      // Translation was attempted, successful or not
+    bool breakpoint;     // Some op has OPF_BREAKPOINT
+    uint8_t idle;        // IdleKind, see idle.h
+    struct Block* next;  // Hash chain, or retired list once invalidated
+    DecodedOp ops[];
+} Block;
+
+typedef struct {
+    unsigned long blocks_built;
+    unsigned long blocks_invalidated;
+} BlockCacheStats;
+
+void block_cache_init(Machine* m);
+void block_cache_shutdown(Machine* m);
+
+Block* block_cache_lookup(Machine* m, uint32_t pc);
+Block* block_cache_insert(Machine* m, const DecodedOp* ops, int num_ops);
+
+// Drops every block overlapping [start, end). Dropped blocks stay readable
+// until the next block_cache_reclaim(), so a block may invalidate itself.
+void block_cache_invalidate(Machine* m, uint32_t start, uint32_t end);
+void block_cache_reclaim(Machine* m);
+
+const BlockCacheStats* block_cache_stats(Machine* m);
+
+#endif // BLOCK_CACHE_H
@@ -0,0 +1,176 @@
+#include "bus.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char* kind_name(BusKind kind) {
+    switch (kind) {
+        case BUS_ROM: return "ROM";
+        case BUS_MMIO: return "MMIO";
+        case BUS_UNMAPPED: return "unmapped";
+    }
+    return "unknown";
+}
+
+// Checks the range and makes sure the bus exists. Returns the new region,
+// not yet entered into the page map, or NULL.
+static BusRegion* add_region(Machine* m, uint32_t start, uint32_t size, BusKind kind, const char* name) {
+    uint32_t page_mask = MEM_PAGE_SIZE - 1;
+    if (size == 0 || (start & page_mask) || (size & page_mask) || start + size - 1 < start) {
+        fprintf(stderr, "ERROR: %s region 0x%X+0x%X is not a range of whole pages.\n",
+                kind_name(kind), start, size);
+        return NULL;
+    }
+    if (!m->bus) {
+        m->bus = (struct Bus*)calloc(1, sizeof(struct Bus));
+        if (!m->bus) {
+            perror("Failed to allocate bus");
+            exit(EXIT_FAILURE);
+        }
+    }
+    struct Bus* bus = m->bus;
+    if (bus->num_regions == BUS_MAX_REGIONS) {
+        fprintf(stderr, "ERROR: No room for %s region at 0x%X.\n", kind_name(kind), start);
+        return NULL;
+    }
+    for (uint32_t offset = 0; offset < size; offset += MEM_PAGE_SIZE) {
+        const BusRegion* other = bus_region_at(m, start + offset);
+        if (other) {
+            fprintf(stderr, "ERROR: %s region at 0x%X overlaps %s at 0x%X.\n",
+                    kind_name(kind), start, other->name, other->start);
+            return NULL;
+        }
+    }
+
+    BusRegion* region = &bus->regions[bus->num_regions++];
+    memset(region, 0, sizeof(*region));
+    region->start = start;
+    region->size = size;
+    region->kind = kind;
+    region->name = name ? name : kind_name(kind);
+    return region;
+}
+
+// Enters a region into the page map. The RAM pages it covers go away first,
+// so the fast paths cannot find them.
+static void map_region(Machine* m, const BusRegion* region) {
+    struct Bus* bus = m->bus;
+    uint8_t number = (uint8_t)(region - bus->regions + 1);
+    mem_release_pages(m, region->start, region->size);
+    for (uint32_t offset = 0; offset < region->size; offset += MEM_PAGE_SIZE) {
+        uint32_t addr = region->start + offset;
+        uint8_t** table = &bus->page_region[addr >> MEM_DIR_SHIFT];
+        if (!*table) {
+            *table = (uint8_t*)calloc(MEM_TABLE_ENTRIES, 1);
+            if (!*table) {
+                perror("Failed to allocate bus page map");
+                exit(EXIT_FAILURE);
+            }
+        }
+        (*table)[(addr >> MEM_PAGE_SHIFT) & (MEM_TABLE_ENTRIES - 1)] = number;
+    }
+}
+
+bool bus_map_rom(Machine* m, uint32_t start, uint32_t size, const uint8_t* data, uint32_t length) {
+    BusRegion* region = add_region(m, start, size, BUS_ROM, NULL);
+    if (!region) return false;
+    map_region(m, region);
+    mem_install_rom(m, start, size, data, length < size ? length : size);
+    return true;
+}
+
+bool bus_map_mmio(Machine* m, uint32_t start, uint32_t size, const char* name,
+                  const BusHandlers* handlers, void* device) {
+    BusRegion* region = add_region(m, start, size, BUS_MMIO, name);
+    if (!region) return false;
+    region->handlers = handlers;
+    region->device = device;
+    map_region(m, region);
+    return true;
+}
+
+bool bus_map_unmapped(Machine* m, uint32_t start, uint32_t size) {
+    BusRegion* region = add_region(m, start, size, BUS_UNMAPPED, NULL);
+    if (!region) return false;
+    map_region(m, region);
+    return true;
+}
+
+void bus_shutdown(Machine* m) {
+    struct Bus* bus = m->bus;
+    if (!bus) return;
+    for (int i = 0; i < bus->num_regions; ++i) {
+        BusRegion* region = &bus->regions[i];
+        // ROM pages still trap stores, they go with the region
+        if (region->kind == BUS_ROM) mem_release_pages(m, region->start, region->size);
+        if (region->handlers && region->handlers->release) region->handlers->release(region->device);
+    }
+    for (int dir = 0; dir < MEM_DIR_ENTRIES; ++dir) free(bus->page_region[dir]);
+    free(bus);
+    m->bus = NULL;
+}
+
+uint64_t bus_next_change(Machine* m, uint32_t address, uint64_t after) {
+    const BusRegion* region = bus_region_at(m, address);
+    if (!region || region->kind != BUS_MMIO) return BUS_NEVER;
+    if (!region->handlers->next_change) return after;
+    return region->handlers->next_change(m, region->device, address - region->start, after);
+}
+
+// --- Device state ---
+
+struct BusState {
+    int num_regions;
+    uint32_t starts[BUS_MAX_REGIONS]; // To tell a different layout
+    size_t size;
+    uint8_t data[];
+};
+
+static size_t state_size(const BusRegion* region) {
+    return region->handlers ? region->handlers->state_size : 0;
+}
+
+BusState* bus_save_state(Machine* m) {
+    const struct Bus* bus = m->bus;
+    int num_regions = bus ? bus->num_regions : 0;
+    size_t size = 0;
+    for (int i = 0; i < num_regions; ++i) size += state_size(&bus->regions[i]);
+
+    BusState* state = (BusState*)malloc(sizeof(BusState) + size);
+    if (!state) {
+        perror("Failed to allocate device state");
+        exit(EXIT_FAILURE);
+    }
+    state->num_regions = num_regions;
+    state->size = size;
+    uint8_t* out = state->data;
+    for (int i = 0; i < num_regions; ++i) {
+        const BusRegion* region = &bus->regions[i];
+        state->starts[i] = region->start;
+        if (state_size(region) == 0) continue;
+        memcpy(out, region->device, state_size(region));
+        out += state_size(region);
+    }
+    return state;
+}
+
+bool bus_restore_state(Machine* m, const BusState* state) {
+    const struct Bus* bus = m->bus;
+    int num_regions = bus ? bus->num_regions : 0;
+    if (num_regions != state->num_regions) return false;
+    for (int i = 0; i < num_regions; ++i) {
+        if (bus->regions[i].start != state->starts[i]) return false;
+    }
+    const uint8_t* in = state->data;
+    for (int i = 0; i < num_regions; ++i) {
+        const BusRegion* region = &bus->regions[i];
+        if (state_size(region) == 0) continue;
+        memcpy(region->device, in, state_size(region));
+        in += state_size(region);
+    }
+    return true;
+}
+
+void bus_state_free(BusState* state) {
+    free(state);
+}
@@ -0,0 +1,94 @@
+#ifndef BUS_H
+#define BUS_H
+
+#include "memory.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// The bus decides what backs each 4 KB page of the address space. Pages no
+// region covers are RAM, as they always were. A region makes its pages ROM,
+// MMIO or unmapped:
+//   ROM       reads as RAM does, stores are dropped
+//   MMIO      reads and stores go to a device
+//   unmapped  reads as zero, stores are dropped
+// RAM and ROM pages are read through the page table as before. The other
+// pages never get a RAM page, so their accesses miss the fast paths in
+// memory.h and the slow paths look up the region of the page, one table
+// index per access rather than a search.
+
+typedef enum {
+    BUS_ROM,
+    BUS_MMIO,
+    BUS_UNMAPPED
+} BusKind;
+
+#define BUS_NEVER UINT64_MAX // No change coming, see next_change
+
+// Devices see byte accesses at an offset into their region. Wider accesses
+// arrive most significant byte first, as the bus would split them.
+//
+// next_change lets the executor skip idle loops that poll a device, see
+// idle.h. It returns the first device clock (see devices.h) after 'after'
+// at which a read of 'offset' may give another value than at 'after', as
+// long as nothing writes the device, or BUS_NEVER. A device whose reads
+// have side effects leaves it NULL.
+typedef struct BusHandlers {
+    uint8_t (*read)(Machine* m, void* device, uint32_t offset);
+    void (*write)(Machine* m, void* device, uint32_t offset, uint8_t value);
+    void (*release)(void* device); // Frees the device with the bus, may be NULL
+    size_t state_size;             // Bytes of device state a snapshot copies, 0 for none
+    uint64_t (*next_change)(Machine* m, void* device, uint32_t offset, uint64_t after); // May be NULL
+} BusHandlers;
+
+typedef struct BusRegion {
+    uint32_t start;
+    uint32_t size;
+    BusKind kind;
+    const char* name;
+    const BusHandlers* handlers; // MMIO only
+    void* device;
+} BusRegion;
+
+#define BUS_MAX_REGIONS 255 // Region numbers must fit the per-page byte
+
+struct Bus {
+    uint8_t* page_region[MEM_DIR_ENTRIES]; // Region number + 1 per page, NULL tables are all RAM
+    BusRegion regions[BUS_MAX_REGIONS];
+    int num_regions;
+};
+
+// Regions start and end on page boundaries and may not overlap. Any RAM
+// already in their pages is released. Return false on a bad range.
+bool bus_map_rom(Machine* m, uint32_t start, uint32_t size, const uint8_t* data, uint32_t length);
+bool bus_map_mmio(Machine* m, uint32_t start, uint32_t size, const char* name,
+                  const BusHandlers* handlers, void* device);
+bool bus_map_unmapped(Machine* m, uint32_t start, uint32_t size);
+
+// Releases every region and its device; the whole space is RAM again
+void bus_shutdown(Machine* m);
+
+// Device state for machine snapshots: the first state_size bytes of each
+// device, copied as they are. Restoring needs the regions the state was
+// saved with and fails, changing nothing, if they differ.
+typedef struct BusState BusState;
+BusState* bus_save_state(Machine* m);
+bool bus_restore_state(Machine* m, const BusState* state);
+void bus_state_free(BusState* state);
+
+// next_change of the byte at 'address'. RAM, ROM and unmapped bytes change
+// only when the CPU stores to them, so they never do; a device without
+// next_change may change at any time, which gives 'after'.
+uint64_t bus_next_change(Machine* m, uint32_t address, uint64_t after);
+
+// The region covering 'address', or NULL for plain RAM
+static inline const BusRegion* bus_region_at(const Machine* m, uint32_t address) {
+    const struct Bus* bus = m->bus;
+    if (!bus) return NULL;
+    const uint8_t* table = bus->page_region[address >> MEM_DIR_SHIFT];
+    if (!table) return NULL;
+    uint8_t region = table[(address >> MEM_PAGE_SHIFT) & (MEM_TABLE_ENTRIES - 1)];
+    return region ? &bus->regions[region - 1] : NULL;
+}
+
+#endif // BUS_H
@@ -1,4 +1,5 @@
 #include "cpu.h"
+#include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
 
@@ -14,7 +15,48 @@ void cpu_pulse_reset(CPU* cpu) {
     // 4. Loads PC from 0x000004.
     // For our simulator, we'll simplify this for now.
     cpu_init(cpu);
-    cpu->sr = (1 << SR_S) | (7 << SR_I0); // Supervisor mode, interrupt level 7
+    cpu_set_sr(cpu, (1 << SR_S) | (7 << SR_I0)); // Supervisor mode, interrupt level 7
+}
+
+uint16_t cpu_get_sr(const CPU* cpu) {
+    if (cpu->flags_op == FLAGS_NONE) {
+        return cpu->sr;
+    }
+
+    uint32_t msb_mask;
+    if (cpu->flags_size == 0) msb_mask = 0x80;          // Byte
+    else if (cpu->flags_size == 1) msb_mask = 0x8000;   // Word
+    else msb_mask = 0x80000000;                         // Long
+    uint32_t size_mask = msb_mask | (msb_mask - 1);
+
+    uint32_t result = cpu->flags_result & size_mask;
+    uint16_t ccr = 0;
+    if (result == 0) ccr |= 1 << SR_Z;
+    if (result & msb_mask) ccr |= 1 << SR_N;
+
+    if (cpu->flags_op == FLAGS_LOGIC) {
+        return (cpu->sr & ~((1 << SR_N) | (1 << SR_Z) | (1 << SR_V) | (1 << SR_C))) | ccr;
+    }
+
+    bool Sm = (cpu->flags_src & msb_mask) != 0;
+    bool Dm = (cpu->flags_dst & msb_mask) != 0;
+    bool Rm = (result & msb_mask) != 0;
+    bool v, c;
+    if (cpu->flags_op == FLAGS_SUB) {
+        v = (!Sm && Dm && !Rm) || (Sm && !Dm && Rm);
+        c = (Sm && !Dm) || (Rm && !Dm) || (Sm && Rm);
+    } else { // FLAGS_ADD
+        v = (!Sm && !Dm && Rm) || (Sm && Dm && !Rm);
+        c = (Sm && Dm) || (!Rm && Dm) || (Sm && !Rm);
+    }
+    if (v) ccr |= 1 << SR_V;
+    if (c) ccr |= (1 << SR_C) | (1 << SR_X);
+    return (cpu->sr & ~0x1F) | ccr;
+}
+
+void cpu_set_sr(CPU* cpu, uint16_t sr) {
+    cpu->sr = sr;
+    cpu->flags_op = FLAGS_NONE;
 }
 
 void cpu_dump_registers(CPU* cpu) {
@@ -27,7 +69,7 @@ void cpu_dump_registers(CPU* cpu) {
 
     // Line 2: SR and Address Registers, aligned with the line above
     printf("                             "); // Matches the 29-char width of instruction column
-    printf("SR: %04X     | ", cpu->sr);      // Padded to align with PC column
+    printf("SR: %04X     | ", cpu_get_sr(cpu)); // Padded to align with PC column
     for (int i = 0; i < NUM_ADDRESS_REGISTERS; ++i) {
         printf("A%d: %08X ", i, cpu->a[i]);
     }
@@ -19,15 +19,34 @@
 #define SR_V  1  // Overflow
 #define SR_C  0  // Carry
 
+// Condition codes are evaluated lazily. Instructions record how the flags
+// were produced and cpu_get_sr() derives the CCR bits when they are read.
+typedef enum {
+    FLAGS_NONE,  // sr holds the current flags
+    FLAGS_ADD,   // X N Z V C from flags_dst + flags_src
+    FLAGS_SUB,   // X N Z V C from flags_dst - flags_src
+    FLAGS_LOGIC, // N Z from flags_result, V and C clear, X unchanged in sr
+} FlagsOp;
+
 typedef struct {
     uint32_t d[NUM_DATA_REGISTERS];
     uint32_t a[NUM_ADDRESS_REGISTERS];
     uint32_t pc; // Program Counter
-    uint16_t sr; // Status Register
+    uint16_t sr; // Status Register, CCR bits are stale unless flags_op is FLAGS_NONE
+    uint8_t flags_op;   // FlagsOp of the last flag-setting instruction
+    uint8_t flags_size; // Its operand size code: 0=Byte, 1=Word, 2=Long
+    uint32_t flags_src;
+    uint32_t flags_dst;
+    uint32_t flags_result;
+#ifdef CYCLE_TIMING
+    uint64_t cycles; // Clock cycles executed, see timing.h
+#endif
 } CPU;
 
 void cpu_init(CPU* cpu);
 void cpu_pulse_reset(CPU* cpu); // Simulates a hardware reset
+uint16_t cpu_get_sr(const CPU* cpu);
+void cpu_set_sr(CPU* cpu, uint16_t sr);
 void cpu_dump_registers(CPU* cpu);
 
 #endif // CPU_H
@@ -0,0 +1,170 @@
+#include "debug.h"
+#include "memory.h"
+#include "block_cache.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef struct {
+    uint32_t start;
+    uint32_t length;
+    int kind;
+} Watchpoint;
+
+struct Debugger {
+    uint32_t breakpoints[DEBUG_MAX_BREAKPOINTS];
+    int num_breakpoints;
+    Watchpoint watchpoints[DEBUG_MAX_WATCHPOINTS];
+    int num_watchpoints;
+    WatchHit hit;
+    bool has_hit;
+};
+
+static struct Debugger* get_debugger(Machine* m) {
+    if (!m->debug) {
+        m->debug = (struct Debugger*)calloc(1, sizeof(struct Debugger));
+        if (!m->debug) {
+            perror("Failed to allocate debugger");
+            exit(EXIT_FAILURE);
+        }
+    }
+    return m->debug;
+}
+
+// Blocks already decoded over 'address' must be decoded again to pick up
+// a change of breakpoints
+static void redecode(Machine* m, uint32_t address) {
+    if (m->blocks) block_cache_invalidate(m, address, address + 1);
+}
+
+// --- Breakpoints ---
+
+bool debug_add_breakpoint(Machine* m, uint32_t address) {
+    struct Debugger* d = get_debugger(m);
+    for (int i = 0; i < d->num_breakpoints; ++i) {
+        if (d->breakpoints[i] == address) return true;
+    }
+    if (d->num_breakpoints == DEBUG_MAX_BREAKPOINTS) {
+        fprintf(stderr, "ERROR: No room for a breakpoint at 0x%X.\n", address);
+        return false;
+    }
+    d->breakpoints[d->num_breakpoints++] = address;
+    redecode(m, address);
+    return true;
+}
+
+void debug_remove_breakpoint(Machine* m, uint32_t address) {
+    struct Debugger* d = m->debug;
+    if (!d) return;
+    for (int i = 0; i < d->num_breakpoints; ++i) {
+        if (d->breakpoints[i] == address) {
+            d->breakpoints[i] = d->breakpoints[--d->num_breakpoints];
+            redecode(m, address);
+            return;
+        }
+    }
+}
+
+void debug_mark_breakpoints(Machine* m, DecodedOp* ops, int num_ops) {
+    const struct Debugger* d = m->debug;
+    for (int i = 0; i < num_ops; ++i) {
+        for (int j = 0; j < d->num_breakpoints; ++j) {
+            if (ops[i].pc == d->breakpoints[j]) ops[i].flags |= OPF_BREAKPOINT;
+        }
+    }
+}
+
+// --- Watchpoints ---
+
+static bool in_watchpoint(const Watchpoint* w, uint32_t address) {
+    return address - w->start < w->length;
+}
+
+// Called by memory for every byte accessed in a watched page
+static void on_watch(Machine* m, uint32_t address, uint8_t value, bool write) {
+    struct Debugger* d = m->debug;
+    int kind = write ? WATCH_WRITE : WATCH_READ;
+    for (int i = 0; i < d->num_watchpoints; ++i) {
+        const Watchpoint* w = &d->watchpoints[i];
+        if (!(w->kind & kind) || !in_watchpoint(w, address)) continue;
+        if (!m->watch_hit) {
+            d->hit.address = address;
+            d->hit.value = value;
+            d->hit.write = write;
+            d->has_hit = true;
+        }
+        m->watch_hit = true;
+        m->exec_break = true;
+        return;
+    }
+}
+
+static uint32_t first_page(const Watchpoint* w) {
+    return w->start & ~(uint32_t)(MEM_PAGE_SIZE - 1);
+}
+
+// Pages covered from first_page() on, wrapping at the end of memory
+static uint64_t page_count(const Watchpoint* w) {
+    uint64_t span = (w->start & (MEM_PAGE_SIZE - 1)) + (uint64_t)w->length - 1;
+    return (span >> MEM_PAGE_SHIFT) + 1;
+}
+
+// Watches or releases the pages of 'w'. A page stays watched while any
+// other watchpoint still covers it.
+static void watch_pages(Machine* m, const Watchpoint* w, bool watch) {
+    const struct Debugger* d = m->debug;
+    for (uint64_t n = 0; n < page_count(w); ++n) {
+        uint32_t page = first_page(w) + (uint32_t)(n << MEM_PAGE_SHIFT);
+        bool keep = false;
+        for (int i = 0; !watch && i < d->num_watchpoints; ++i) {
+            const Watchpoint* other = &d->watchpoints[i];
+            keep = keep || ((page - first_page(other)) >> MEM_PAGE_SHIFT) < page_count(other);
+        }
+        if (!keep) mem_watch_page(m, page, watch);
+    }
+}
+
+bool debug_add_watchpoint(Machine* m, uint32_t start, uint32_t length, int kind) {
+    struct Debugger* d = get_debugger(m);
+    if (length == 0 || !(kind & (WATCH_READ | WATCH_WRITE))) {
+        fprintf(stderr, "ERROR: Empty watchpoint at 0x%X.\n", start);
+        return false;
+    }
+    if (d->num_watchpoints == DEBUG_MAX_WATCHPOINTS) {
+        fprintf(stderr, "ERROR: No room for a watchpoint at 0x%X.\n", start);
+        return false;
+    }
+    Watchpoint* w = &d->watchpoints[d->num_watchpoints++];
+    w->start = start;
+    w->length = length;
+    w->kind = kind;
+    watch_pages(m, w, true);
+    mem_set_watch_hook(m, on_watch);
+    return true;
+}
+
+void debug_remove_watchpoint(Machine* m, uint32_t start) {
+    struct Debugger* d = m->debug;
+    if (!d) return;
+    for (int i = 0; i < d->num_watchpoints; ++i) {
+        if (d->watchpoints[i].start == start) {
+            Watchpoint removed = d->watchpoints[i];
+            d->watchpoints[i] = d->watchpoints[--d->num_watchpoints];
+            watch_pages(m, &removed, false);
+            return;
+        }
+    }
+}
+
+const WatchHit* debug_last_hit(Machine* m) {
+    return m->debug && m->debug->has_hit ? &m->debug->hit : NULL;
+}
+
+void debug_shutdown(Machine* m) {
+    struct Debugger* d = m->debug;
+    if (!d) return;
+    while (d->num_watchpoints > 0) debug_remove_watchpoint(m, d->watchpoints[0].start);
+    mem_set_watch_hook(m, NULL);
+    free(d);
+    m->debug = NULL;
+    m->watch_hit = false;
+}
@@ -0,0 +1,49 @@
+#ifndef DEBUG_H
+#define DEBUG_H
+
+#include "executor.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+// Breakpoints and watchpoints, both free while none is set.
+//
+// A breakpoint is flagged on its instruction when the block holding it is
+// decoded, so only that block runs with per-instruction checks. Execution
+// stops before the instruction, except as the first one of a run, so a run
+// can resume from it.
+//
+// A watchpoint takes the pages it covers off the memory fast paths, see
+// memory.h. Accesses to other pages cost nothing; accesses to a watched page
+// go through the slow path and are checked against the watched ranges.
+// Execution stops after the instruction that made the access. Instruction
+// fetches do not count as reads.
+
+#define DEBUG_MAX_BREAKPOINTS 64
+#define DEBUG_MAX_WATCHPOINTS 16
+
+#define WATCH_READ  0x01
+#define WATCH_WRITE 0x02
+
+typedef struct {
+    uint32_t address; // First watched byte accessed by the instruction
+    uint8_t value;    // Byte read or written there
+    bool write;
+} WatchHit;
+
+bool debug_add_breakpoint(Machine* m, uint32_t address);
+void debug_remove_breakpoint(Machine* m, uint32_t address);
+
+// Watches 'length' bytes from 'start' for WATCH_READ and/or WATCH_WRITE
+bool debug_add_watchpoint(Machine* m, uint32_t start, uint32_t length, int kind);
+void debug_remove_watchpoint(Machine* m, uint32_t start);
+
+// What stopped the last run with STOP_WATCHPOINT, or NULL
+const WatchHit* debug_last_hit(Machine* m);
+
+// Flags the decoded ops that have a breakpoint, see OPF_BREAKPOINT
+void debug_mark_breakpoints(Machine* m, DecodedOp* ops, int num_ops);
+
+// Removes every breakpoint and watchpoint
+void debug_shutdown(Machine* m);
+
+#endif // DEBUG_H
@@ -0,0 +1,177 @@
+#include "devices.h"
+#include "bus.h"
+#include "executor.h"
+#include <stdlib.h>
+
+uint64_t devices_clock(Machine* m) {
+#ifdef CYCLE_TIMING
+    return m->cpu.cycles;
+#else
+    return executor_counters(m)->instructions;
+#endif
+}
+
+// --- UART ---
+
+typedef struct {
+    FILE* out;
+} Uart;
+
+static uint8_t uart_read(Machine* m, void* device, uint32_t offset) {
+    (void)m; // Silence unused parameter warning
+    (void)device;
+    return offset == UART_STATUS ? UART_STATUS_TX_READY : 0;
+}
+
+static void uart_write(Machine* m, void* device, uint32_t offset, uint8_t value) {
+    (void)m; // Silence unused parameter warning
+    Uart* uart = (Uart*)device;
+    if (offset == UART_DATA && uart->out) fputc(value, uart->out);
+}
+
+// Reads always give the same value
+static uint64_t uart_next_change(Machine* m, void* device, uint32_t offset, uint64_t after) {
+    (void)m; // Silence unused parameter warning
+    (void)device;
+    (void)offset;
+    (void)after;
+    return BUS_NEVER;
+}
+
+static const BusHandlers uart_handlers = {uart_read, uart_write, free, sizeof(Uart), uart_next_change};
+
+bool uart_attach(Machine* m, uint32_t base, FILE* out) {
+    Uart* uart = (Uart*)calloc(1, sizeof(Uart));
+    if (!uart) {
+        perror("Failed to allocate UART");
+        exit(EXIT_FAILURE);
+    }
+    uart->out = out;
+    if (!bus_map_mmio(m, base, MEM_PAGE_SIZE, "UART", &uart_handlers, uart)) {
+        free(uart);
+        return false;
+    }
+    return true;
+}
+
+// --- Timer ---
+
+#define TIMER_REGISTER_BYTES 0x10
+
+typedef struct {
+    uint32_t reload;
+    uint32_t control;
+    uint64_t started;          // Clock when the count was last loaded
+    uint64_t acknowledged;     // Expiries already cleared from STATUS
+    uint32_t stopped_count;    // State frozen when the timer was stopped
+    uint64_t stopped_expiries;
+    uint8_t pending[TIMER_REGISTER_BYTES]; // Register bytes written so far
+} Timer;
+
+// Times the count reached zero since it was loaded, and the count at 'now'
+static uint64_t timer_state(const Timer* t, uint64_t now, uint32_t* count) {
+    if (!(t->control & TIMER_ENABLE)) {
+        *count = t->stopped_count;
+        return t->stopped_expiries;
+    }
+    uint64_t elapsed = now > t->started ? now - t->started : 0;
+    if (t->reload == 0) {
+        *count = 0;
+        return 1;
+    }
+    if (t->control & TIMER_PERIODIC) {
+        *count = t->reload - (uint32_t)(elapsed % t->reload);
+        return elapsed / t->reload;
+    }
+    *count = elapsed >= t->reload ? 0 : t->reload - (uint32_t)elapsed;
+    return elapsed >= t->reload ? 1 : 0;
+}
+
+static uint32_t timer_register(Machine* m, const Timer* t, uint32_t reg) {
+    uint32_t count;
+    uint64_t expiries = timer_state(t, devices_clock(m), &count);
+    switch (reg) {
+        case TIMER_COUNT: return count;
+        case TIMER_RELOAD: return t->reload;
+        case TIMER_CONTROL: return t->control;
+        case TIMER_STATUS: return expiries > t->acknowledged ? TIMER_EXPIRED : 0;
+    }
+    return 0;
+}
+
+static void timer_set_register(Machine* m, Timer* t, uint32_t reg, uint32_t value) {
+    uint32_t count;
+    uint64_t expiries = timer_state(t, devices_clock(m), &count);
+    switch (reg) {
+        case TIMER_RELOAD:
+            t->reload = value;
+            if (t->control & TIMER_ENABLE) { // Reload now, as enabling does
+                t->started = devices_clock(m);
+                t->acknowledged = 0;
+            }
+            break;
+        case TIMER_CONTROL:
+            if ((value & TIMER_ENABLE) && !(t->control & TIMER_ENABLE)) {
+                t->started = devices_clock(m);
+                t->acknowledged = 0;
+            } else if (!(value & TIMER_ENABLE) && (t->control & TIMER_ENABLE)) {
+                t->stopped_count = count;
+                t->stopped_expiries = expiries;
+            }
+            t->control = value & (TIMER_ENABLE | TIMER_PERIODIC);
+            break;
+        case TIMER_STATUS:
+            if (value & TIMER_EXPIRED) t->acknowledged = expiries;
+            break;
+    }
+}
+
+static uint8_t timer_read(Machine* m, void* device, uint32_t offset) {
+    if (offset >= TIMER_REGISTER_BYTES) return 0;
+    uint32_t value = timer_register(m, (Timer*)device, offset & ~3u);
+    return (value >> (8 * (3 - (offset & 3)))) & 0xFF;
+}
+
+static void timer_write(Machine* m, void* device, uint32_t offset, uint8_t value) {
+    Timer* t = (Timer*)device;
+    if (offset >= TIMER_REGISTER_BYTES) return;
+    t->pending[offset] = value;
+    if ((offset & 3) != 3) return;
+    const uint8_t* bytes = &t->pending[offset - 3];
+    uint32_t reg_value = ((uint32_t)bytes[0] << 24) | ((uint32_t)bytes[1] << 16) | ((uint32_t)bytes[2] << 8) | bytes[3];
+    timer_set_register(m, t, offset - 3, reg_value);
+}
+
+// COUNT changes on every tick while it runs. STATUS shows EXPIRED once the
+// expiries pass the acknowledged ones, and then keeps it until cleared.
+static uint64_t timer_next_change(Machine* m, void* device, uint32_t offset, uint64_t after) {
+    (void)m; // Silence unused parameter warning
+    const Timer* t = (const Timer*)device;
+    uint32_t reg = offset & ~3u;
+    if (!(t->control & TIMER_ENABLE) || t->reload == 0 || offset >= TIMER_REGISTER_BYTES) return BUS_NEVER;
+    uint32_t count;
+    uint64_t expiries = timer_state(t, after, &count);
+    bool periodic = t->control & TIMER_PERIODIC;
+    if (reg == TIMER_COUNT) return count || periodic ? after + 1 : BUS_NEVER;
+    if (reg != TIMER_STATUS || expiries > t->acknowledged || (!periodic && t->acknowledged)) return BUS_NEVER;
+    return t->started + (t->acknowledged + 1) * t->reload;
+}
+
+static const BusHandlers timer_handlers = {timer_read, timer_write, free, sizeof(Timer), timer_next_change};
+
+bool timer_attach(Machine* m, uint32_t base) {
+    Timer* t = (Timer*)calloc(1, sizeof(Timer));
+    if (!t) {
+        perror("Failed to allocate timer");
+        exit(EXIT_FAILURE);
+    }
+    if (!bus_map_mmio(m, base, MEM_PAGE_SIZE, "timer", &timer_handlers, t)) {
+        free(t);
+        return false;
+    }
+    return true;
+}
+
+bool devices_attach_standard(Machine* m, FILE* uart_out) {
+    return uart_attach(m, DEVICE_UART_BASE, uart_out) && timer_attach(m, DEVICE_TIMER_BASE);
+}
@@ -0,0 +1,47 @@
+#ifndef DEVICES_H
+#define DEVICES_H
+
+#include "machine.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Device models for the MMIO regions of bus.h. Each takes one 4 KB page.
+// Registers are big-endian. A multi-byte register takes effect when its
+// last byte is written, so write it with one MOVE or low byte last.
+
+// Addresses the standard board puts its devices at
+#define DEVICE_UART_BASE  0xFFFF0000
+#define DEVICE_TIMER_BASE 0xFFFF1000
+
+// UART, transmit only. Every byte written to DATA is sent at once, so TX
+// is always ready.
+#define UART_DATA   0x00 // 8 bits
+#define UART_STATUS 0x01 // 8 bits, read only
+#define UART_STATUS_TX_READY 0x01
+
+// Countdown timer, clocked by CPU cycles, or by instructions in a build
+// without cycle timing. Setting TIMER_ENABLE loads COUNT from RELOAD; it
+// counts down to zero and sets EXPIRED, then stops or, if periodic, starts
+// again from RELOAD. Writing EXPIRED to STATUS clears it.
+#define TIMER_COUNT   0x00 // 32 bits, read only
+#define TIMER_RELOAD  0x04 // 32 bits
+#define TIMER_CONTROL 0x08 // 32 bits
+#define TIMER_STATUS  0x0C // 32 bits
+#define TIMER_ENABLE   0x01
+#define TIMER_PERIODIC 0x02
+#define TIMER_EXPIRED  0x01
+
+// Time as the devices see it: CPU cycles, or instructions in a build without
+// cycle timing. Nothing ticks: a device works out its state from the clock
+// whenever it is accessed, so RAM traffic pays nothing.
+uint64_t devices_clock(Machine* m);
+
+// Map a device at 'base'. UART output goes to 'out', or nowhere if NULL.
+bool uart_attach(Machine* m, uint32_t base, FILE* out);
+bool timer_attach(Machine* m, uint32_t base);
+
+// The UART and timer at their standard addresses
+bool devices_attach_standard(Machine* m, FILE* uart_out);
+
+#endif // DEVICES_H
@@ -1,8 +1,11 @@
 #define _DEFAULT_SOURCE
 #include "disassembler.h"
+#include "isa.h"
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdarg.h>
+#include <stdbool.h>
 
 #define HASH_TABLE_SIZE 1024
 
@@ -11,13 +14,23 @@ typedef struct MappingNode {
     struct MappingNode* next;
 } MappingNode;
 
-static MappingNode* hash_table[HASH_TABLE_SIZE] = {NULL};
+struct SourceMap {
+    MappingNode* hash_table[HASH_TABLE_SIZE];
+};
 
 static unsigned int hash(uint32_t address) {
     return address % HASH_TABLE_SIZE;
 }
 
-void disassembler_add_mapping(uint32_t address, int line_number, const char* text) {
+SourceMap* disassembler_create(void) {
+    SourceMap* map = (SourceMap*)calloc(1, sizeof(SourceMap));
+    if (map == NULL) {
+        perror("Failed to allocate source map");
+    }
+    return map;
+}
+
+void disassembler_add_mapping(SourceMap* map, uint32_t address, int line_number, const char* text) {
     unsigned int index = hash(address);
     MappingNode* new_node = (MappingNode*)malloc(sizeof(MappingNode));
     if (new_node == NULL) {
@@ -27,13 +40,13 @@ void disassembler_add_mapping(uint32_t address, int line_number, const char* tex
     new_node->mapping.address = address;
     new_node->mapping.line_number = line_number;
     new_node->mapping.instruction_text = strdup(text);
-    new_node->next = hash_table[index];
-    hash_table[index] = new_node;
+    new_node->next = map->hash_table[index];
+    map->hash_table[index] = new_node;
 }
 
-SourceMapping* disassembler_get_mapping(uint32_t address) {
+SourceMapping* disassembler_get_mapping(SourceMap* map, uint32_t address) {
     unsigned int index = hash(address);
-    MappingNode* current = hash_table[index];
+    MappingNode* current = map->hash_table[index];
     while (current != NULL) {
         if (current->mapping.address == address) {
             return &current->mapping;
@@ -43,15 +56,192 @@ SourceMapping* disassembler_get_mapping(uint32_t address) {
     return NULL;
 }
 
-void disassembler_cleanup() {
+void disassembler_for_each(SourceMap* map, MappingVisitor visit, void* context) {
     for (int i = 0; i < HASH_TABLE_SIZE; ++i) {
-        MappingNode* current = hash_table[i];
+        for (MappingNode* current = map->hash_table[i]; current != NULL; current = current->next) {
+            visit(&current->mapping, context);
+        }
+    }
+}
+
+void disassembler_cleanup(SourceMap* map) {
+    if (map == NULL) return;
+    for (int i = 0; i < HASH_TABLE_SIZE; ++i) {
+        MappingNode* current = map->hash_table[i];
         while (current != NULL) {
             MappingNode* temp = current;
             current = current->next;
             free(temp->mapping.instruction_text);
             free(temp);
         }
-        hash_table[i] = NULL;
+        map->hash_table[i] = NULL;
     }
-}
\ No newline at end of file
+    free(map);
+}
+// --- Formatting Instructions ---
+
+// Appends to a bounded text buffer, dropping what does not fit
+typedef struct {
+    char* text;
+    size_t length;
+    size_t used;
+} TextBuffer;
+
+static void put(TextBuffer* b, const char* format, ...) {
+    if (b->used >= b->length) return;
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(b->text + b->used, b->length - b->used, format, args);
+    va_end(args);
+    if (n > 0) b->used += (size_t)n;
+}
+
+// Extension words are read through here so missing ones can be shown
+typedef struct {
+    const uint16_t* words;
+    int num_words;
+    int next; // Index of the next extension word
+} WordReader;
+
+static bool next_word(WordReader* r, uint16_t* word) {
+    int index = r->next++;
+    if (index >= r->num_words) return false;
+    *word = r->words[index];
+    return true;
+}
+
+static void put_word(TextBuffer* b, WordReader* r, const char* format) {
+    uint16_t word;
+    if (next_word(r, &word)) put(b, format, word);
+    else put(b, "?");
+}
+
+static void put_long(TextBuffer* b, WordReader* r, const char* format) {
+    uint16_t high, low;
+    bool ok = next_word(r, &high);
+    ok = next_word(r, &low) && ok;
+    if (ok) put(b, format, ((uint32_t)high << 16) | low);
+    else put(b, "?");
+}
+
+// Brief format index extension word, "(d8,An,Xn.s)"
+static void put_index(TextBuffer* b, WordReader* r, const char* base) {
+    uint16_t ext;
+    if (!next_word(r, &ext)) {
+        put(b, "?(%s,?)", base);
+    } else if (ext & 0x0100) {
+        put(b, "(%s,...)", base); // 68020 full format, not taken apart
+    } else {
+        put(b, "%d(%s,%c%d.%c)", (int8_t)(ext & 0xFF), base, (ext & 0x8000) ? 'A' : 'D', (ext >> 12) & 7,
+            (ext & 0x0800) ? 'L' : 'W');
+    }
+}
+
+// An effective address, 'ea' is mode << 3 | reg
+static void put_ea(TextBuffer* b, WordReader* r, uint8_t ea, int size_code) {
+    int reg = ea & 7;
+    char base[4];
+    snprintf(base, sizeof(base), "A%d", reg);
+    uint16_t word;
+    switch (ea >> 3) {
+        case 0: put(b, "D%d", reg); break;
+        case 1: put(b, "A%d", reg); break;
+        case 2: put(b, "(A%d)", reg); break;
+        case 3: put(b, "(A%d)+", reg); break;
+        case 4: put(b, "-(A%d)", reg); break;
+        case 5:
+            if (next_word(r, &word)) put(b, "%d(A%d)", (int16_t)word, reg);
+            else put(b, "?(A%d)", reg);
+            break;
+        case 6: put_index(b, r, base); break;
+        default:
+            switch (reg) {
+                case 0: put_word(b, r, "$%X.W"); break;
+                case 1: put_long(b, r, "$%X.L"); break;
+                case 2:
+                    if (next_word(r, &word)) put(b, "%d(PC)", (int16_t)word);
+                    else put(b, "?(PC)");
+                    break;
+                case 3: put_index(b, r, "PC"); break;
+                case 4:
+                    put(b, "#");
+                    if (size_code == 2) put_long(b, r, "$%X");
+                    else if (size_code == 1) put_word(b, r, "$%X");
+                    else if (next_word(r, &word)) put(b, "$%X", word & 0xFF);
+                    else put(b, "?");
+                    break;
+                default: put(b, "?"); break;
+            }
+            break;
+    }
+}
+
+int disassembler_format(const uint16_t* words, int num_words, uint32_t pc, char* text, size_t length) {
+    TextBuffer b = { text, length, 0 };
+    if (length > 0) text[0] = '\0';
+    uint16_t opcode = words[0];
+    const IsaEntry* entry = isa_match(opcode);
+    if (!entry) {
+        put(&b, "DC.W $%04X", opcode);
+        return 0;
+    }
+
+    static const char size_names[] = { 'B', 'W', 'L' };
+    int size_code = isa_size_code(entry, opcode);
+    char size = size_names[size_code];
+    WordReader r = { words, num_words, 1 };
+    switch (entry->form) {
+        case FORM_NONE:
+            put(&b, "%s", entry->mnemonic);
+            break;
+        case FORM_QUICK: {
+            uint32_t quick = isa_get_field(entry, opcode, ISA_FIELD_QUICK);
+            put(&b, "%s.%c #%u,D%u", entry->mnemonic, size, quick ? quick : 8,
+                isa_get_field(entry, opcode, ISA_FIELD_DN));
+            break;
+        }
+        case FORM_IMM:
+            put(&b, "%s.%c ", entry->mnemonic, size);
+            put_ea(&b, &r, 0x3C, size_code);
+            put(&b, ",D%u", isa_get_field(entry, opcode, ISA_FIELD_DN));
+            break;
+        case FORM_BIT_IMM:
+            put(&b, "%s #", entry->mnemonic);
+            put_word(&b, &r, "%u");
+            put(&b, ",D%u", isa_get_field(entry, opcode, ISA_FIELD_DN));
+            break;
+        case FORM_MOVE: {
+            uint8_t src = (uint8_t)isa_get_field(entry, opcode, ISA_FIELD_SRC_EA);
+            uint8_t field = (uint8_t)isa_get_field(entry, opcode, ISA_FIELD_DST_EA);
+            uint8_t dst = (uint8_t)(((field & 7) << 3) | (field >> 3)); // Stored register then mode
+            put(&b, "%s%s.%c ", entry->mnemonic, (dst >> 3) == 1 ? "A" : "", size);
+            put_ea(&b, &r, src, size_code);
+            put(&b, ",");
+            put_ea(&b, &r, dst, size_code);
+            break;
+        }
+        case FORM_REG:
+            put(&b, "%s.%c D%u,D%u", entry->mnemonic, size, isa_get_field(entry, opcode, ISA_FIELD_DM),
+                isa_get_field(entry, opcode, ISA_FIELD_DN));
+            break;
+        case FORM_BRANCH: {
+            int condition = (int)isa_get_field(entry, opcode, ISA_FIELD_CONDITION);
+            const char* name = isa_condition_name(condition);
+            int8_t displacement = (int8_t)isa_get_field(entry, opcode, ISA_FIELD_DISPLACEMENT);
+            put(&b, "%s%s", entry->mnemonic, name ? name : "SR");
+            uint16_t word;
+            if (displacement != 0) {
+                put(&b, ".S $%X", pc + 2 + displacement);
+            } else if (next_word(&r, &word)) {
+                put(&b, ".W $%X", pc + 2 + (int16_t)word);
+            } else {
+                put(&b, ".W ?");
+            }
+            break;
+        }
+        default:
+            put(&b, "%s ?", entry->mnemonic);
+            break;
+    }
+    return r.next;
+}
@@ -2,6 +2,7 @@
 #define DISASSEMBLER_H
 
 #include <stdint.h>
+#include <stddef.h>
 
 // A structure to map a memory address back to the source file
 typedef struct {
@@ -10,8 +11,22 @@ typedef struct {
     char* instruction_text;
 } SourceMapping;
 
-void disassembler_add_mapping(uint32_t address, int line_number, const char* text);
-SourceMapping* disassembler_get_mapping(uint32_t address);
-void disassembler_cleanup();
+// All mappings of one program, owned by its Machine
+typedef struct SourceMap SourceMap;
+
+SourceMap* disassembler_create(void);
+void disassembler_add_mapping(SourceMap* map, uint32_t address, int line_number, const char* text);
+SourceMapping* disassembler_get_mapping(SourceMap* map, uint32_t address);
+void disassembler_cleanup(SourceMap* map); // Frees the map and all its mappings
+
+// Calls 'visit' for every mapping, in no particular order
+typedef void (*MappingVisitor)(const SourceMapping* mapping, void* context);
+void disassembler_for_each(SourceMap* map, MappingVisitor visit, void* context);
+
+// Writes the instruction in 'words', the opcode and its extension words, as
+// assembler text such as "ADDQ.L #1,D0". Extension words past 'num_words'
+// are shown as "?". Returns the number of words the instruction takes, or 0
+// for an unknown opcode, which is written as "DC.W $xxxx".
+int disassembler_format(const uint16_t* words, int num_words, uint32_t pc, char* text, size_t length);
 
 #endif // DISASSEMBLER_H
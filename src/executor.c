@@ -1,113 +1,261 @@
 #include "executor.h"
+#include "block_cache.h"
+#include "jit.h"
 #include "memory.h"
 #include "disassembler.h"
+#include "trace.h"
+#include "timing.h"
+#include "debug.h"
+#include "profile.h"
+#include "idle.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdbool.h>
-
-#define MAX_EXECUTION_CYCLES 5000 // Safety break to prevent infinite loops
+#include <string.h>
+#include <limits.h>
+#include <time.h>
 
 // --- Forward declarations for instruction handler functions ---
-static void handle_move_b(CPU* cpu, uint16_t opcode);
-static void handle_move_l(CPU* cpu, uint16_t opcode);
-static void handle_move_w(CPU* cpu, uint16_t opcode);
-static void handle_subq(CPU* cpu, uint16_t opcode);
-static void handle_subi(CPU* cpu, uint16_t opcode);
-static void handle_sub_reg(CPU* cpu, uint16_t opcode);
-static void handle_add_reg(CPU* cpu, uint16_t opcode);
-static void handle_addq(CPU* cpu, uint16_t opcode);
-static void handle_addi(CPU* cpu, uint16_t opcode);
-static void handle_andi(CPU* cpu, uint16_t opcode);
-static void handle_btst_imm(CPU* cpu, uint16_t opcode);
-static void handle_bchg_imm(CPU* cpu, uint16_t opcode);
-static void handle_bclr_imm(CPU* cpu, uint16_t opcode);
-static void handle_bset_imm(CPU* cpu, uint16_t opcode);
-static void handle_bcc(CPU* cpu, uint16_t opcode);
-static void handle_nop(CPU* cpu, uint16_t opcode);
-static void handle_rts(CPU* cpu, uint16_t opcode);
-
-// --- Opcode to Handler Lookup Table ---
-// The order is important! More specific masks must come before more general ones.
-static const OpcodeMapping instruction_table[] = {
-    { 0xFFF8, 0x0800, handle_btst_imm }, // BTST #imm,Dn
-    { 0xFFF8, 0x0840, handle_bchg_imm }, // BCHG #imm,Dn
-    { 0xFFF8, 0x0880, handle_bclr_imm }, // BCLR #imm,Dn
-    { 0xFFF8, 0x08C0, handle_bset_imm }, // BSET #imm,Dn
-    { 0xFF38, 0x0200, handle_andi },     // ANDI #<data>,Dn
-    { 0xFF38, 0x0400, handle_subi },     // SUBI #<data>,Dn
-    { 0xFF38, 0x0600, handle_addi },     // ADDI #<data>,Dn
-    { 0xF138, 0x5000, handle_addq },     // ADDQ #imm,Dn
-    { 0xF138, 0x5100, handle_subq },     // SUBQ #imm,Dn
-    { 0xF000, 0x1000, handle_move_b },   // MOVE.B
-    { 0xF000, 0x2000, handle_move_l },   // MOVE.L / MOVEA.L
-    { 0xF000, 0x3000, handle_move_w },   // MOVE.W / MOVEA.W
-    { 0xF000, 0x6000, handle_bcc },      // Bcc
-    { 0xF038, 0x9000, handle_sub_reg },  // SUB.B/W/L Dm,Dn
-    { 0xF038, 0xD000, handle_add_reg },  // ADD.B/W/L Dm,Dn
-    { 0xFFFF, 0x4E71, handle_nop },      // NOP
-    { 0xFFFF, 0x4E75, handle_rts },      // RTS
-};
-static const int num_opcodes = sizeof(instruction_table) / sizeof(OpcodeMapping);
+#define ISA(kind, mnemonic, pattern, form, sizes, flags, cycles, cycles_long, handler) \
+    static void handler(Machine* m, const DecodedOp* op);
+#include "isa.def"
+
+// Generated into handlers.inc by gen_isa, with the handler variants
+// specialised by operand size and EA class
+static uint16_t select_handler(int kind, uint16_t opcode, int size_code);
+static InstructionHandler handler_for(uint16_t id);
+#ifdef THREADED_CORE
+static void fuse_ops(DecodedOp* ops, int num_ops);
+#endif
+
+// --- Precomputed Opcode Dispatch Table ---
+// One entry per possible opcode word, so dispatch is a single indexed load
+// instead of a mask/compare scan over isa_table.
+#define DISPATCH_TABLE_SIZE 0x10000
+
+static InstructionHandler dispatch_table[DISPATCH_TABLE_SIZE];
+static OpcodeInfo opcode_info[DISPATCH_TABLE_SIZE];
+static bool dispatch_ready = false;
+
+
+// The priority scan over isa_table
+static int lookup_mapping_linear(uint16_t opcode) {
+    const IsaEntry* entry = isa_match(opcode);
+    return entry ? (int)(entry - isa_table) : OPCODE_UNMAPPED;
+}
+
+void executor_init(void) {
+    if (dispatch_ready) return;
+
+    for (uint32_t opcode = 0; opcode < DISPATCH_TABLE_SIZE; ++opcode) {
+        int index = lookup_mapping_linear(opcode);
+        OpcodeInfo* info = &opcode_info[opcode];
+        if (index == OPCODE_UNMAPPED) {
+            dispatch_table[opcode] = NULL;
+            info->handler_id = 0;
+            info->mapping = OPCODE_UNMAPPED;
+            info->size_code = 0;
+            info->flags = 0;
+        } else {
+            info->mapping = index;
+            info->size_code = isa_size_code(&isa_table[index], opcode);
+            info->handler_id = select_handler(index, opcode, info->size_code);
+            dispatch_table[opcode] = handler_for(info->handler_id);
+            info->flags = isa_table[index].flags;
+        }
+    }
+    dispatch_ready = true;
+}
 
+// --- Instruction Decoder ---
 
-// Helper to set/clear status register flags
-void set_sr_flag(CPU* cpu, int flag, bool set) {
-    if (set) {
-        cpu->sr |= (1 << flag);
-    } else {
-        cpu->sr &= ~(1 << flag);
+// Appends the next instruction stream word to the op's extension words
+static uint16_t fetch_extension(Machine* m, DecodedOp* op) {
+    uint16_t word = mem_fetch_word(m, op->pc + 2 + 2 * op->num_ext);
+    op->ext[op->num_ext++] = word;
+    return word;
+}
+
+// Fetches the extension words of an indexed EA: one brief format word, or a
+// 68020+ full format word followed by its base and outer displacements
+static void decode_index_extension(Machine* m, DecodedOp* op) {
+    uint16_t extension_word = fetch_extension(m, op);
+    if (!(extension_word & 0x0100)) return; // 68000 Brief Format
+
+    int bd_size_code = (extension_word >> 4) & 3;
+    int iis = extension_word & 7;
+    int words = (bd_size_code == 2) ? 1 : (bd_size_code == 3) ? 2 : 0;
+    if (iis == 0b010 || iis == 0b110) words += 1; // Word OD
+    if (iis == 0b011 || iis == 0b111) words += 2; // Long OD
+    while (words-- > 0) fetch_extension(m, op);
+}
+
+// Fetches whatever extension words an EA field needs
+static void decode_ea_extension(Machine* m, DecodedOp* op, uint8_t ea_field, int size_code) {
+    uint8_t mode = (ea_field >> 3) & 0x7;
+    uint8_t reg = ea_field & 0x7;
+
+    switch (mode) {
+        case 5: fetch_extension(m, op); break; // d16(An)
+        case 6: decode_index_extension(m, op); break; // d8(An,Xn) or full format
+        case 7:
+            switch (reg) {
+                case 0: fetch_extension(m, op); break; // Absolute Short
+                case 1: fetch_extension(m, op); fetch_extension(m, op); break; // Absolute Long
+                case 2: fetch_extension(m, op); break; // d16(PC)
+                case 3: decode_index_extension(m, op); break; // d8(PC,Xn) or full format
+                case 4: // Immediate
+                    fetch_extension(m, op);
+                    if (size_code == 2) fetch_extension(m, op);
+                    break;
+            }
+            break;
+        default: break; // Register and plain indirect modes have no extensions
     }
 }
 
-void set_flags(CPU* cpu, uint32_t S, uint32_t D, uint32_t R, int size_code, bool is_sub) {
-    uint32_t msb_mask;
-    uint32_t size_mask;
-    if (size_code == 0) { // Byte
-        msb_mask = 0x80;
-        size_mask = 0xFF;
-    } else if (size_code == 1) { // Word
-        msb_mask = 0x8000;
-        size_mask = 0xFFFF;
-    } else { // Long
-        msb_mask = 0x80000000;
-        size_mask = 0xFFFFFFFF;
+// Decodes the instruction at 'pc'. Returns false for an unmapped opcode.
+static bool decode_instruction(Machine* m, uint32_t pc, DecodedOp* op) {
+    uint16_t opcode = mem_fetch_word(m, pc);
+    const OpcodeInfo* info = &opcode_info[opcode];
+    if (info->mapping == OPCODE_UNMAPPED) return false;
+
+    op->handler = dispatch_table[opcode];
+    op->handler_id = info->handler_id;
+    op->dispatch_id = info->handler_id;
+    op->pc = pc;
+    op->opcode = opcode;
+    op->kind = info->mapping;
+    op->size_code = info->size_code;
+    op->flags = info->flags;
+    op->rx = (opcode >> 9) & 0x7;
+    op->ry = opcode & 0x7;
+    op->src_ea = opcode & 0x3F;
+    op->dst_ea = (((opcode >> 6) & 0x7) << 3) | op->rx;
+    op->src_ext = 0;
+    op->dst_ext = 0;
+    op->num_ext = 0;
+    op->imm = 0;
+
+    switch (isa_table[info->mapping].form) {
+        case FORM_QUICK:
+            op->imm = (op->rx == 0) ? 8 : op->rx;
+            break;
+        case FORM_IMM:
+            if (op->size_code == 0) { // Byte, upper byte of the word is ignored
+                op->imm = fetch_extension(m, op) & 0xFF;
+            } else if (op->size_code == 1) { // Word
+                op->imm = fetch_extension(m, op);
+            } else { // Long
+                op->imm = (uint32_t)fetch_extension(m, op) << 16;
+                op->imm |= fetch_extension(m, op);
+            }
+            op->dst_ea = op->src_ea;
+            op->dst_ext = op->num_ext;
+            decode_ea_extension(m, op, op->dst_ea, op->size_code);
+            break;
+        case FORM_BIT_IMM: {
+            uint8_t bit_num = fetch_extension(m, op) & 0xFF;
+            op->imm = 1u << (bit_num % 32); // Dn forms operate on all 32 bits
+            op->dst_ea = op->src_ea;
+            op->dst_ext = op->num_ext;
+            decode_ea_extension(m, op, op->dst_ea, op->size_code);
+            break;
+        }
+        case FORM_MOVE:
+            op->src_ext = op->num_ext;
+            decode_ea_extension(m, op, op->src_ea, op->size_code);
+            op->dst_ext = op->num_ext;
+            decode_ea_extension(m, op, op->dst_ea, op->size_code);
+            break;
+        case FORM_REG:
+            op->src_ext = op->num_ext;
+            decode_ea_extension(m, op, op->src_ea, op->size_code);
+            break;
+        case FORM_BRANCH: {
+            int32_t displacement = (int8_t)(opcode & 0xFF);
+            if (displacement == 0) { // 16-bit displacement follows the opcode
+                displacement = (int16_t)fetch_extension(m, op);
+            }
+            op->imm = pc + 2 + displacement;
+            break;
+        }
+        default:
+            break;
     }
 
-    uint32_t result = R & size_mask;
-    set_sr_flag(cpu, SR_Z, result == 0);
-    set_sr_flag(cpu, SR_N, (result & msb_mask) != 0);
+    op->next_pc = pc + 2 + 2 * op->num_ext;
+    timing_decode(op);
+    return true;
+}
 
-    bool Sm = (S & msb_mask) != 0;
-    bool Dm = (D & msb_mask) != 0;
-    bool Rm = (result & msb_mask) != 0;
+// Decodes a straight-line run starting at 'pc' and adds it to the block cache.
+// Returns NULL if the first opcode cannot be decoded.
+static Block* build_block(Machine* m, uint32_t pc) {
+    DecodedOp ops[MAX_BLOCK_OPS];
+    int num_ops = 0;
+    uint32_t address = pc;
 
-    if (is_sub) { // Subtraction
-        set_sr_flag(cpu, SR_V, (Sm && !Dm && !Rm) || (!Sm && Dm && Rm));
-        set_sr_flag(cpu, SR_C, (Sm && !Dm) || (Rm && !Dm) || (Sm && Rm));
-    } else { // Addition
-        set_sr_flag(cpu, SR_V, (!Sm && !Dm && Rm) || (Sm && Dm && !Rm));
-        set_sr_flag(cpu, SR_C, (Sm && Dm) || (!Rm && Dm) || (Sm && !Rm));
+    while (num_ops < MAX_BLOCK_OPS && decode_instruction(m, address, &ops[num_ops])) {
+        address = ops[num_ops].next_pc;
+        if (ops[num_ops++].flags & OPF_BRANCH) break;
     }
+    if (num_ops == 0) return NULL;
+#ifdef THREADED_CORE
+    fuse_ops(ops, num_ops);
+#endif
+    if (m->debug) debug_mark_breakpoints(m, ops, num_ops);
+    return block_cache_insert(m, ops, num_ops);
+}
+
 
-    set_sr_flag(cpu, SR_X, (cpu->sr & (1 << SR_C)) != 0);
+// Helper to set/clear a status register bit. Pending lazy flags are
+// materialised first, since the other CCR bits must survive.
+static void set_sr_flag(CPU* cpu, int flag, bool set) {
+    uint16_t sr = cpu_get_sr(cpu);
+    if (set) {
+        sr |= (1 << flag);
+    } else {
+        sr &= ~(1 << flag);
+    }
+    cpu_set_sr(cpu, sr);
 }
 
-void set_logic_flags(CPU* cpu, uint32_t result, int size_code) {
-    set_sr_flag(cpu, SR_C, false);
-    set_sr_flag(cpu, SR_V, false);
-    if (size_code == 0) { // Byte
-        set_sr_flag(cpu, SR_Z, (result & 0xFF) == 0);
-        set_sr_flag(cpu, SR_N, (result & 0x80) != 0);
-    } else if (size_code == 1) { // Word
-        set_sr_flag(cpu, SR_Z, (result & 0xFFFF) == 0);
-        set_sr_flag(cpu, SR_N, (result & 0x8000) != 0);
-    } else { // Long
-        set_sr_flag(cpu, SR_Z, result == 0);
-        set_sr_flag(cpu, SR_N, (result & 0x80000000) != 0);
+// Records an add or subtract for lazy evaluation, see cpu_get_sr()
+static inline void set_flags(CPU* cpu, uint32_t S, uint32_t D, uint32_t R, int size_code, bool is_sub) {
+    cpu->flags_op = is_sub ? FLAGS_SUB : FLAGS_ADD;
+    cpu->flags_size = size_code;
+    cpu->flags_src = S;
+    cpu->flags_dst = D;
+    cpu->flags_result = R;
+}
+
+static inline void set_logic_flags(CPU* cpu, uint32_t result, int size_code) {
+    // Logic results keep X, which a pending add/sub has not written to sr yet
+    if (cpu->flags_op == FLAGS_ADD || cpu->flags_op == FLAGS_SUB) {
+        cpu_set_sr(cpu, cpu_get_sr(cpu));
     }
+    cpu->flags_op = FLAGS_LOGIC;
+    cpu->flags_size = size_code;
+    cpu->flags_result = result;
+}
+
+// Reads a long from two consecutive extension words
+static inline uint32_t ext_long(const DecodedOp* op, int index) {
+    return ((uint32_t)op->ext[index] << 16) | op->ext[index + 1];
+}
+
+// Address of an extension word in memory, the base for PC-relative modes
+static inline uint32_t ext_address(const DecodedOp* op, int index) {
+    return op->pc + 2 + 2 * index;
 }
 
-// Decodes a 68020+ full format extension word and computes the address
-uint32_t resolve_full_format_ea(CPU* cpu, uint32_t base_reg_val, uint16_t extension_word) {
+// Decodes a 68020+ full format extension word and computes the address.
+// 'index' points at the extension word; displacements follow it.
+uint32_t resolve_full_format_ea(Machine* m, uint32_t base_reg_val, const DecodedOp* op, int index) {
+    CPU* cpu = &m->cpu;
+    uint16_t extension_word = op->ext[index++];
+
     // 1. Decode all fields from the extension word
     bool index_is_an      = (extension_word >> 15) & 1;
     int index_reg_num     = (extension_word >> 12) & 7;
@@ -116,10 +264,10 @@ uint32_t resolve_full_format_ea(CPU* cpu, uint32_t base_reg_val, uint16_t extens
     int bd_size_code      = (extension_word >> 4) & 3;
     int iis               = extension_word & 7;
 
-    // 2. Read Base Displacement (BD) from instruction stream if present
+    // 2. Read Base Displacement (BD) from the extension words if present
     int32_t base_disp = 0;
-    if (bd_size_code == 2) { base_disp = (int16_t)mem_read_word(cpu->pc); cpu->pc += 2; }
-    else if (bd_size_code == 3) { base_disp = mem_read_long(cpu->pc); cpu->pc += 4; }
+    if (bd_size_code == 2) { base_disp = (int16_t)op->ext[index]; index += 1; }
+    else if (bd_size_code == 3) { base_disp = ext_long(op, index); index += 2; }
 
     // 3. Get the scaled index register value
     uint32_t index_val = index_is_an ? cpu->a[index_reg_num] : cpu->d[index_reg_num];
@@ -138,10 +286,10 @@ uint32_t resolve_full_format_ea(CPU* cpu, uint32_t base_reg_val, uint16_t extens
 
     if (pre_indexed) {
         // Add index *before* the memory fetch
-        final_ea = mem_read_long(temp_addr + scaled_index);
+        final_ea = mem_read_long(m, temp_addr + scaled_index);
     } else if (post_indexed) {
         // Add index *after* the memory fetch
-        final_ea = mem_read_long(temp_addr) + scaled_index;
+        final_ea = mem_read_long(m, temp_addr) + scaled_index;
     } else {
         // No indirection (iis == 0b000)
         final_ea = temp_addr + scaled_index;
@@ -155,9 +303,9 @@ uint32_t resolve_full_format_ea(CPU* cpu, uint32_t base_reg_val, uint16_t extens
         // OD size is determined by bit 2 of the iis field
         bool od_is_long = (iis & 1) != 0; // Bit 0 of iis
         if (od_is_long) {
-             outer_disp = mem_read_long(cpu->pc); cpu->pc += 4;
+             outer_disp = ext_long(op, index);
         } else { // Word OD
-             outer_disp = (int16_t)mem_read_word(cpu->pc); cpu->pc += 2;
+             outer_disp = (int16_t)op->ext[index];
         }
         final_ea += outer_disp;
     }
@@ -165,8 +313,26 @@ uint32_t resolve_full_format_ea(CPU* cpu, uint32_t base_reg_val, uint16_t extens
     return final_ea;
 }
 
+// Resolves a brief format d8(base,Xn) or a full format extension at 'index'
+static uint32_t resolve_indexed_ea(Machine* m, uint32_t base, const DecodedOp* op, int index) {
+    CPU* cpu = &m->cpu;
+    uint16_t extension_word = op->ext[index];
+
+    if (extension_word & 0x0100) { // 68020+ Full Format
+        return resolve_full_format_ea(m, base, op, index);
+    } else { // 68000 Brief Format d8(base,Xn)
+        bool index_is_an = (extension_word >> 15) & 1;
+        int index_reg_num = (extension_word >> 12) & 7;
+        bool index_is_long = (extension_word >> 11) & 1;
+        uint32_t index_val = index_is_an ? cpu->a[index_reg_num] : cpu->d[index_reg_num];
+        if (!index_is_long) index_val = (int32_t)(int16_t)index_val; // Sign-extend if word
+        int8_t displacement = extension_word & 0xFF;
+        return base + index_val + displacement;
+    }
+}
 
-uint32_t resolve_ea(CPU* cpu, uint8_t ea_field, int size_code) {
+uint32_t resolve_ea(Machine* m, const DecodedOp* op, uint8_t ea_field, int size_code, int index) {
+    CPU* cpu = &m->cpu;
     uint8_t mode = (ea_field >> 3) & 0x7;
     uint8_t reg = ea_field & 0x7;
     uint32_t address;
@@ -179,62 +345,20 @@ uint32_t resolve_ea(CPU* cpu, uint8_t ea_field, int size_code) {
         case 2: return cpu->a[reg]; // (An)
         case 3: address = cpu->a[reg]; cpu->a[reg] += increment; return address; // (An)+
         case 4: cpu->a[reg] -= increment; return cpu->a[reg]; // -(An)
-        case 5: { // d16(An)
-            int16_t displacement = (int16_t)mem_read_word(cpu->pc);
-            cpu->pc += 2;
-            return cpu->a[reg] + displacement;
-        }
-        case 6: { // d8(An, Xn) or 68020+ full format
-            uint16_t extension_word = mem_read_word(cpu->pc);
-            cpu->pc += 2;
-            
-            if (extension_word & 0x0100) { // 68020+ Full Format
-                return resolve_full_format_ea(cpu, cpu->a[reg], extension_word);
-            } else { // 68000 Brief Format d8(An,Xn)
-                bool index_is_an = (extension_word >> 15) & 1;
-                int index_reg_num = (extension_word >> 12) & 7;
-                bool index_is_long = (extension_word >> 11) & 1;
-                uint32_t index_val = index_is_an ? cpu->a[index_reg_num] : cpu->d[index_reg_num];
-                if (!index_is_long) index_val = (int32_t)(int16_t)index_val; // Sign-extend if word
-                int8_t displacement = extension_word & 0xFF;
-                return cpu->a[reg] + index_val + displacement;
-            }
-        }
+        case 5: // d16(An)
+            return cpu->a[reg] + (int16_t)op->ext[index];
+        case 6: // d8(An, Xn) or 68020+ full format
+            return resolve_indexed_ea(m, cpu->a[reg], op, index);
         case 7: // Special modes
             switch (reg) {
-                case 0: { // Absolute Short
-                    uint32_t addr = (int32_t)(int16_t)mem_read_word(cpu->pc);
-                    cpu->pc += 2;
-                    return addr;
-                }
-                case 1: { // Absolute Long
-                    uint32_t addr = mem_read_long(cpu->pc);
-                    cpu->pc += 4;
-                    return addr;
-                }
-                case 2: { // d16(PC)
-                    uint32_t base_pc = cpu->pc; // PC is at the extension word
-                    int16_t displacement = (int16_t)mem_read_word(cpu->pc);
-                    cpu->pc += 2;
-                    return base_pc + displacement;
-                }
-                case 3: { // d8(PC, Xn) or 68020+ full format
-                    uint32_t base_pc = cpu->pc; // PC is at the extension word
-                    uint16_t extension_word = mem_read_word(cpu->pc);
-                    cpu->pc += 2;
-
-                    if (extension_word & 0x0100) { // 68020+ Full Format
-                        return resolve_full_format_ea(cpu, base_pc, extension_word);
-                    } else { // 68000 Brief Format d8(PC,Xn)
-                        bool index_is_an = (extension_word >> 15) & 1;
-                        int index_reg_num = (extension_word >> 12) & 7;
-                        bool index_is_long = (extension_word >> 11) & 1;
-                        uint32_t index_val = index_is_an ? cpu->a[index_reg_num] : cpu->d[index_reg_num];
-                        if (!index_is_long) index_val = (int32_t)(int16_t)index_val; // Sign-extend
-                        int8_t displacement = extension_word & 0xFF;
-                        return base_pc + index_val + displacement;
-                    }
-                }
+                case 0: // Absolute Short
+                    return (int32_t)(int16_t)op->ext[index];
+                case 1: // Absolute Long
+                    return ext_long(op, index);
+                case 2: // d16(PC), relative to the extension word
+                    return ext_address(op, index) + (int16_t)op->ext[index];
+                case 3: // d8(PC, Xn) or 68020+ full format
+                    return resolve_indexed_ea(m, ext_address(op, index), op, index);
                 case 4: return 0; // Immediate, not an address
             }
     }
@@ -242,20 +366,17 @@ uint32_t resolve_ea(CPU* cpu, uint8_t ea_field, int size_code) {
 }
 
 
-uint32_t read_from_ea(CPU* cpu, uint8_t ea_field, int size_code) {
+uint32_t read_from_ea(Machine* m, const DecodedOp* op, uint8_t ea_field, int size_code, int index) {
+    CPU* cpu = &m->cpu;
     uint8_t mode = (ea_field >> 3) & 0x7;
     uint8_t reg = ea_field & 0x7;
 
 	if (mode == 7 && reg == 4) { // Immediate
-        uint32_t data;
         if (size_code == 2) { // Long
-            data = mem_read_long(cpu->pc);
-            cpu->pc += 4;
-        } else { // Byte or Word, reads a word, upper byte is ignored for .B
-            data = mem_read_word(cpu->pc);
-            cpu->pc += 2;
+            return ext_long(op, index);
         }
-		return data;
+        // Byte or Word, reads a word, upper byte is ignored for .B
+		return op->ext[index];
     }
 
     switch (mode) {
@@ -265,16 +386,17 @@ uint32_t read_from_ea(CPU* cpu, uint8_t ea_field, int size_code) {
             return cpu->a[reg];
         default: // All other memory-based modes
             {
-                uint32_t address = resolve_ea(cpu, ea_field, size_code);
-                if (size_code == 0) return mem_read_byte(address);
-                if (size_code == 1) return mem_read_word(address);
-                return mem_read_long(address);
+                uint32_t address = resolve_ea(m, op, ea_field, size_code, index);
+                if (size_code == 0) return mem_read_byte(m, address);
+                if (size_code == 1) return mem_read_word(m, address);
+                return mem_read_long(m, address);
             }
     }
 }
 
 // write_to_ea remains largely the same, but it will now work with the new resolve_ea
-void write_to_ea(CPU* cpu, uint8_t ea_field, uint32_t value, int size_code) {
+void write_to_ea(Machine* m, const DecodedOp* op, uint8_t ea_field, uint32_t value, int size_code, int index) {
+    CPU* cpu = &m->cpu;
     uint8_t mode = (ea_field >> 3) & 0x7;
     uint8_t reg = ea_field & 0x7;
 
@@ -301,70 +423,56 @@ void write_to_ea(CPU* cpu, uint8_t ea_field, uint32_t value, int size_code) {
         default: // All other memory-based modes
             {
                 // Note: Pre-decrement for write happens in resolve_ea
-                uint32_t address = resolve_ea(cpu, ea_field, size_code);
-                if (size_code == 0) mem_write_byte(address, value);
-                else if (size_code == 1) mem_write_word(address, value);
-                else mem_write_long(address, value);
+                uint32_t address = resolve_ea(m, op, ea_field, size_code, index);
+                if (size_code == 0) mem_write_byte(m, address, value);
+                else if (size_code == 1) mem_write_word(m, address, value);
+                else mem_write_long(m, address, value);
             }
     }
 }
 
 // --- Instruction Handler Implementations ---
+// cpu->pc already points past the instruction when a handler runs.
 
-static void handle_move_b(CPU* cpu, uint16_t opcode) {
-    uint8_t dest_ea_mode = (opcode >> 6) & 0x7;
-    uint8_t dest_ea_reg = (opcode >> 9) & 0x7;
-    uint8_t dest_ea = (dest_ea_mode << 3) | dest_ea_reg;
-    uint8_t src_ea = opcode & 0x3F;
-    uint32_t value = read_from_ea(cpu, src_ea, 0); // 0=Byte
-    write_to_ea(cpu, dest_ea, value, 0);
-    set_sr_flag(cpu, SR_V, false);
-    set_sr_flag(cpu, SR_C, false);
+static void handle_move_b(Machine* m, const DecodedOp* op) {
+    CPU* cpu = &m->cpu;
+    uint32_t value = read_from_ea(m, op, op->src_ea, 0, op->src_ext); // 0=Byte
+    write_to_ea(m, op, op->dst_ea, value, 0, op->dst_ext);
     set_logic_flags(cpu, value, 0);
 }
 
-static void handle_move_l(CPU* cpu, uint16_t opcode) {
-    uint8_t dest_ea_mode = (opcode >> 6) & 0x7;
-    uint8_t dest_ea_reg = (opcode >> 9) & 0x7;
-    uint8_t dest_ea = (dest_ea_mode << 3) | dest_ea_reg;
-    uint8_t src_ea = opcode & 0x3F;
-    uint32_t value = read_from_ea(cpu, src_ea, 2); // 2=Long
+static void handle_move_l(Machine* m, const DecodedOp* op) {
+    CPU* cpu = &m->cpu;
+    uint32_t value = read_from_ea(m, op, op->src_ea, 2, op->src_ext); // 2=Long
 
-    if (dest_ea_mode == 1) { // Destination is An (MOVEA.L)
-        write_to_ea(cpu, dest_ea, value, 2);
+    if ((op->dst_ea >> 3) == 1) { // Destination is An (MOVEA.L)
+        write_to_ea(m, op, op->dst_ea, value, 2, op->dst_ext);
         // MOVEA does not affect flags
     } else { // Destination is not An (MOVE.L)
-        write_to_ea(cpu, dest_ea, value, 2);
-        set_sr_flag(cpu, SR_V, false);
-        set_sr_flag(cpu, SR_C, false);
+        write_to_ea(m, op, op->dst_ea, value, 2, op->dst_ext);
         set_logic_flags(cpu, value, 2);
     }
 }
 
-static void handle_move_w(CPU* cpu, uint16_t opcode) {
-    uint8_t dest_ea_mode = (opcode >> 6) & 0x7;
-    uint8_t dest_ea_reg = (opcode >> 9) & 0x7;
-    uint8_t dest_ea = (dest_ea_mode << 3) | dest_ea_reg;
-    uint8_t src_ea = opcode & 0x3F;
-    uint32_t value = read_from_ea(cpu, src_ea, 1); // 1=Word
+static void handle_move_w(Machine* m, const DecodedOp* op) {
+    CPU* cpu = &m->cpu;
+    uint32_t value = read_from_ea(m, op, op->src_ea, 1, op->src_ext); // 1=Word
 
-    if (dest_ea_mode == 1) { // Destination is An (MOVEA.W)
+    if ((op->dst_ea >> 3) == 1) { // Destination is An (MOVEA.W)
         // Word moves to An are sign-extended, so write as Long
-        write_to_ea(cpu, dest_ea, (int32_t)(int16_t)value, 2);
+        write_to_ea(m, op, op->dst_ea, (int32_t)(int16_t)value, 2, op->dst_ext);
         // MOVEA does not affect flags
     } else { // Destination is not An (MOVE.W)
-        write_to_ea(cpu, dest_ea, value, 1);
-        set_sr_flag(cpu, SR_V, false);
-        set_sr_flag(cpu, SR_C, false);
+        write_to_ea(m, op, op->dst_ea, value, 1, op->dst_ext);
         set_logic_flags(cpu, value, 1);
     }
 }
 
-static void handle_subq(CPU* cpu, uint16_t opcode) {
-    int data = (opcode >> 9) & 0x7;
-    if (data == 0) data = 8;
-    int size_code = (opcode >> 6) & 0x3;
-    int reg_num = opcode & 0x7;
+static void handle_subq(Machine* m, const DecodedOp* op) {
+    CPU* cpu = &m->cpu;
+    uint32_t data = op->imm;
+    int size_code = op->size_code;
+    int reg_num = op->ry;
 
     uint32_t reg_val = cpu->d[reg_num];
     uint32_t result;
@@ -386,14 +494,11 @@ static void handle_subq(CPU* cpu, uint16_t opcode) {
     }
 }
 
-static void handle_subi(CPU* cpu, uint16_t opcode) {
-    int size_code = (opcode >> 6) & 0x3;
-    int reg_num = opcode & 0x7;
-    
-    uint32_t data;
-    if (size_code == 0) { data = mem_read_word(cpu->pc) & 0xFF; cpu->pc += 2; }
-    else if (size_code == 1) { data = mem_read_word(cpu->pc); cpu->pc += 2; }
-    else { data = mem_read_long(cpu->pc); cpu->pc += 4; }
+static void handle_subi(Machine* m, const DecodedOp* op) {
+    CPU* cpu = &m->cpu;
+    int size_code = op->size_code;
+    int reg_num = op->ry;
+    uint32_t data = op->imm;
 
     uint32_t reg_val = cpu->d[reg_num];
     uint32_t result;
@@ -415,10 +520,11 @@ static void handle_subi(CPU* cpu, uint16_t opcode) {
     }
 }
 
-static void handle_sub_reg(CPU* cpu, uint16_t opcode) {
-    int src_reg = opcode & 0x7;
-    int dest_reg = (opcode >> 9) & 0x7;
-    int size_field = (opcode >> 6) & 0x3; // 0=B, 1=W, 2=L
+static void handle_sub_reg(Machine* m, const DecodedOp* op) {
+    CPU* cpu = &m->cpu;
+    int src_reg = op->ry;
+    int dest_reg = op->rx;
+    int size_field = op->size_code; // 0=B, 1=W, 2=L
 
     uint32_t src_val = cpu->d[src_reg];
     uint32_t dest_val = cpu->d[dest_reg];
@@ -443,10 +549,11 @@ static void handle_sub_reg(CPU* cpu, uint16_t opcode) {
     }
 }
 
-static void handle_add_reg(CPU* cpu, uint16_t opcode) {
-    int src_reg = opcode & 0x7;
-    int dest_reg = (opcode >> 9) & 0x7;
-    int opmode = (opcode >> 6) & 0x3; // 0=B, 1=W, 2=L
+static void handle_add_reg(Machine* m, const DecodedOp* op) {
+    CPU* cpu = &m->cpu;
+    int src_reg = op->ry;
+    int dest_reg = op->rx;
+    int opmode = op->size_code; // 0=B, 1=W, 2=L
     
     uint32_t src_val = cpu->d[src_reg];
     uint32_t dest_val = cpu->d[dest_reg];
@@ -471,11 +578,11 @@ static void handle_add_reg(CPU* cpu, uint16_t opcode) {
     }
 }
 
-static void handle_addq(CPU* cpu, uint16_t opcode) {
-    int data = (opcode >> 9) & 0x7;
-    if (data == 0) data = 8;
-    int size_code = (opcode >> 6) & 0x3;
-    int reg_num = opcode & 0x7;
+static void handle_addq(Machine* m, const DecodedOp* op) {
+    CPU* cpu = &m->cpu;
+    uint32_t data = op->imm;
+    int size_code = op->size_code;
+    int reg_num = op->ry;
 
     uint32_t reg_val = cpu->d[reg_num];
     uint32_t result;
@@ -497,14 +604,11 @@ static void handle_addq(CPU* cpu, uint16_t opcode) {
     }
 }
 
-static void handle_addi(CPU* cpu, uint16_t opcode) {
-    int size_code = (opcode >> 6) & 0x3;
-    int reg_num = opcode & 0x7;
-    
-    uint32_t data;
-    if (size_code == 0) { data = mem_read_word(cpu->pc) & 0xFF; cpu->pc += 2; }
-    else if (size_code == 1) { data = mem_read_word(cpu->pc); cpu->pc += 2; }
-    else { data = mem_read_long(cpu->pc); cpu->pc += 4; }
+static void handle_addi(Machine* m, const DecodedOp* op) {
+    CPU* cpu = &m->cpu;
+    int size_code = op->size_code;
+    int reg_num = op->ry;
+    uint32_t data = op->imm;
 
     uint32_t reg_val = cpu->d[reg_num];
     uint32_t result;
@@ -526,14 +630,11 @@ static void handle_addi(CPU* cpu, uint16_t opcode) {
     }
 }
 
-static void handle_andi(CPU* cpu, uint16_t opcode) {
-    int size_code = (opcode >> 6) & 0x3;
-    int reg_num = opcode & 0x7;
-    
-    uint32_t data;
-    if (size_code == 0) { data = mem_read_word(cpu->pc) & 0xFF; cpu->pc += 2; }
-    else if (size_code == 1) { data = mem_read_word(cpu->pc); cpu->pc += 2; }
-    else { data = mem_read_long(cpu->pc); cpu->pc += 4; }
+static void handle_andi(Machine* m, const DecodedOp* op) {
+    CPU* cpu = &m->cpu;
+    int size_code = op->size_code;
+    int reg_num = op->ry;
+    uint32_t data = op->imm;
 
     uint32_t reg_val = cpu->d[reg_num];
     uint32_t result;
@@ -545,138 +646,663 @@ static void handle_andi(CPU* cpu, uint16_t opcode) {
     set_logic_flags(cpu, result, size_code);
 }
 
-static void handle_btst_imm(CPU* cpu, uint16_t opcode) {
-    int reg_num = opcode & 0x7;
-    uint8_t bit_num = mem_read_word(cpu->pc) & 0xFF;
-    cpu->pc += 2;
-    uint32_t reg_val = cpu->d[reg_num];
-    uint32_t mask = 1 << (bit_num % 32);
-    set_sr_flag(cpu, SR_Z, (reg_val & mask) == 0);
+// Bit operations on Dn: op->imm holds the decoded bit mask
+static void handle_btst_imm(Machine* m, const DecodedOp* op) {
+    CPU* cpu = &m->cpu;
+    uint32_t reg_val = cpu->d[op->ry];
+    set_sr_flag(cpu, SR_Z, (reg_val & op->imm) == 0);
 }
 
-static void handle_bchg_imm(CPU* cpu, uint16_t opcode) {
-    int reg_num = opcode & 0x7;
-    uint8_t bit_num = mem_read_word(cpu->pc) & 0xFF;
-    cpu->pc += 2;
-    uint32_t reg_val = cpu->d[reg_num];
-    uint32_t mask = 1 << (bit_num % 32);
-    set_sr_flag(cpu, SR_Z, (reg_val & mask) == 0);
-    cpu->d[reg_num] = reg_val ^ mask;
+static void handle_bchg_imm(Machine* m, const DecodedOp* op) {
+    CPU* cpu = &m->cpu;
+    uint32_t reg_val = cpu->d[op->ry];
+    set_sr_flag(cpu, SR_Z, (reg_val & op->imm) == 0);
+    cpu->d[op->ry] = reg_val ^ op->imm;
 }
 
-static void handle_bclr_imm(CPU* cpu, uint16_t opcode) {
-    int reg_num = opcode & 0x7;
-    uint8_t bit_num = mem_read_word(cpu->pc) & 0xFF;
-    cpu->pc += 2;
-    uint32_t reg_val = cpu->d[reg_num];
-    uint32_t mask = 1 << (bit_num % 32);
-    set_sr_flag(cpu, SR_Z, (reg_val & mask) == 0);
-    cpu->d[reg_num] = reg_val & ~mask;
+static void handle_bclr_imm(Machine* m, const DecodedOp* op) {
+    CPU* cpu = &m->cpu;
+    uint32_t reg_val = cpu->d[op->ry];
+    set_sr_flag(cpu, SR_Z, (reg_val & op->imm) == 0);
+    cpu->d[op->ry] = reg_val & ~op->imm;
 }
 
-static void handle_bset_imm(CPU* cpu, uint16_t opcode) {
-    int reg_num = opcode & 0x7;
-    uint8_t bit_num = mem_read_word(cpu->pc) & 0xFF;
-    cpu->pc += 2;
-    uint32_t reg_val = cpu->d[reg_num];
-    uint32_t mask = 1 << (bit_num % 32);
-    set_sr_flag(cpu, SR_Z, (reg_val & mask) == 0);
-    cpu->d[reg_num] = reg_val | mask;
+static void handle_bset_imm(Machine* m, const DecodedOp* op) {
+    CPU* cpu = &m->cpu;
+    uint32_t reg_val = cpu->d[op->ry];
+    set_sr_flag(cpu, SR_Z, (reg_val & op->imm) == 0);
+    cpu->d[op->ry] = reg_val | op->imm;
 }
 
-static void handle_bcc(CPU* cpu, uint16_t opcode) {
-    uint32_t current_pc = cpu->pc - 2; // The PC was already advanced past the opcode
-    int condition = (opcode >> 8) & 0xF;
-    int8_t displacement = opcode & 0xFF;
-    bool branch = false;
-    bool z = (cpu->sr >> SR_Z) & 1;
-    bool n = (cpu->sr >> SR_N) & 1;
-    bool v = (cpu->sr >> SR_V) & 1;
-    bool c = (cpu->sr >> SR_C) & 1;
+// Evaluates a Bcc condition code against the N, Z, V and C bits of 'sr'
+bool executor_test_condition(int condition, uint16_t sr) {
+    bool z = (sr >> SR_Z) & 1;
+    bool n = (sr >> SR_N) & 1;
+    bool v = (sr >> SR_V) & 1;
+    bool c = (sr >> SR_C) & 1;
 
     switch (condition) {
-        case 0x0: branch = true; break; // BRA
-        case 0x2: branch = !c && !z; break; // BHI
-        case 0x3: branch = c || z; break; // BLS
-        case 0x4: branch = !c; break; // BCC
-        case 0x5: branch = c; break; // BCS
-        case 0x6: branch = !z; break; // BNE
-        case 0x7: branch = z; break; // BEQ
-        case 0x8: branch = !v; break; // BVC
-        case 0x9: branch = v; break; // BVS
-        case 0xA: branch = !n; break; // BPL
-        case 0xB: branch = n; break; // BMI
-        case 0xC: branch = (n && v) || (!n && !v); break; // BGE
-        case 0xD: branch = (n && !v) || (!n && v); break; // BLT
-        case 0xE: branch = (n && v && !z) || (!n && !v && !z); break; // BGT
-        case 0xF: branch = z || (n && !v) || (!n && v); break; // BLE
+        case 0x0: return true; // BRA
+        case 0x2: return !c && !z; // BHI
+        case 0x3: return c || z; // BLS
+        case 0x4: return !c; // BCC
+        case 0x5: return c; // BCS
+        case 0x6: return !z; // BNE
+        case 0x7: return z; // BEQ
+        case 0x8: return !v; // BVC
+        case 0x9: return v; // BVS
+        case 0xA: return !n; // BPL
+        case 0xB: return n; // BMI
+        case 0xC: return (n && v) || (!n && !v); // BGE
+        case 0xD: return (n && !v) || (!n && v); // BLT
+        case 0xE: return (n && v && !z) || (!n && !v && !z); // BGT
+        case 0xF: return z || (n && !v) || (!n && v); // BLE
     }
+    return false; // BSR is not implemented
+}
 
-    if (branch) {
-        cpu->pc = current_pc + 2 + displacement;
+static void handle_bcc(Machine* m, const DecodedOp* op) {
+    CPU* cpu = &m->cpu;
+    int condition = (op->opcode >> 8) & 0xF;
+    if (executor_test_condition(condition, cpu_get_sr(cpu))) {
+        cpu->pc = op->imm; // Target was resolved when the op was decoded
+        TIMING_ADD(cpu, (int)op->taken_cycles - op->cycles); // The loop adds op->cycles
     }
 }
 
-static void handle_nop(CPU* cpu, uint16_t opcode) {
-    (void)cpu;    // Silence unused parameter warning
-    (void)opcode; // Silence unused parameter warning
+static void handle_nop(Machine* m, const DecodedOp* op) {
+    (void)m;   // Silence unused parameter warning
+    (void)op;  // Silence unused parameter warning
 }
 
-static void handle_rts(CPU* cpu, uint16_t opcode) {
-    (void)cpu;    // Silence unused parameter warning
-    (void)opcode; // Silence unused parameter warning
+static void handle_rts(Machine* m, const DecodedOp* op) {
+    (void)m;   // Silence unused parameter warning
+    (void)op;  // Silence unused parameter warning
     // In the future, this will pop the return address from the stack.
 }
 
-// --- Main Execution Loop ---
+#include "handlers.inc"
 
-void execute_program(CPU* cpu) {
-    printf("INFO: Beginning execution from 0x%X.\n\n", cpu->pc);
-    bool running = true;
-    int cycles = 0;
+static const char* const handler_names[NUM_HANDLERS] = {
+#define HANDLER_NAME(name) #name,
+    HANDLER_LIST(HANDLER_NAME)
+#undef HANDLER_NAME
+};
 
-    printf("%-26s | ", "Initial State");
-    cpu_dump_registers(cpu);
+// --- Dispatch Table Check ---
+// executor_verify_dispatch() decodes every opcode again without isa_match(),
+// isa_size_code() or the generated select_handler(), and names the handler
+// it expects from isa.def and the naming of the gen_isa variants.
+
+static const char* const generic_handlers[NUM_INSTRUCTION_KINDS] = {
+#define ISA(kind, mnemonic, pattern, form, sizes, flags, cycles, cycles_long, handler) [INSN_##kind] = #handler,
+#include "isa.def"
+};
+
+static const char* const variant_sizes[3] = { "b", "w", "l" };
+
+// Kinds with one variant per size, sized by bits 7-6
+static bool has_size_variants(int kind) {
+    switch (kind) {
+        case INSN_ANDI: case INSN_SUBI: case INSN_ADDI:
+        case INSN_ADDQ: case INSN_SUBQ:
+        case INSN_SUB: case INSN_ADD:
+            return true;
+    }
+    return false;
+}
+
+static bool is_move_kind(int kind) {
+    return kind == INSN_MOVE_B || kind == INSN_MOVE_W || kind == INSN_MOVE_L;
+}
 
-    while (running && cycles < MAX_EXECUTION_CYCLES) {
-        uint32_t current_pc = cpu->pc;
-        SourceMapping* map = disassembler_get_mapping(current_pc);
+// Name of the class of a MOVE effective address in the variant names
+static const char* move_ea_name(int mode, int reg, bool destination) {
+    static const char* const modes[6] = { "dn", "an", "ind", "postinc", "predec", "disp" };
+    if (mode < 6) return modes[mode];
+    if (mode == 7 && reg == 0) return "abs_w";
+    if (mode == 7 && reg == 1) return "abs_l";
+    if (mode == 7 && reg == 4 && !destination) return "imm";
+    return "other";
+}
 
-        uint16_t opcode = mem_read_word(cpu->pc);
-        cpu->pc += 2;
+// Size code from the opcode bits: bits 13-12 for MOVE, 7-6 for the others
+static int reference_size(int kind, uint16_t opcode) {
+    if (is_move_kind(kind)) {
+        static const int move_sizes[4] = { -1, 0, 2, 1 };
+        return move_sizes[(opcode >> 12) & 3];
+    }
+    if (has_size_variants(kind)) return (opcode >> 6) & 3;
+    return -1; // Unsized, or one size: not checked
+}
 
-        // Special case for RTS to halt simulation
-        if (opcode == 0x4E75) {
-            running = false;
+static void reference_handler(int kind, uint16_t opcode, int size, char* name, size_t length) {
+    if (is_move_kind(kind)) {
+        snprintf(name, length, "handle_move_%s_%s_%s", variant_sizes[size],
+                 move_ea_name((opcode >> 3) & 7, opcode & 7, false), move_ea_name((opcode >> 6) & 7, (opcode >> 9) & 7, true));
+    } else if (has_size_variants(kind) && size < 3) {
+        snprintf(name, length, "%s_%s", generic_handlers[kind], variant_sizes[size]);
+    } else {
+        snprintf(name, length, "%s", generic_handlers[kind]);
+    }
+}
+
+// Checks every opcode's table entry, size and handler against the reference
+// decode above. Returns the number of mismatching opcodes.
+int executor_verify_dispatch(void) {
+    executor_init();
+    int mismatches = 0;
+    int mapped = 0;
+
+    for (uint32_t opcode = 0; opcode < DISPATCH_TABLE_SIZE; ++opcode) {
+        const OpcodeInfo* info = &opcode_info[opcode];
+        int kind = OPCODE_UNMAPPED;
+        for (int k = 0; k < NUM_INSTRUCTION_KINDS && kind == OPCODE_UNMAPPED; ++k) {
+            if ((opcode & isa_table[k].mask) == isa_table[k].value) kind = k;
+        }
+        const char* problem = NULL;
+        char expected[64] = "";
+        if (info->mapping != kind) {
+            problem = "instruction";
+        } else if (kind != OPCODE_UNMAPPED) {
+            int size = reference_size(kind, (uint16_t)opcode);
+            reference_handler(kind, (uint16_t)opcode, size, expected, sizeof(expected));
+            if (size >= 0 && info->size_code != size) {
+                problem = "size";
+            } else if (strcmp(handler_names[info->handler_id], expected) != 0 ||
+                       dispatch_table[opcode] != handler_for(info->handler_id)) {
+                problem = "handler";
+            }
+            mapped++;
+        } else if (dispatch_table[opcode]) {
+            problem = "handler";
+        }
+        if (problem) {
+            if (mismatches < 16) {
+                printf("ERROR: Dispatch mismatch for opcode %04X: %s (expected %s)\n", opcode, problem,
+                       *expected ? expected : kind == OPCODE_UNMAPPED ? "unmapped" : isa_table[kind].mnemonic);
+            }
+            mismatches++;
         }
+    }
+
+    printf("INFO: Dispatch table checked against a reference decode: %d opcodes mapped, %d mismatches.\n", mapped, mismatches);
+    return mismatches;
+}
 
-        bool handled = false;
-        for (int i = 0; i < num_opcodes; ++i) {
-            if ((opcode & instruction_table[i].mask) == instruction_table[i].value) {
-                instruction_table[i].handler(cpu, opcode);
-                handled = true;
+#ifdef THREADED_CORE
+// Starts each op that begins a fused sequence, picked by gen_isa from the
+// profile, on its superinstruction. Longer sequences are listed first.
+static void fuse_ops(DecodedOp* ops, int num_ops) {
+    for (int i = 0; i < num_ops; ++i) {
+        for (int s = 0; s < NUM_FUSED_SEQUENCES; ++s) {
+            const FusedSequence* sequence = &fused_sequences[s];
+            if (i + sequence->length > num_ops) continue;
+            int k = 0;
+            while (k < sequence->length && ops[i + k].handler_id == sequence->handlers[k]) k++;
+            if (k == sequence->length) {
+                ops[i].dispatch_id = sequence->fused;
                 break;
             }
         }
+    }
+}
+#endif
+
+// --- Main Execution Loop ---
+
+// A store hit decoded code, so the loop leaves the current block
+static void on_code_write(Machine* m, uint32_t start, uint32_t end) {
+    block_cache_invalidate(m, start, end);
+    m->exec_break = true;
+}
+
+static inline const SourceMapping* source_line(Machine* m, uint32_t pc) {
+    return m->source_map ? disassembler_get_mapping(m->source_map, pc) : NULL;
+}
+
+// 'words' are the opcode and extension words, disassembled when there is
+// no source line
+static void print_trace_line(CPU* cpu, const SourceMapping* map, uint32_t pc, const uint16_t* words, int num_words) {
+    // Print instruction and state AFTER execution
+    if (map) {
+        printf("L%-3d: %-20s | ", map->line_number, map->instruction_text);
+    } else {
+        char text[64];
+        disassembler_format(words, num_words, pc, text, sizeof(text));
+        printf("??:   %-20s | ", text);
+    }
+    cpu_dump_registers(cpu);
+}
+
+static void print_op_trace_line(Machine* m, const DecodedOp* op) {
+    uint16_t words[1 + MAX_EXTENSION_WORDS];
+    words[0] = op->opcode;
+    memcpy(&words[1], op->ext, op->num_ext * sizeof(uint16_t));
+    print_trace_line(&m->cpu, source_line(m, op->pc), op->pc, words, 1 + op->num_ext);
+}
+
+// Translates a hot block. A full code cache is flushed along with every
+// block, since blocks hold pointers into it.
+static void translate_block(Machine* m, Block* block) {
+    if (!jit_translate(m, block)) {
+        block_cache_invalidate(m, 0, UINT32_MAX);
+        jit_reset(m);
+    }
+}
+
+// Native code does not count cycles; a block ending in a taken branch has
+// left pc at the branch target.
+static inline void add_native_cycles(CPU* cpu, const Block* block) {
+#ifdef CYCLE_TIMING
+    const DecodedOp* last = &block->ops[block->native_ops - 1];
+    cpu->cycles += block->native_cycles;
+    if (last->kind == INSN_BCC && cpu->pc == last->imm) {
+        cpu->cycles += (int)last->taken_cycles - last->cycles;
+    }
+#else
+    (void)cpu;   // Silence unused parameter warning
+    (void)block; // Silence unused parameter warning
+#endif
+}
+
+static bool cpu_state_equal(const CPU* a, const CPU* b) {
+    for (int i = 0; i < NUM_DATA_REGISTERS; ++i) {
+        if (a->d[i] != b->d[i]) return false;
+    }
+    for (int i = 0; i < NUM_ADDRESS_REGISTERS; ++i) {
+        if (a->a[i] != b->a[i]) return false;
+    }
+#ifdef CYCLE_TIMING
+    if (a->cycles != b->cycles) return false;
+#endif
+    return a->pc == b->pc && cpu_get_sr(a) == cpu_get_sr(b);
+}
+
+// Runs the native prefix of a block. In lockstep mode the same ops are also
+// interpreted from a copy of the CPU and the two results compared; on a
+// mismatch the interpreter's result is kept. Returns false on a mismatch.
+static bool run_native(Machine* m, const Block* block, bool lockstep) {
+    CPU* cpu = &m->cpu;
+    // Native code updates sr directly, so pending lazy flags go there first
+    cpu_set_sr(cpu, cpu_get_sr(cpu));
+    if (!lockstep) {
+        block->native(cpu);
+        add_native_cycles(cpu, block);
+        return true;
+    }
+
+    // Handlers work on m->cpu, so the interpreter runs first
+    CPU before = *cpu;
+    for (int i = 0; i < block->native_ops; ++i) {
+        const DecodedOp* op = &block->ops[i];
+        cpu->pc = op->next_pc;
+        op->handler(m, op);
+        TIMING_ADD(cpu, op->cycles);
+    }
+    CPU expected = *cpu;
+    *cpu = before;
+    block->native(cpu);
+    add_native_cycles(cpu, block);
+
+    if (cpu_state_equal(cpu, &expected)) return true;
+    printf("ERROR: JIT lockstep mismatch in block at 0x%X (%d ops)\n", block->start_pc, block->native_ops);
+    printf("%-26s | ", "Native");
+    cpu_dump_registers(cpu);
+    printf("%-26s | ", "Interpreter");
+    cpu_dump_registers(&expected);
+    *cpu = expected;
+    return false;
+}
+
+// State kept across executor_run() calls between start and finish
+struct ExecSession {
+    ExecOptions options;
+    bool use_jit;
+    bool trace;         // Per-instruction text output
+    bool binary_trace;  // Per-instruction trace records, see trace.h
+    ExecCounters counters;
+    clock_t start_time;
+    bool muted;         // Output held back by executor_mute()
+    bool muted_trace;
+    bool muted_binary_trace;
+    Profile* profile;   // Sequence counts for options.profile_file, or NULL
+    bool idle_skip;     // Fast-forward idle loops, see idle.h
+};
+
+void executor_start(Machine* m, const ExecOptions* options) {
+    executor_init();
+    block_cache_init(m);
+    mem_set_code_write_hook(m, on_code_write);
+
+    if (!m->session) m->session = (struct ExecSession*)malloc(sizeof(struct ExecSession));
+    if (!m->session) {
+        perror("Failed to allocate execution session");
+        exit(EXIT_FAILURE);
+    }
+    struct ExecSession* session = m->session;
+    memset(session, 0, sizeof(*session));
+    session->options = *options;
+    session->use_jit = options->use_jit || options->jit_lockstep;
+    if (session->use_jit && !jit_init(m)) {
+        if (!m->quiet) printf("WARN: JIT is not available on this host, interpreting only.\n");
+        session->use_jit = false;
+    }
+    // Headless runs skip all per-instruction output and source map lookups
+    session->trace = !options->headless && !m->quiet;
+    session->binary_trace = options->trace_file && trace_open(m, options->trace_file);
+    if (options->profile_file) session->profile = profile_create();
+    // Skipped instructions have no trace lines, so traced runs run them all
+    session->idle_skip = !options->no_idle_skip && !session->trace && !session->binary_trace;
+
+    if (!m->quiet) printf("INFO: Beginning execution from 0x%X.\n\n", m->cpu.pc);
+    session->start_time = clock();
+    m->watch_hit = false; // Loading the program may have touched a watched page
+
+    if (session->trace) {
+        printf("%-26s | ", "Initial State");
+        cpu_dump_registers(&m->cpu);
+    }
+}
+
+// Runs one interpreted instruction with its per-instruction output
+static inline void step(Machine* m, struct ExecSession* session, const DecodedOp* op) {
+    m->cpu.pc = op->next_pc;
+    op->handler(m, op);
+    TIMING_ADD(&m->cpu, op->cycles);
+
+    if (session->trace) print_op_trace_line(m, op);
+    if (session->binary_trace) trace_record(m, op->pc, op->opcode, 0);
+}
 
-        if (!handled) {
-            printf("WARN: Unknown or unimplemented opcode: %04X\n", opcode);
-            running = false;
+#ifdef THREADED_CORE
+// Direct-threaded form of the loop above for runs without per-instruction
+// output. Every handler body ends in its own indirect jump to the next op's
+// handler, so the host predicts each jump from the instruction before it
+// instead of from one shared call site. Runs ops [first, count) and returns
+// the index after the last one run.
+//
+// A fused superinstruction runs the handlers of its sequence back to back
+// with no dispatch between them. Each one still sees its own op, pc and
+// cycles, and a break after any of them stops the sequence there, so the
+// results are those of the ops run one by one.
+static int run_threaded(Machine* m, const Block* block, int first, int count) {
+#define HANDLER_LABEL(name) &&op_##name,
+#define FUSED_LABEL(name, ...) &&op_##name,
+    static const void* const labels[NUM_DISPATCH_IDS] = {
+        HANDLER_LIST(HANDLER_LABEL) FUSED_PAIRS(FUSED_LABEL) FUSED_TRIPLES(FUSED_LABEL)
+    };
+#undef FUSED_LABEL
+#undef HANDLER_LABEL
+    CPU* cpu = &m->cpu;
+    const DecodedOp* op = &block->ops[first];
+    const DecodedOp* end = &block->ops[count];
+    if (op == end) return first;
+
+#define DISPATCH() do { cpu->pc = op->next_pc; goto *labels[op->dispatch_id]; } while (0)
+#define NEXT() do { \
+        TIMING_ADD(cpu, op->cycles); \
+        if (++op == end || m->exec_break) goto done; \
+        DISPATCH(); \
+    } while (0)
+// Between the ops of a fused sequence, which never crosses the block end
+#define FUSED_NEXT() do { \
+        TIMING_ADD(cpu, op->cycles); \
+        ++op; \
+        if (m->exec_break) goto done; \
+        cpu->pc = op->next_pc; \
+    } while (0)
+
+    DISPATCH();
+#define HANDLER_CASE(name) op_##name: name(m, op); NEXT();
+    HANDLER_LIST(HANDLER_CASE)
+#undef HANDLER_CASE
+#define FUSED_PAIR_CASE(name, a, b) op_##name: a(m, op); FUSED_NEXT(); b(m, op); NEXT();
+    FUSED_PAIRS(FUSED_PAIR_CASE)
+#undef FUSED_PAIR_CASE
+#define FUSED_TRIPLE_CASE(name, a, b, c) op_##name: a(m, op); FUSED_NEXT(); b(m, op); FUSED_NEXT(); c(m, op); NEXT();
+    FUSED_TRIPLES(FUSED_TRIPLE_CASE)
+#undef FUSED_TRIPLE_CASE
+#undef FUSED_NEXT
+#undef NEXT
+#undef DISPATCH
+
+done:
+    return (int)(op - block->ops);
+}
+#endif
+
+// Returns the condition that stops execution before 'op', or STOP_NONE
+static StopReason check_stop(const CPU* cpu, const StopConditions* stop, const DecodedOp* op) {
+    if (op->flags & OPF_BREAKPOINT) return STOP_BREAKPOINT;
+    if (stop->use_address && cpu->pc == stop->address) return STOP_ADDRESS;
+#ifdef CYCLE_TIMING
+    if (stop->max_cycles && cpu->cycles >= stop->max_cycles) return STOP_CYCLES;
+#endif
+    return STOP_NONE;
+}
+
+StopReason executor_check_stop(Machine* m, const StopConditions* stop) {
+    Block* block = block_cache_lookup(m, m->cpu.pc);
+    if (!block) block = build_block(m, m->cpu.pc);
+    return block ? check_stop(&m->cpu, stop, &block->ops[0]) : STOP_NONE;
+}
+
+StopReason executor_run(Machine* m, unsigned long budget, const StopConditions* stop) {
+    static const StopConditions no_stop = {0};
+    CPU* cpu = &m->cpu;
+    struct ExecSession* session = m->session;
+    if (!stop) stop = &no_stop;
+#ifndef CYCLE_TIMING
+    if (stop->max_cycles) {
+        printf("WARN: Built without cycle timing, ignoring the cycle limit.\n");
+    }
+#endif
+    bool started = false; // Stopping at the starting pc would prevent resuming
+    StopReason reason = STOP_NONE;
+
+    while (true) {
+        // Blocks invalidated during the previous block are safe to free now
+        block_cache_reclaim(m);
+
+        if (budget == 0) return STOP_BUDGET;
+
+        Block* block = block_cache_lookup(m, cpu->pc);
+        if (!block) block = build_block(m, cpu->pc);
+        if (!block) {
+            uint32_t pc = cpu->pc;
+            uint16_t opcode = mem_fetch_word(m, pc);
+            cpu->pc += 2;
+            if (!m->quiet) printf("WARN: Unknown or unimplemented opcode: %04X\n", opcode);
+            if (session->trace) print_trace_line(cpu, source_line(m, pc), pc, &opcode, 1);
+            if (session->binary_trace) trace_record(m, pc, opcode, TRACE_UNKNOWN);
+            session->counters.instructions++;
+            return STOP_UNKNOWN_OPCODE;
+        }
+        session->counters.blocks_entered++;
+
+        // Limits are checked once per block. Only a block that may reach one
+        // part-way is run with a check before every instruction.
+        int count = block->num_ops;
+        if (budget < (unsigned long)count) count = budget;
+        bool careful = count < block->num_ops || block->breakpoint ||
+                       (stop->use_address && stop->address >= block->start_pc && stop->address < block->end_pc);
+#ifdef CYCLE_TIMING
+        careful = careful || (stop->max_cycles && cpu->cycles + block->max_cycles >= stop->max_cycles);
+#endif
+        if (careful && started && (reason = check_stop(cpu, stop, &block->ops[0])) != STOP_NONE) {
+            return reason;
         }
-        
-        // Print instruction and state AFTER execution
-        if (map) {
-            printf("L%-3d: %-20s | ", map->line_number, map->instruction_text);
+        started = true;
+
+        // An idle loop is skipped ahead once it ran an iteration from here
+        bool idle = block->idle != IDLE_NONE && session->idle_skip && !careful;
+        CPU before;
+        if (idle) before = *cpu;
+
+        // Native code covers a prefix of the block; the rest is interpreted.
+        // Traced runs interpret every op, which native code cannot trace.
+        int first_op = 0;
+        if (session->use_jit) {
+            if (!block->jit_tried && ++block->exec_count >= JIT_HOT_THRESHOLD) {
+                translate_block(m, block);
+            }
+            if (block->native && !careful && !session->trace && !session->binary_trace) {
+                if (!run_native(m, block, session->options.jit_lockstep)) session->counters.lockstep_mismatches++;
+                first_op = block->native_ops;
+                session->counters.native_ops += first_op;
+            }
+        }
+
+        int executed = first_op;
+        if (!careful) {
+#ifdef THREADED_CORE
+            if (!session->trace && !session->binary_trace) executed = run_threaded(m, block, executed, count);
+#endif
+            // Whatever the threaded loop left, it stopped on a break
+            while (executed < count && !m->exec_break) step(m, session, &block->ops[executed++]);
         } else {
-            printf("%-26s | ", "??: (no source)");
+            while (executed < count) {
+                if (executed > 0 && (reason = check_stop(cpu, stop, &block->ops[executed])) != STOP_NONE) break;
+                step(m, session, &block->ops[executed++]);
+                if (m->exec_break) break;
+            }
         }
-        cpu_dump_registers(cpu);
+        m->exec_break = false;
+        // Re-executed instructions, see executor_mute(), were counted already
+        if (session->profile && !session->muted) profile_record(session->profile, block->ops, executed);
+        session->counters.instructions += executed;
+        budget -= executed;
+
+        // Halting instructions always end their block
+        if (executed == block->num_ops && (block->ops[executed - 1].flags & OPF_HALT)) {
+            m->watch_hit = false;
+            return STOP_HALT;
+        }
+        if (m->watch_hit) {
+            m->watch_hit = false;
+            return STOP_WATCHPOINT;
+        }
+        if (reason != STOP_NONE) return reason;
+
+        // Each skipped iteration is a run of the whole block, which the limits
+        // checked above would have let through unchecked
+        if (idle && executed == block->num_ops && cpu->pc == block->start_pc) {
+            unsigned long iterations = idle_skip(m, block, &before, budget / block->num_ops, stop->max_cycles);
+            unsigned long skipped = iterations * block->num_ops;
+            session->counters.instructions += skipped;
+            session->counters.blocks_entered += iterations;
+            session->counters.idle_skipped += skipped;
+            budget -= skipped;
+        }
+    }
+}
 
-        cycles++;
+const char* executor_stop_reason_name(StopReason reason) {
+    switch (reason) {
+        case STOP_NONE: return "not stopped";
+        case STOP_HALT: return "halted";
+        case STOP_BUDGET: return "instruction budget reached";
+        case STOP_ADDRESS: return "stop address reached";
+        case STOP_BREAKPOINT: return "breakpoint reached";
+        case STOP_WATCHPOINT: return "watchpoint hit";
+        case STOP_CYCLES: return "cycle limit reached";
+        case STOP_UNKNOWN_OPCODE: return "unknown opcode";
     }
+    return "unknown";
+}
 
-    if (cycles >= MAX_EXECUTION_CYCLES) {
-        printf("\nWARN: Maximum execution cycles reached. Halting simulation.\n");
+const ExecCounters* executor_counters(Machine* m) {
+    static const ExecCounters none = {0};
+    return m->session ? &m->session->counters : &none;
+}
+
+void executor_set_counters(Machine* m, const ExecCounters* counters) {
+    m->session->counters = *counters;
+}
+
+void executor_mute(Machine* m, bool mute) {
+    struct ExecSession* session = m->session;
+    if (mute == session->muted) return;
+    session->muted = mute;
+    if (mute) {
+        session->muted_trace = session->trace;
+        session->muted_binary_trace = session->binary_trace;
+        session->trace = false;
+        session->binary_trace = false;
+    } else {
+        session->trace = session->muted_trace;
+        session->binary_trace = session->muted_binary_trace;
     }
+}
+
+static void print_summary(Machine* m) {
+    CPU* cpu = &m->cpu;
+    struct ExecSession* session = m->session;
     printf("\nINFO: Execution finished.\n");
-}
\ No newline at end of file
+    if (!session->trace) {
+        printf("%-26s | ", "Final State");
+        cpu_dump_registers(cpu);
+    }
+
+    double seconds = (double)(clock() - session->start_time) / CLOCKS_PER_SEC;
+    printf("INFO: %lu instructions in %lu blocks, %.3f s", session->counters.instructions, session->counters.blocks_entered, seconds);
+    if (seconds > 0) printf(" (%.2f MIPS)", session->counters.instructions / seconds / 1e6);
+    printf(".\n");
+#ifdef CYCLE_TIMING
+    printf("INFO: %llu clock cycles, %.3f ms on a %d MHz 68000.\n", (unsigned long long)cpu->cycles,
+           cpu->cycles / (TIMING_CLOCK_MHZ * 1000.0), TIMING_CLOCK_MHZ);
+#endif
+
+    const BlockCacheStats* stats = block_cache_stats(m);
+    printf("INFO: Block cache: %lu blocks decoded, %lu invalidated.\n",
+           stats->blocks_built, stats->blocks_invalidated);
+    printf("INFO: Memory: %d pages in use (%d KB).\n", mem_pages_used(m), mem_pages_used(m) * (MEM_PAGE_SIZE / 1024));
+    if (session->counters.idle_skipped) {
+        printf("INFO: %lu instructions of idle loops skipped.\n", session->counters.idle_skipped);
+    }
+    if (session->use_jit) {
+        const JitStats* jstats = jit_stats(m);
+        printf("INFO: JIT: %lu blocks translated (%lu ops), %lu ops run natively, %lu lockstep mismatches.\n",
+               jstats->blocks_translated, jstats->ops_translated, session->counters.native_ops, session->counters.lockstep_mismatches);
+    }
+}
+
+// Ends a run and releases its caches. Quiet machines skip the summary.
+void executor_finish(Machine* m) {
+    executor_mute(m, false);
+    if (m->session->binary_trace) trace_close(m);
+    mem_set_code_write_hook(m, NULL);
+    if (!m->quiet) print_summary(m);
+    if (m->session->profile) {
+        const char* filename = m->session->options.profile_file;
+        if (profile_save(m->session->profile, filename, handler_names, NUM_HANDLERS) && !m->quiet) {
+            printf("INFO: Instruction profile added to %s.\n", filename);
+        }
+        profile_free(m->session->profile);
+        m->session->profile = NULL;
+    }
+    block_cache_shutdown(m);
+    jit_shutdown(m);
+}
+
+StopReason execute_program(Machine* m, const ExecOptions* options) {
+    executor_start(m, options);
+    unsigned long budget = options->budget ? options->budget : ULONG_MAX;
+    StopReason reason = executor_run(m, budget, &options->stop);
+    executor_report_stop(m, options, reason);
+    executor_finish(m);
+    return reason;
+}
+
+void executor_report_stop(Machine* m, const ExecOptions* options, StopReason reason) {
+    if (m->quiet) {
+        // Callers read the reason and the machine state instead
+    } else if (reason == STOP_BUDGET) {
+        printf("\nWARN: Instruction budget of %lu reached. Halting simulation.\n", options->budget);
+    } else if (reason != STOP_HALT && reason != STOP_UNKNOWN_OPCODE) {
+        printf("\nINFO: Stopped at 0x%X: %s.\n", m->cpu.pc, executor_stop_reason_name(reason));
+        const WatchHit* hit = reason == STOP_WATCHPOINT ? debug_last_hit(m) : NULL;
+        if (hit) printf("INFO: %s 0x%02X at 0x%X.\n", hit->write ? "Wrote" : "Read", hit->value, hit->address);
+    }
+}
@@ -1,25 +1,130 @@
-    
 #ifndef EXECUTOR_H
 #define EXECUTOR_H
 
 #include "cpu.h"
+#include "machine.h"
+#include "isa.h"
 #include <stdint.h> // Include for uint16_t
+#include <stdbool.h>
 
 // Forward declare CPU to avoid circular dependency if needed later
 // struct CPU; // Already included via cpu.h
 
+// Longest 68020 instruction: opcode + two full format EAs of 5 words each
+#define MAX_EXTENSION_WORDS 10
+
+typedef struct DecodedOp DecodedOp;
+
 // Define a function pointer type for our instruction handlers
-typedef void (*InstructionHandler)(CPU* cpu, uint16_t opcode);
+typedef void (*InstructionHandler)(Machine* m, const DecodedOp* op);
+
+// Per-opcode metadata, decoded once when the dispatch table is built
+#define OPCODE_UNMAPPED 0xFF
 
-// Structure to map an opcode pattern to a handler function
 typedef struct {
-    uint16_t mask;    // Bitmask to apply to the opcode
-    uint16_t value;   // Value to compare against after masking
-    InstructionHandler handler; // Function to handle this opcode
-} OpcodeMapping;
+    uint8_t mapping;   // Index into isa_table, the InstructionKind, or OPCODE_UNMAPPED
+    uint8_t size_code; // Operand size: 0=Byte, 1=Word, 2=Long
+    uint8_t flags;     // OPF_* bits of the matching mapping
+    uint16_t handler_id; // Generic handler or a specialised variant, see handlers.inc
+} OpcodeInfo;
 
-void execute_program(CPU* cpu);
+// An instruction decoded once from memory. Handlers read their operands from
+// here instead of re-fetching the opcode and extension words.
+struct DecodedOp {
+    InstructionHandler handler;
+    uint16_t handler_id; // Index of 'handler' in HANDLER_LIST of handlers.inc
+    uint16_t dispatch_id; // What the threaded loop runs: handler_id, or a fused sequence starting here
+    uint32_t pc;        // Address of the opcode word
+    uint32_t next_pc;   // Address of the following instruction
+    uint32_t imm;       // Immediate data, quick data, bit mask or branch target
+    uint16_t opcode;
+    uint8_t kind;       // InstructionKind
+    uint8_t size_code;  // 0=Byte, 1=Word, 2=Long
+    uint8_t flags;      // OPF_* bits
+    uint8_t rx;         // Register field, bits 11-9
+    uint8_t ry;         // Register field, bits 2-0
+    uint8_t src_ea;     // Source EA field (mode << 3 | reg)
+    uint8_t dst_ea;     // Destination EA field (mode << 3 | reg)
+    uint8_t src_ext;    // Index of the source EA's first extension word
+    uint8_t dst_ext;    // Index of the destination EA's first extension word
+    uint8_t num_ext;
+    uint8_t cycles;       // Clock cycles, for a branch when not taken (timing.h)
+    uint8_t taken_cycles; // Clock cycles of a taken branch
+    uint16_t ext[MAX_EXTENSION_WORDS];
+};
 
-#endif // EXECUTOR_H
+// Why executor_run() returned
+typedef enum {
+    STOP_NONE,
+    STOP_HALT,           // A halting instruction (RTS for now) was executed
+    STOP_BUDGET,         // The instruction budget is used up
+    STOP_ADDRESS,        // pc reached StopConditions.address
+    STOP_CYCLES,         // The clock cycle count reached StopConditions.max_cycles
+    STOP_UNKNOWN_OPCODE, // An opcode could not be decoded
+    STOP_BREAKPOINT,     // pc reached a breakpoint
+    STOP_WATCHPOINT,     // The last instruction accessed a watched address
+} StopReason;
+
+// Optional reasons to stop before the instruction budget is used up. Stops
+// are taken before an instruction, but never before the first one of a run.
+typedef struct {
+    bool use_address;
+    uint32_t address;              // Stop when pc reaches this address
+    unsigned long long max_cycles; // Stop once this many clock cycles ran, 0 for none
+} StopConditions;
+
+// Run-time switches for execute_program
+typedef struct {
+    bool use_jit;      // Translate hot blocks to native code where supported
+    bool jit_lockstep; // Re-run every native block in the interpreter and compare
+    bool headless;     // No per-instruction trace, only a final summary
+    bool no_idle_skip; // Run idle loops in full, see idle.h
+    const char* trace_file; // Binary trace output, see trace.h, or NULL
+    const char* profile_file; // Instruction sequence profile to add to, see profile.h, or NULL
+    unsigned long budget;   // Instructions to run, 0 for no limit
+    StopConditions stop;
+} ExecOptions;
+
+// Address of a memory effective address of 'op', whose extension words start
+// at ext[index]. (An)+ and -(An) update An.
+uint32_t resolve_ea(Machine* m, const DecodedOp* op, uint8_t ea_field, int size_code, int index);
 
-  
+// Builds the shared dispatch table. Safe to call again; call it once before
+// starting machines on several threads.
+void executor_init(void);
+int executor_verify_dispatch(void);
+bool executor_test_condition(int condition, uint16_t sr);
+
+// Runs a program from start to finish with the summary printed at the end
+StopReason execute_program(Machine* m, const ExecOptions* options);
+
+// The same in steps: executor_run() may be called repeatedly to resume
+// where the previous call stopped. 'stop' may be NULL.
+void executor_start(Machine* m, const ExecOptions* options);
+StopReason executor_run(Machine* m, unsigned long budget, const StopConditions* stop);
+void executor_finish(Machine* m);
+// The condition that would stop a run before the instruction at pc, even as
+// its first one, or STOP_NONE
+StopReason executor_check_stop(Machine* m, const StopConditions* stop);
+// What execute_program() prints about the way a run stopped
+void executor_report_stop(Machine* m, const ExecOptions* options, StopReason reason);
+const char* executor_stop_reason_name(StopReason reason);
+
+// Counters of the current run, or of the last one once it finished
+typedef struct {
+    unsigned long instructions;
+    unsigned long blocks_entered;
+    unsigned long native_ops;
+    unsigned long lockstep_mismatches;
+    unsigned long idle_skipped; // Instructions of idle loops skipped, counted in 'instructions' too
+} ExecCounters;
+
+const ExecCounters* executor_counters(Machine* m);
+
+// For going back in time, see history.h: puts back the counters of an
+// earlier point of the run, and holds back per-instruction output, text and
+// binary, while instructions are run again
+void executor_set_counters(Machine* m, const ExecCounters* counters);
+void executor_mute(Machine* m, bool mute);
+
+#endif // EXECUTOR_H
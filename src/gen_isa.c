@@ -0,0 +1,602 @@
+// ISA generator, a build-time tool. Reads the instruction set from isa.def
+// and writes:
+//   isa_table.c   isa_table[], the mask, value and field positions of each
+//                 pattern, for the decoder, assembler and disassembler
+//   handlers.inc  the instruction handler variants executor.c includes
+// Each handler variant is one generic handler with its operand size, and for
+// MOVE the class of both effective addresses, fixed, so the hot handlers run
+// without branching on size_code or switching on EA modes. With a profile,
+// see profile.h, handlers.inc also lists the superinstructions: the handler
+// sequences whose fusion saves the most dispatches. Run by the Makefile, see
+// 'make isa'.
+//
+// Usage: gen_isa <isa_table.c> <handlers.inc> [profile]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <string.h>
+
+static FILE* out;
+
+// --- The Instruction Set ---
+
+typedef struct {
+    const char* kind;
+    const char* mnemonic;
+    const char* pattern;
+    const char* form;
+    const char* sizes;
+    const char* flags;
+    int cycles;
+    int cycles_long;
+    const char* handler; // Every opcode without a specialised variant runs it
+} Instruction;
+
+static const Instruction isa[] = {
+#define ISA(kind, mnemonic, pattern, form, sizes, flags, cycles, cycles_long, handler) \
+    { "INSN_" #kind, mnemonic, pattern, #form, sizes, #flags, cycles, cycles_long, #handler },
+#include "isa.def"
+};
+#define NUM_KINDS (int)(sizeof(isa) / sizeof(isa[0]))
+
+// Pattern letters in IsaFieldId order
+static const char field_letters[] = "sdrqcbef";
+
+static void fail(const Instruction* insn, const char* message) {
+    fprintf(stderr, "ERROR: isa.def, %s: %s\n", insn->kind, message);
+    exit(EXIT_FAILURE);
+}
+
+static uint16_t pattern_bits(const Instruction* insn, char bit) {
+    uint16_t bits = 0;
+    for (int i = 0; i < 16; ++i) {
+        if (insn->pattern[i] == bit) bits |= (uint16_t)(0x8000 >> i);
+    }
+    return bits;
+}
+
+static uint16_t pattern_mask(const Instruction* insn) {
+    return pattern_bits(insn, '0') | pattern_bits(insn, '1');
+}
+
+static void check_patterns(void) {
+    for (int i = 0; i < NUM_KINDS; ++i) {
+        const Instruction* insn = &isa[i];
+        if (strlen(insn->pattern) != 16) fail(insn, "pattern is not 16 bits long");
+        for (int j = 0; j < 16; ++j) {
+            char c = insn->pattern[j];
+            if (c != '0' && c != '1' && c != 'x' && !strchr(field_letters, c)) fail(insn, "unknown pattern letter");
+        }
+        for (const char* letter = field_letters; *letter; ++letter) {
+            uint16_t bits = pattern_bits(insn, *letter);
+            uint16_t low = bits & (uint16_t)-bits;
+            if (bits && ((bits + low) & bits)) fail(insn, "field bits are not contiguous");
+        }
+        // An earlier pattern wins, so it must not hide a later one
+        for (int j = 0; j < i; ++j) {
+            uint16_t both = pattern_mask(&isa[j]) & pattern_mask(insn);
+            int overlap = (pattern_bits(&isa[j], '1') & both) == (pattern_bits(insn, '1') & both);
+            if (overlap && (pattern_mask(&isa[j]) & ~pattern_mask(insn)) == 0) fail(insn, "hidden by an earlier pattern");
+        }
+    }
+}
+
+static void emit_isa_table(void) {
+    fprintf(out, "// Generated by gen_isa from src/isa.def, do not edit.\n\n");
+    fprintf(out, "#include \"isa.h\"\n\n");
+    fprintf(out, "const IsaEntry isa_table[NUM_INSTRUCTION_KINDS] = {\n");
+    for (int i = 0; i < NUM_KINDS; ++i) {
+        const Instruction* insn = &isa[i];
+        int sizes = 0;
+        for (const char* c = insn->sizes; *c; ++c) sizes |= *c == 'B' ? 1 : *c == 'W' ? 2 : 4;
+        int first_size = !insn->sizes[0] ? 0 : insn->sizes[0] == 'B' ? 0 : insn->sizes[0] == 'W' ? 1 : 2;
+        fprintf(out, "    [%s] = { \"%s\", 0x%04X, 0x%04X, %s, %s, 0x%X, %d, %d, %d, {",
+                insn->kind, insn->mnemonic, pattern_mask(insn), pattern_bits(insn, '1'), insn->form,
+                insn->flags, sizes, first_size, insn->cycles, insn->cycles_long);
+        for (int f = 0; field_letters[f]; ++f) {
+            uint16_t bits = pattern_bits(insn, field_letters[f]);
+            int shift = 0, width = 0;
+            while (bits && !(bits & (1u << shift))) shift++;
+            while (bits & (1u << (shift + width))) width++;
+            fprintf(out, " { %d, %d }%s", shift, width, field_letters[f + 1] ? "," : "");
+        }
+        fprintf(out, " } },\n");
+    }
+    fprintf(out, "};\n");
+}
+
+static const char* size_names[3] = { "b", "w", "l" };
+static const char* size_masks[3] = { "0xFF", "0xFFFF", "" };
+static const char* merge_masks[3] = { "0xFFFFFF00", "0xFFFF0000", "" };
+static const char* mem_sizes[3] = { "byte", "word", "long" };
+
+// --- Effective Address Classes ---
+
+typedef enum {
+    EA_DN, EA_AN, EA_IND, EA_POSTINC, EA_PREDEC, EA_DISP, EA_ABS_W, EA_ABS_L, EA_IMM,
+    EA_OTHER, // Indexed and PC-relative modes, handled by read_from_ea()/write_to_ea()
+    NUM_EA_CLASSES
+} EaClass;
+
+static const char* ea_names[NUM_EA_CLASSES] = {
+    "dn", "an", "ind", "postinc", "predec", "disp", "abs_w", "abs_l", "imm", "other"
+};
+
+// Extension words of a source EA of this class, or -1 if they vary
+static int ea_ext_words(EaClass ea, int size) {
+    switch (ea) {
+        case EA_DISP: case EA_ABS_W: return 1;
+        case EA_ABS_L: return 2;
+        case EA_IMM: return size == 2 ? 2 : 1;
+        case EA_OTHER: return -1;
+        default: return 0;
+    }
+}
+
+// Destinations that cannot be written to go through write_to_ea(), like the
+// generic handler
+static EaClass dst_class(EaClass ea) {
+    return ea == EA_IMM ? EA_OTHER : ea;
+}
+
+// (An)+ and -(An) step A7 by 2 for byte operands
+static const char* increment(int size, const char* reg) {
+    static char text[64];
+    if (size == 0) {
+        snprintf(text, sizeof(text), "(%s == 7 ? 2 : 1)", reg);
+    } else {
+        snprintf(text, sizeof(text), "%d", size == 1 ? 2 : 4);
+    }
+    return text;
+}
+
+// Address expression of a memory class, 'reg' holding the register number
+static void address_of(char* text, size_t length, EaClass ea, const char* reg, const char* ext) {
+    switch (ea) {
+        case EA_DISP: snprintf(text, length, "cpu->a[%s] + (int16_t)op->ext[%s]", reg, ext); break;
+        case EA_ABS_W: snprintf(text, length, "(uint32_t)(int32_t)(int16_t)op->ext[%s]", ext); break;
+        case EA_ABS_L: snprintf(text, length, "ext_long(op, %s)", ext); break;
+        default: snprintf(text, length, "cpu->a[%s]", reg); break;
+    }
+}
+
+// --- MOVE ---
+
+// Emits the read of the source operand into 'value', with the side effects
+// of resolve_ea() in the same order
+static void emit_move_read(int size, EaClass src) {
+    const char* reg = "op->ry";
+    char address[96];
+    address_of(address, sizeof(address), src, reg, "0");
+    switch (src) {
+        case EA_DN: fprintf(out, "    uint32_t value = cpu->d[%s];\n", reg); break;
+        case EA_AN: fprintf(out, "    uint32_t value = cpu->a[%s];\n", reg); break;
+        case EA_IMM:
+            fprintf(out, "    uint32_t value = %s;\n", size == 2 ? "ext_long(op, 0)" : "op->ext[0]");
+            break;
+        case EA_OTHER:
+            fprintf(out, "    uint32_t value = read_from_ea(m, op, op->src_ea, %d, op->src_ext);\n", size);
+            break;
+        case EA_POSTINC:
+            fprintf(out, "    uint32_t source = cpu->a[%s];\n", reg);
+            fprintf(out, "    cpu->a[%s] += %s;\n", reg, increment(size, reg));
+            fprintf(out, "    uint32_t value = mem_read_%s(m, source);\n", mem_sizes[size]);
+            break;
+        case EA_PREDEC:
+            fprintf(out, "    cpu->a[%s] -= %s;\n", reg, increment(size, reg));
+            fprintf(out, "    uint32_t value = mem_read_%s(m, cpu->a[%s]);\n", mem_sizes[size], reg);
+            break;
+        default:
+            fprintf(out, "    uint32_t value = mem_read_%s(m, %s);\n", mem_sizes[size], address);
+            break;
+    }
+}
+
+// Emits the write of 'value' and the flags, as the generic MOVE handlers do
+static void emit_move_write(int size, EaClass src, EaClass dst) {
+    const char* reg = "op->rx";
+    char ext[32];
+    int src_words = ea_ext_words(src, size);
+    if (src_words < 0) {
+        snprintf(ext, sizeof(ext), "op->dst_ext");
+    } else {
+        snprintf(ext, sizeof(ext), "%d", src_words);
+    }
+    char address[96];
+    address_of(address, sizeof(address), dst, reg, ext);
+
+    switch (dst) {
+        case EA_DN:
+            if (size == 2) {
+                fprintf(out, "    cpu->d[%s] = value;\n", reg);
+            } else {
+                fprintf(out, "    cpu->d[%s] = (cpu->d[%s] & %s) | (value & %s);\n",
+                        reg, reg, merge_masks[size], size_masks[size]);
+            }
+            break;
+        case EA_AN: // MOVEA does not affect flags; MOVE.B to An writes nothing
+            if (size == 1) fprintf(out, "    cpu->a[%s] = (int32_t)(int16_t)value;\n", reg);
+            if (size == 2) fprintf(out, "    cpu->a[%s] = value;\n", reg);
+            if (size != 0) return;
+            break;
+        case EA_OTHER:
+            fprintf(out, "    write_to_ea(m, op, op->dst_ea, value, %d, %s);\n", size, ext);
+            break;
+        case EA_POSTINC:
+            fprintf(out, "    uint32_t address = cpu->a[%s];\n", reg);
+            fprintf(out, "    cpu->a[%s] += %s;\n", reg, increment(size, reg));
+            fprintf(out, "    mem_write_%s(m, address, value);\n", mem_sizes[size]);
+            break;
+        case EA_PREDEC:
+            fprintf(out, "    cpu->a[%s] -= %s;\n", reg, increment(size, reg));
+            fprintf(out, "    mem_write_%s(m, cpu->a[%s], value);\n", mem_sizes[size], reg);
+            break;
+        default:
+            fprintf(out, "    mem_write_%s(m, %s, value);\n", mem_sizes[size], address);
+            break;
+    }
+    fprintf(out, "    set_logic_flags(cpu, value, %d);\n", size);
+}
+
+static void emit_move(int size, EaClass src, EaClass dst) {
+    fprintf(out, "static void handle_move_%s_%s_%s(Machine* m, const DecodedOp* op) {\n",
+            size_names[size], ea_names[src], ea_names[dst]);
+    fprintf(out, "    CPU* cpu = &m->cpu;\n");
+    emit_move_read(size, src);
+    emit_move_write(size, src, dst);
+    fprintf(out, "}\n\n");
+}
+
+// --- Arithmetic and Logic on Dn ---
+
+typedef enum { ALU_QUICK, ALU_IMM, ALU_REG, ALU_AND } AluForm;
+
+static const struct {
+    const char* name; // Generic handler, the variants add a size suffix
+    AluForm form;
+    char op;          // '+', '-' or '&'
+} alu_ops[] = {
+    { "handle_addq", ALU_QUICK, '+' }, { "handle_subq", ALU_QUICK, '-' },
+    { "handle_addi", ALU_IMM, '+' }, { "handle_subi", ALU_IMM, '-' },
+    { "handle_add_reg", ALU_REG, '+' }, { "handle_sub_reg", ALU_REG, '-' },
+    { "handle_andi", ALU_AND, '&' },
+};
+#define NUM_ALU_OPS (int)(sizeof(alu_ops) / sizeof(alu_ops[0]))
+
+// Same arithmetic as the generic handlers, size by size
+static void emit_alu(int index, int size) {
+    AluForm form = alu_ops[index].form;
+    char c = alu_ops[index].op;
+    const char* is_sub = c == '-' ? "true" : "false";
+    const char* dst = form == ALU_REG ? "op->rx" : "op->ry";
+
+    fprintf(out, "static void %s_%s(Machine* m, const DecodedOp* op) {\n", alu_ops[index].name, size_names[size]);
+    fprintf(out, "    CPU* cpu = &m->cpu;\n");
+    fprintf(out, "    uint32_t reg_val = cpu->d[%s];\n", dst);
+    if (form == ALU_AND) {
+        if (size == 2) {
+            fprintf(out, "    uint32_t result = reg_val & op->imm;\n");
+            fprintf(out, "    cpu->d[%s] = result;\n", dst);
+        } else {
+            fprintf(out, "    uint32_t result = (reg_val & %s) & (op->imm & %s);\n", size_masks[size], size_masks[size]);
+            fprintf(out, "    cpu->d[%s] = (reg_val & %s) | result;\n", dst, merge_masks[size]);
+        }
+        fprintf(out, "    set_logic_flags(cpu, result, %d);\n", size);
+        fprintf(out, "}\n\n");
+        return;
+    }
+
+    // 'source' is what set_flags() gets, 'operand' what the arithmetic uses
+    const char* source = "op->imm";
+    char operand[64];
+    snprintf(operand, sizeof(operand), "op->imm");
+    if (form == ALU_REG) {
+        if (size == 2) {
+            fprintf(out, "    uint32_t s = cpu->d[op->ry];\n");
+        } else {
+            fprintf(out, "    uint32_t s = cpu->d[op->ry] & %s;\n", size_masks[size]);
+        }
+        source = "s";
+        snprintf(operand, sizeof(operand), "s");
+    } else if (form == ALU_IMM && size < 2) {
+        snprintf(operand, sizeof(operand), "(op->imm & %s)", size_masks[size]);
+    }
+    if (size == 2) {
+        fprintf(out, "    uint32_t result = reg_val %c %s;\n", c, operand);
+        fprintf(out, "    cpu->d[%s] = result;\n", dst);
+        fprintf(out, "    set_flags(cpu, %s, reg_val, result, 2, %s);\n", source, is_sub);
+    } else {
+        fprintf(out, "    uint32_t val = reg_val & %s;\n", size_masks[size]);
+        fprintf(out, "    uint32_t result = val %c %s;\n", c, operand);
+        fprintf(out, "    cpu->d[%s] = (reg_val & %s) | (result & %s);\n", dst, merge_masks[size], size_masks[size]);
+        fprintf(out, "    set_flags(cpu, %s, val, result, %d, %s);\n", source, size, is_sub);
+    }
+    fprintf(out, "}\n\n");
+}
+
+// --- Handler Names ---
+
+#define MAX_HANDLERS 512
+#define MAX_NAME 48
+
+static char handler_names[MAX_HANDLERS][MAX_NAME];
+static int num_handlers;
+
+static void add_handler(const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    vsnprintf(handler_names[num_handlers++], MAX_NAME, format, args);
+    va_end(args);
+}
+
+// Every handler an op can run, generic ones first in kind order
+static void collect_handlers(void) {
+    for (int k = 0; k < NUM_KINDS; ++k) add_handler("%s", isa[k].handler);
+    for (int i = 0; i < NUM_ALU_OPS; ++i) {
+        for (int size = 0; size < 3; ++size) add_handler("%s_%s", alu_ops[i].name, size_names[size]);
+    }
+    for (int size = 0; size < 3; ++size) {
+        for (int src = 0; src < NUM_EA_CLASSES; ++src) {
+            for (int dst = 0; dst < NUM_EA_CLASSES; ++dst) {
+                if (dst_class(dst) != (EaClass)dst) continue;
+                add_handler("handle_move_%s_%s_%s", size_names[size], ea_names[src], ea_names[dst]);
+            }
+        }
+    }
+}
+
+static int handler_index(const char* name) {
+    for (int i = 0; i < num_handlers; ++i) {
+        if (strcmp(handler_names[i], name) == 0) return i;
+    }
+    return -1;
+}
+
+// --- Superinstructions ---
+
+#define MAX_FUSED 16       // Superinstructions generated at most
+#define MAX_FUSED_LENGTH 3 // Handlers in one, as profiled
+
+typedef struct {
+    int handlers[MAX_FUSED_LENGTH];
+    int length;
+    unsigned long long saved; // Dispatches saved over the profiled runs
+} Fused;
+
+static Fused fused[MAX_FUSED]; // Most saved first
+static int num_fused;
+
+// Only the last op of a sequence may leave the block
+static bool is_branch_handler(const char* name) {
+    for (int k = 0; k < NUM_KINDS; ++k) {
+        if (strcmp(isa[k].handler, name) == 0 && strstr(isa[k].flags, "OPF_BRANCH")) return true;
+    }
+    return false;
+}
+
+static void consider(const Fused* candidate) {
+    int i = num_fused < MAX_FUSED ? num_fused++ : MAX_FUSED;
+    while (i > 0 && fused[i - 1].saved < candidate->saved) {
+        if (i < MAX_FUSED) fused[i] = fused[i - 1];
+        i--;
+    }
+    if (i < MAX_FUSED) fused[i] = *candidate;
+}
+
+// Keeps the MAX_FUSED sequences of the profile that save the most
+// dispatches: each run of a fused sequence saves one per op after the first
+static void read_profile(const char* filename) {
+    FILE* f = fopen(filename, "r");
+    if (!f) {
+        fprintf(stderr, "WARN: No profile '%s', generating no superinstructions.\n", filename);
+        return;
+    }
+    char line[512];
+    while (fgets(line, sizeof(line), f)) {
+        if (line[0] == '#') continue;
+        char* token = strtok(line, " \t\r\n");
+        if (!token) continue;
+        Fused candidate = { { 0 }, 0, strtoull(token, NULL, 10) };
+        bool usable = true;
+        while ((token = strtok(NULL, " \t\r\n"))) {
+            int index = handler_index(token);
+            if (index < 0 || candidate.length == MAX_FUSED_LENGTH) {
+                usable = false;
+                break;
+            }
+            if (candidate.length > 0 && is_branch_handler(handler_names[candidate.handlers[candidate.length - 1]])) {
+                usable = false;
+            }
+            candidate.handlers[candidate.length++] = index;
+        }
+        if (!usable || candidate.length < 2) continue;
+        candidate.saved *= (unsigned long long)(candidate.length - 1);
+        consider(&candidate);
+    }
+    fclose(f);
+}
+
+// "fused_" and the handler names without "handle_"
+static const char* fused_name(const Fused* f) {
+    static char name[MAX_FUSED_LENGTH * MAX_NAME];
+    size_t used = (size_t)snprintf(name, sizeof(name), "fused");
+    for (int i = 0; i < f->length; ++i) {
+        const char* handler = handler_names[f->handlers[i]];
+        if (strncmp(handler, "handle_", 7) == 0) handler += 7;
+        used += (size_t)snprintf(name + used, sizeof(name) - used, "_%s", handler);
+    }
+    return name;
+}
+
+static void emit_fused_list(const char* list, int length) {
+    fprintf(out, "#define %s(X) \\\n", list);
+    for (int i = 0; i < num_fused; ++i) {
+        if (fused[i].length != length) continue;
+        fprintf(out, "    X(%s", fused_name(&fused[i]));
+        for (int k = 0; k < length; ++k) fprintf(out, ", %s", handler_names[fused[i].handlers[k]]);
+        fprintf(out, ") \\\n");
+    }
+    fprintf(out, "\n");
+}
+
+static void emit_superinstructions(void) {
+    fprintf(out, "// Superinstructions, the handler sequences that saved the most dispatches\n");
+    fprintf(out, "// in the profile: X(name, handlers...). The threaded loop runs them.\n");
+    emit_fused_list("FUSED_PAIRS", 2);
+    emit_fused_list("FUSED_TRIPLES", 3);
+
+    // Numbered after the handlers, in list order
+    fprintf(out, "enum {\n");
+    int count = 0;
+    for (int length = 2; length <= MAX_FUSED_LENGTH; ++length) {
+        for (int i = 0; i < num_fused; ++i) {
+            if (fused[i].length != length) continue;
+            fprintf(out, "    ID_%s%s,\n", fused_name(&fused[i]), count++ ? "" : " = NUM_HANDLERS");
+        }
+    }
+    fprintf(out, "    NUM_DISPATCH_IDS%s\n", count ? "" : " = NUM_HANDLERS");
+    fprintf(out, "};\n\n");
+
+    fprintf(out, "#ifdef THREADED_CORE\n");
+    fprintf(out, "typedef struct {\n");
+    fprintf(out, "    uint16_t handlers[%d];\n", MAX_FUSED_LENGTH);
+    fprintf(out, "    uint8_t length;\n");
+    fprintf(out, "    uint16_t fused;\n");
+    fprintf(out, "} FusedSequence;\n\n");
+    fprintf(out, "// Longest first, so fuse_ops() prefers them\n");
+    fprintf(out, "#define NUM_FUSED_SEQUENCES %d\n", num_fused);
+    fprintf(out, "static const FusedSequence fused_sequences[] = {\n");
+    for (int length = MAX_FUSED_LENGTH; length >= 2; --length) {
+        for (int i = 0; i < num_fused; ++i) {
+            if (fused[i].length != length) continue;
+            fprintf(out, "    { {");
+            for (int k = 0; k < length; ++k) fprintf(out, "%s ID_%s", k ? "," : "", handler_names[fused[i].handlers[k]]);
+            fprintf(out, " }, %d, ID_%s },\n", length, fused_name(&fused[i]));
+        }
+    }
+    if (!num_fused) fprintf(out, "    { { 0 }, 0, 0 },\n");
+    fprintf(out, "};\n");
+    fprintf(out, "#endif\n\n");
+}
+
+// --- Output ---
+
+static void emit_handler_list(void) {
+    fprintf(out, "// Every handler an op can run, generic ones first\n");
+    fprintf(out, "#define HANDLER_LIST(X) \\\n");
+    for (int i = 0; i < num_handlers; ++i) fprintf(out, "    X(%s) \\\n", handler_names[i]);
+    fprintf(out, "\n#define HANDLER_ID(name) ID_##name,\n");
+    fprintf(out, "enum { HANDLER_LIST(HANDLER_ID) NUM_HANDLERS };\n");
+    fprintf(out, "#undef HANDLER_ID\n\n");
+}
+
+static void emit_selector(void) {
+    fprintf(out, "#define HANDLER_POINTER(name) name,\n");
+    fprintf(out, "static const InstructionHandler handler_table[NUM_HANDLERS] = { HANDLER_LIST(HANDLER_POINTER) };\n");
+    fprintf(out, "#undef HANDLER_POINTER\n\n");
+    fprintf(out, "static InstructionHandler handler_for(uint16_t id) {\n");
+    fprintf(out, "    return handler_table[id];\n");
+    fprintf(out, "}\n\n");
+
+    fprintf(out, "// Class of a MOVE source EA field\n");
+    fprintf(out, "static int ea_class(uint8_t ea_field) {\n");
+    fprintf(out, "    static const uint8_t mode_7[8] = { %d, %d, %d, %d, %d, %d, %d, %d };\n",
+            EA_ABS_W, EA_ABS_L, EA_OTHER, EA_OTHER, EA_IMM, EA_OTHER, EA_OTHER, EA_OTHER);
+    fprintf(out, "    static const uint8_t modes[7] = { %d, %d, %d, %d, %d, %d, %d };\n",
+            EA_DN, EA_AN, EA_IND, EA_POSTINC, EA_PREDEC, EA_DISP, EA_OTHER);
+    fprintf(out, "    int mode = ea_field >> 3;\n");
+    fprintf(out, "    return mode == 7 ? mode_7[ea_field & 7] : modes[mode];\n");
+    fprintf(out, "}\n\n");
+
+    fprintf(out, "// MOVE variants by size, source class and destination class\n");
+    fprintf(out, "static const uint16_t move_handlers[3][%d][%d] = {\n", NUM_EA_CLASSES, NUM_EA_CLASSES);
+    for (int size = 0; size < 3; ++size) {
+        fprintf(out, "    {\n");
+        for (int src = 0; src < NUM_EA_CLASSES; ++src) {
+            fprintf(out, "        {");
+            for (int dst = 0; dst < NUM_EA_CLASSES; ++dst) {
+                fprintf(out, "%s\n            ID_handle_move_%s_%s_%s", dst ? "," : "",
+                        size_names[size], ea_names[src], ea_names[dst_class(dst)]);
+            }
+            fprintf(out, " },\n");
+        }
+        fprintf(out, "    },\n");
+    }
+    fprintf(out, "};\n\n");
+
+    fprintf(out, "// The handler id for an opcode of this kind and operand size\n");
+    fprintf(out, "static uint16_t select_handler(int kind, uint16_t opcode, int size_code) {\n");
+    fprintf(out, "    uint8_t dst_ea = (((opcode >> 6) & 0x7) << 3) | ((opcode >> 9) & 0x7);\n");
+    fprintf(out, "    switch (kind) {\n");
+    for (int k = 0; k < NUM_KINDS; ++k) {
+        const char* handler = isa[k].handler;
+        if (strcmp(isa[k].form, "FORM_MOVE") == 0) {
+            fprintf(out, "        case %s: return move_handlers[size_code][ea_class(opcode & 0x3F)][ea_class(dst_ea)];\n",
+                    isa[k].kind);
+            continue;
+        }
+        for (int i = 0; i < NUM_ALU_OPS; ++i) {
+            if (strcmp(alu_ops[i].name, handler) != 0) continue;
+            // Size code 3 is not a valid size, the generic handler decides
+            fprintf(out, "        case %s:\n", isa[k].kind);
+            for (int size = 0; size < 3; ++size) {
+                fprintf(out, "            if (size_code == %d) return ID_%s_%s;\n", size, handler, size_names[size]);
+            }
+            fprintf(out, "            return ID_%s;\n", handler);
+        }
+    }
+    fprintf(out, "    }\n");
+    fprintf(out, "    return kind; // The generic handlers come first, in kind order\n");
+    fprintf(out, "}\n");
+}
+
+static void open_output(const char* filename) {
+    out = fopen(filename, "w");
+    if (!out) {
+        perror("Could not open output file");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void close_output(void) {
+    if (fclose(out) != 0) {
+        perror("Could not write output file");
+        exit(EXIT_FAILURE);
+    }
+}
+
+int main(int argc, char** argv) {
+    if (argc != 3 && argc != 4) {
+        fprintf(stderr, "Usage: %s <isa_table.c> <handlers.inc> [profile]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    check_patterns();
+    collect_handlers();
+    if (argc == 4) read_profile(argv[3]);
+
+    open_output(argv[1]);
+    emit_isa_table();
+    close_output();
+
+    open_output(argv[2]);
+    fprintf(out, "// Generated by gen_isa from src/isa.def, do not edit.\n");
+    fprintf(out, "// Included by executor.c after the generic handlers.\n\n");
+    emit_handler_list();
+    for (int i = 0; i < NUM_ALU_OPS; ++i) {
+        for (int size = 0; size < 3; ++size) emit_alu(i, size);
+    }
+    for (int size = 0; size < 3; ++size) {
+        for (int src = 0; src < NUM_EA_CLASSES; ++src) {
+            for (int dst = 0; dst < NUM_EA_CLASSES; ++dst) {
+                if (dst_class(dst) == (EaClass)dst) emit_move(size, src, dst);
+            }
+        }
+    }
+    emit_selector();
+    emit_superinstructions();
+    close_output();
+    return EXIT_SUCCESS;
+}
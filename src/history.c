@@ -0,0 +1,186 @@
+#include "history.h"
+#include "debug.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef struct {
+    uint64_t position;
+    ExecCounters counters; // The device clock may run on them
+    MachineSnapshot* snapshot;
+} Checkpoint;
+
+struct History {
+    unsigned long interval;
+    int max_checkpoints;
+    Checkpoint* checkpoints; // Oldest first
+    int count;
+    uint64_t position;
+};
+
+static void take_checkpoint(Machine* m, struct History* h) {
+    if (h->count == h->max_checkpoints) {
+        // Keep every other one, the first always
+        int kept = 0;
+        for (int i = 0; i < h->count; ++i) {
+            if (i % 2 == 0) {
+                h->checkpoints[kept++] = h->checkpoints[i];
+            } else {
+                machine_snapshot_free(h->checkpoints[i].snapshot);
+            }
+        }
+        h->count = kept;
+        h->interval *= 2;
+    }
+    Checkpoint* c = &h->checkpoints[h->count++];
+    c->position = h->position;
+    c->counters = *executor_counters(m);
+    c->snapshot = machine_snapshot(m);
+}
+
+// Drops the checkpoints after 'position', the run may go another way
+static void drop_after(struct History* h, uint64_t position) {
+    while (h->count > 1 && h->checkpoints[h->count - 1].position > position) {
+        machine_snapshot_free(h->checkpoints[--h->count].snapshot);
+    }
+}
+
+void history_start(Machine* m, unsigned long interval, int max_checkpoints) {
+    history_stop(m);
+    struct History* h = (struct History*)calloc(1, sizeof(struct History));
+    if (!h) {
+        perror("Failed to allocate history");
+        exit(EXIT_FAILURE);
+    }
+    h->interval = interval ? interval : HISTORY_DEFAULT_INTERVAL;
+    h->max_checkpoints = max_checkpoints > 2 ? max_checkpoints : 2;
+    h->checkpoints = (Checkpoint*)malloc(h->max_checkpoints * sizeof(Checkpoint));
+    if (!h->checkpoints) {
+        perror("Failed to allocate history");
+        exit(EXIT_FAILURE);
+    }
+    m->history = h;
+    take_checkpoint(m, h);
+}
+
+void history_stop(Machine* m) {
+    struct History* h = m->history;
+    if (!h) return;
+    for (int i = 0; i < h->count; ++i) machine_snapshot_free(h->checkpoints[i].snapshot);
+    free(h->checkpoints);
+    free(h);
+    m->history = NULL;
+}
+
+uint64_t history_position(Machine* m) {
+    return m->history ? m->history->position : 0;
+}
+
+// --- Running ---
+
+// Runs up to 'budget' instructions and moves the position by those run
+static StopReason run(Machine* m, unsigned long budget, const StopConditions* stop) {
+    unsigned long before = executor_counters(m)->instructions;
+    StopReason reason = executor_run(m, budget, stop);
+    m->history->position += executor_counters(m)->instructions - before;
+    return reason;
+}
+
+StopReason history_run(Machine* m, unsigned long budget, const StopConditions* stop) {
+    struct History* h = m->history;
+    static const StopConditions no_stop = {0};
+    if (!stop) stop = &no_stop;
+    bool started = false;
+    while (budget > 0) {
+        uint64_t next = h->checkpoints[h->count - 1].position + h->interval;
+        if (h->position >= next) {
+            take_checkpoint(m, h);
+            next = h->position + h->interval;
+        }
+        // A new run does not stop before its first instruction, this one may
+        StopReason reason;
+        if (started && (reason = executor_check_stop(m, stop)) != STOP_NONE) return reason;
+        started = true;
+
+        unsigned long chunk = next - h->position < budget ? (unsigned long)(next - h->position) : budget;
+        uint64_t before = h->position;
+        reason = run(m, chunk, stop);
+        budget -= (unsigned long)(h->position - before);
+        if (reason != STOP_BUDGET) return reason;
+    }
+    return STOP_BUDGET;
+}
+
+// Restores checkpoint 'index' and runs forward to 'position' without output
+static bool replay(Machine* m, int index, uint64_t position) {
+    struct History* h = m->history;
+    const Checkpoint* c = &h->checkpoints[index];
+    machine_restore(m, c->snapshot);
+    executor_set_counters(m, &c->counters);
+    h->position = c->position;
+
+    executor_mute(m, true);
+    while (h->position < position) {
+        // Breakpoints and watchpoints only pause a replay
+        StopReason reason = run(m, (unsigned long)(position - h->position), NULL);
+        if (reason == STOP_HALT || reason == STOP_UNKNOWN_OPCODE) break;
+    }
+    executor_mute(m, false);
+    return h->position == position;
+}
+
+// The newest checkpoint at or before 'position'
+static int checkpoint_before(const struct History* h, uint64_t position) {
+    int index = h->count - 1;
+    while (index > 0 && h->checkpoints[index].position > position) index--;
+    return index;
+}
+
+bool history_seek(Machine* m, uint64_t position) {
+    struct History* h = m->history;
+    bool reached = replay(m, checkpoint_before(h, position), position);
+    drop_after(h, h->position);
+    return reached;
+}
+
+bool history_step_back(Machine* m, uint64_t count) {
+    uint64_t position = history_position(m);
+    return history_seek(m, count < position ? position - count : 0);
+}
+
+// --- Finding Writes ---
+
+// Runs from checkpoint 'index' to 'end' and returns the position after the
+// last write to 'address', or 0 if there was none
+static uint64_t last_write_in(Machine* m, int index, uint64_t end, uint32_t address) {
+    struct History* h = m->history;
+    uint64_t found = 0;
+    replay(m, index, h->checkpoints[index].position);
+    executor_mute(m, true);
+    while (h->position < end) {
+        StopReason reason = run(m, (unsigned long)(end - h->position), NULL);
+        const WatchHit* hit = debug_last_hit(m);
+        if (reason == STOP_WATCHPOINT && hit && hit->write && hit->address == address) found = h->position;
+        if (reason == STOP_HALT || reason == STOP_UNKNOWN_OPCODE) break;
+    }
+    executor_mute(m, false);
+    return found;
+}
+
+bool history_find_write(Machine* m, uint32_t address) {
+    struct History* h = m->history;
+    uint64_t start = h->position;
+    if (!debug_add_watchpoint(m, address, 1, WATCH_WRITE)) return false;
+
+    // Search the intervals newest first, the first write found is the last
+    uint64_t found = 0;
+    uint64_t end = start;
+    for (int index = checkpoint_before(h, start); index >= 0 && !found; --index) {
+        if (h->checkpoints[index].position >= end) continue;
+        found = last_write_in(m, index, end, address);
+        end = h->checkpoints[index].position;
+    }
+    debug_remove_watchpoint(m, address);
+
+    // Stop before the writing instruction, or go back to where we were
+    return history_seek(m, found ? found - 1 : start) && found;
+}
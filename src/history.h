@@ -0,0 +1,41 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include "executor.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+// Reverse execution. While history is on, history_run() runs like
+// executor_run() and takes a checkpoint, a machine snapshot, every
+// 'interval' instructions. Checkpoints share unchanged pages with the
+// machine, so each costs about the pages stored to in its interval.
+//
+// Going back restores the newest checkpoint before the target and runs the
+// rest again with output held back, so any earlier instruction is reached
+// by re-executing less than one interval. At most 'max_checkpoints' are
+// kept: when they are used up every other one is dropped and the interval
+// doubles, so the whole run stays reachable in bounded memory.
+//
+// Positions count the instructions run since history_start(). All calls go
+// between executor_start() and executor_finish(). Device output written by
+// re-executed instructions is written again.
+
+#define HISTORY_DEFAULT_INTERVAL 100000
+#define HISTORY_DEFAULT_CHECKPOINTS 64
+
+void history_start(Machine* m, unsigned long interval, int max_checkpoints);
+void history_stop(Machine* m);
+
+StopReason history_run(Machine* m, unsigned long budget, const StopConditions* stop);
+uint64_t history_position(Machine* m);
+
+// Returns false if the run ended before 'position', and stays where it ended
+bool history_seek(Machine* m, uint64_t position);
+bool history_step_back(Machine* m, uint64_t count);
+
+// Goes back to the last instruction before the current position that wrote
+// the byte at 'address', stopping before it. Returns false, not moving, if
+// no reachable instruction did.
+bool history_find_write(Machine* m, uint32_t address);
+
+#endif // HISTORY_H
@@ -0,0 +1,152 @@
+#include "idle.h"
+#include "bus.h"
+#include "devices.h"
+#include "timing.h"
+#include <string.h>
+
+#define CONDITION_NE 0x6
+
+// Iterations skipped at most per call. A loop nothing will ever change is
+// then fast-forwarded a chunk at a time, so an unlimited budget cannot
+// carry the clock and the counters past their range.
+#define IDLE_SKIP_CHUNK 0x100000ul
+
+static uint32_t size_mask(int size_code) {
+    return size_code == 0 ? 0xFF : size_code == 1 ? 0xFFFF : 0xFFFFFFFF;
+}
+
+static bool is_move(const DecodedOp* op) {
+    return op->kind == INSN_MOVE_B || op->kind == INSN_MOVE_W || op->kind == INSN_MOVE_L;
+}
+
+// Ops a spin loop may run: none stores or changes an address register
+// other than by loading it
+static bool is_spin_op(const DecodedOp* op) {
+    switch (op->kind) {
+        case INSN_MOVE_B:
+        case INSN_MOVE_W:
+        case INSN_MOVE_L: {
+            int src_mode = op->src_ea >> 3;
+            return (op->dst_ea >> 3) <= 1 && src_mode != 3 && src_mode != 4; // To Dn or An, no (An)+ or -(An)
+        }
+        case INSN_BTST: case INSN_BCHG: case INSN_BCLR: case INSN_BSET:
+        case INSN_ANDI: case INSN_SUBI: case INSN_ADDI:
+        case INSN_ADDQ: case INSN_SUBQ:
+        case INSN_SUB: case INSN_ADD:
+        case INSN_NOP:
+            return true; // Data registers only
+        default:
+            return false;
+    }
+}
+
+IdleKind idle_classify(const Block* block) {
+    const DecodedOp* last = &block->ops[block->num_ops - 1];
+    if (last->kind != INSN_BCC || last->imm != block->start_pc) return IDLE_NONE;
+
+    int counters = 0; // ADDQ or SUBQ ops, other than NOPs for a countdown
+    bool spin = true;
+    for (int i = 0; i < block->num_ops - 1; ++i) {
+        const DecodedOp* op = &block->ops[i];
+        if (op->kind == INSN_ADDQ || op->kind == INSN_SUBQ) {
+            counters++;
+        } else if (op->kind != INSN_NOP) {
+            counters = 2;
+        }
+        spin = spin && is_spin_op(op);
+    }
+    int condition = (int)isa_get_field(&isa_table[INSN_BCC], last->opcode, ISA_FIELD_CONDITION);
+    if (counters == 1 && condition == CONDITION_NE) return IDLE_COUNTDOWN;
+    return spin ? IDLE_SPIN : IDLE_NONE;
+}
+
+// --- Countdown Loops ---
+
+static const DecodedOp* find_counter(const Block* block) {
+    for (int i = 0;; ++i) {
+        if (block->ops[i].kind == INSN_ADDQ || block->ops[i].kind == INSN_SUBQ) return &block->ops[i];
+    }
+}
+
+// Iterations before the one that reaches zero, which runs as usual to set
+// the flags. A counter that would wrap past zero is left to run.
+static unsigned long countdown_iterations(Machine* m, const DecodedOp* counter) {
+    uint32_t mask = size_mask(counter->size_code);
+    uint32_t value = m->cpu.d[counter->ry] & mask;
+    uint32_t distance = counter->kind == INSN_SUBQ ? value : (0u - value) & mask;
+    if (distance == 0 || distance % counter->imm) return 0;
+    return distance / counter->imm - 1;
+}
+
+static void count_down(Machine* m, const DecodedOp* counter, unsigned long iterations) {
+    uint32_t mask = size_mask(counter->size_code);
+    uint32_t* dn = &m->cpu.d[counter->ry];
+    uint32_t step = (uint32_t)iterations * counter->imm;
+    uint32_t value = counter->kind == INSN_SUBQ ? *dn - step : *dn + step;
+    *dn = (*dn & ~mask) | (value & mask);
+}
+
+// --- Spin Loops ---
+
+static bool same_registers(const CPU* a, const CPU* b) {
+    return memcmp(a->d, b->d, sizeof(a->d)) == 0 && memcmp(a->a, b->a, sizeof(a->a)) == 0 &&
+           cpu_get_sr(a) == cpu_get_sr(b);
+}
+
+// The first clock after 'after' at which some byte the loop reads may change
+static uint64_t next_event(Machine* m, const Block* block, uint64_t after) {
+    uint64_t event = BUS_NEVER;
+    for (int i = 0; i < block->num_ops; ++i) {
+        const DecodedOp* op = &block->ops[i];
+        if (!is_move(op) || (op->src_ea >> 3) <= 1 || op->src_ea == 0x3C) continue; // Register or immediate
+        uint32_t address = resolve_ea(m, op, op->src_ea, op->size_code, op->src_ext);
+        int bytes = 1 << op->size_code;
+        for (int b = 0; b < bytes; ++b) {
+            uint64_t change = bus_next_change(m, address + b, after);
+            if (change < event) event = change;
+        }
+    }
+    return event;
+}
+
+// --- Skipping ---
+
+unsigned long idle_skip(Machine* m, const Block* block, const CPU* before, unsigned long max_iterations,
+                        unsigned long long max_cycles) {
+    // One iteration in device clock units, see devices.h
+#ifdef CYCLE_TIMING
+    uint64_t period = m->cpu.cycles - before->cycles;
+    if (max_cycles) {
+        uint64_t first_end = m->cpu.cycles + block->max_cycles;
+        if (first_end >= max_cycles) return 0;
+        uint64_t fit = (max_cycles - first_end - 1) / period + 1;
+        if (fit < max_iterations) max_iterations = (unsigned long)fit;
+    }
+#else
+    (void)max_cycles; // Silence unused parameter warning
+    uint64_t period = (uint64_t)block->num_ops;
+#endif
+    if (period == 0) return 0;
+    if (max_iterations > IDLE_SKIP_CHUNK) max_iterations = IDLE_SKIP_CHUNK;
+#ifdef CYCLE_TIMING
+    uint64_t room = (UINT64_MAX - m->cpu.cycles) / period; // Stop short of wrapping the clock
+    if (room < max_iterations) max_iterations = (unsigned long)room;
+#endif
+
+    unsigned long iterations = 0;
+    if (block->idle == IDLE_COUNTDOWN) {
+        const DecodedOp* counter = find_counter(block);
+        iterations = countdown_iterations(m, counter);
+        if (iterations > max_iterations) iterations = max_iterations;
+        count_down(m, counter, iterations);
+    } else if (block->idle == IDLE_SPIN && same_registers(before, &m->cpu)) {
+        // The iteration run read what it would have read at its start
+        uint64_t now = devices_clock(m);
+        uint64_t event = next_event(m, block, now - period);
+        if (event <= now) return 0;
+        uint64_t fit = (event - now) / period;
+        iterations = event == BUS_NEVER || fit > max_iterations ? max_iterations : (unsigned long)fit;
+    }
+    TIMING_ADD(&m->cpu, iterations * period);
+    return iterations;
+}
@@ -0,0 +1,41 @@
+#ifndef IDLE_H
+#define IDLE_H
+
+#include "block_cache.h"
+#include <stdint.h>
+
+// Fast-forwarding of loops that only pass time.
+//
+// A block that branches back to its own start is a loop of its own. Two
+// kinds are recognised when the block is built:
+//   countdown  SUBQ or ADDQ #q,Dn and BNE, with nothing but NOPs besides.
+//              The iterations left follow from Dn, so all but the last are
+//              skipped by setting Dn and the clock in one step.
+//   spin       Only register operations and reads of memory or devices, no
+//              stores. If an iteration leaves every register and SR as it
+//              found them, the next ones do the same until something they
+//              read changes: RAM never does, a device says when it will,
+//              see bus.h. Those iterations are skipped by advancing the
+//              clock, up to the next device event.
+// The executor runs each loop block once as usual and then calls idle_skip(),
+// which only skips iterations the block would have run whole, so the results
+// are those of running every instruction.
+
+typedef enum {
+    IDLE_NONE,
+    IDLE_COUNTDOWN,
+    IDLE_SPIN,
+} IdleKind;
+
+// The kind of loop 'block' is, from its decoded ops
+IdleKind idle_classify(const Block* block);
+
+// Skips iterations of an idle loop that has just run once from 'before' and
+// is back at its start, at most 'max_iterations' and one chunk of them, and
+// returns their number.
+// With a cycle limit, 'max_cycles', only iterations the executor would have
+// run without checking the limit are skipped, see executor_run().
+unsigned long idle_skip(Machine* m, const Block* block, const CPU* before, unsigned long max_iterations,
+                        unsigned long long max_cycles);
+
+#endif // IDLE_H
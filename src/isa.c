@@ -0,0 +1,80 @@
+#include "isa.h"
+#include <string.h>
+#include <strings.h>
+
+static const char* const condition_names[16] = {
+#define CONDITION(code, name) [code] = name,
+#include "isa.def"
+};
+
+const IsaEntry* isa_match(uint16_t opcode) {
+    for (int i = 0; i < NUM_INSTRUCTION_KINDS; ++i) {
+        if ((opcode & isa_table[i].mask) == isa_table[i].value) return &isa_table[i];
+    }
+    return NULL;
+}
+
+static int size_code_of(uint8_t size_bit) {
+    return size_bit == ISA_SIZE_B ? 0 : size_bit == ISA_SIZE_W ? 1 : 2;
+}
+
+int isa_size_code(const IsaEntry* entry, uint16_t opcode) {
+    if (isa_has_field(entry, ISA_FIELD_SIZE)) return (int)isa_get_field(entry, opcode, ISA_FIELD_SIZE);
+    bool single = entry->sizes && !(entry->sizes & (entry->sizes - 1));
+    return single ? size_code_of(entry->sizes) : 0;
+}
+
+const char* isa_condition_name(int condition) {
+    return condition_names[condition & 0xF];
+}
+
+// Branch mnemonics are "B" followed by a condition name
+static bool match_condition(const char* suffix, int* condition) {
+    static const struct {
+        int code;
+        const char* name;
+    } names[] = {
+#define CONDITION(code, name) { code, name },
+#define CONDITION_ALIAS(code, name) { code, name },
+#include "isa.def"
+    };
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); ++i) {
+        if (strcasecmp(suffix, names[i].name) == 0) {
+            *condition = names[i].code;
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool same_mnemonic(const IsaEntry* entry, const char* mnemonic, int* condition) {
+    if (entry->form == FORM_BRANCH) {
+        size_t length = strlen(entry->mnemonic);
+        return strncasecmp(mnemonic, entry->mnemonic, length) == 0 && match_condition(mnemonic + length, condition);
+    }
+    return strcasecmp(mnemonic, entry->mnemonic) == 0;
+}
+
+const IsaEntry* isa_lookup(const char* mnemonic, int* size_code, int* condition) {
+    *condition = 0;
+    int wanted = *size_code < 0 ? 1 : *size_code; // W unless given
+    const IsaEntry* fallback = NULL;
+    for (int i = 0; i < NUM_INSTRUCTION_KINDS; ++i) {
+        const IsaEntry* entry = &isa_table[i];
+        if (!same_mnemonic(entry, mnemonic, condition)) continue;
+        if (!entry->sizes) { // Unsized, any suffix is ignored
+            *size_code = 0;
+            return entry;
+        }
+        if (entry->sizes & (1 << wanted)) {
+            *size_code = wanted;
+            return entry;
+        }
+        if (!fallback) fallback = entry;
+    }
+    if (fallback && *size_code < 0) { // No W form, take the first size
+        *size_code = fallback->first_size;
+        return fallback;
+    }
+    return NULL;
+}
@@ -0,0 +1,102 @@
+#ifndef ISA_H
+#define ISA_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// The instruction set as tables, generated at build time from isa.def by
+// gen_isa: isa_table[] has one entry per InstructionKind with the decoder's
+// mask and value and the position of every opcode field.
+
+// Opcode property flags, stored per mapping and copied into the dispatch table
+#define OPF_BRANCH 0x01 // Instruction may change the flow of control
+#define OPF_HALT   0x02 // Instruction halts the simulation (RTS for now)
+#define OPF_BREAKPOINT 0x04 // Set at decode time on an instruction with a breakpoint, see debug.h
+
+// Operand layouts, used by the decoder to find immediates and extension words
+typedef enum {
+    FORM_NONE,    // No operands (NOP, RTS)
+    FORM_QUICK,   // 3-bit quick data in bits 11-9, Dn in bits 2-0
+    FORM_IMM,     // Immediate of operand size, then EA in bits 5-0
+    FORM_BIT_IMM, // Immediate bit number word, then EA in bits 5-0
+    FORM_MOVE,    // Source EA in bits 5-0, destination EA in bits 11-6
+    FORM_REG,     // Source EA in bits 5-0, Dn in bits 11-9
+    FORM_BRANCH,  // 8-bit displacement, or a 16-bit extension word when zero
+} OperandForm;
+
+// Identifies an instruction table entry for code that specialises on it
+typedef enum {
+#define ISA(kind, mnemonic, pattern, form, sizes, flags, cycles, cycles_long, handler) INSN_##kind,
+#include "isa.def"
+    NUM_INSTRUCTION_KINDS
+} InstructionKind;
+
+// Opcode fields, the letters of an isa.def pattern
+typedef enum {
+    ISA_FIELD_SIZE,         // s
+    ISA_FIELD_DN,           // d
+    ISA_FIELD_DM,           // r
+    ISA_FIELD_QUICK,        // q
+    ISA_FIELD_CONDITION,    // c
+    ISA_FIELD_DISPLACEMENT, // b
+    ISA_FIELD_SRC_EA,       // e
+    ISA_FIELD_DST_EA,       // f, register then mode
+    NUM_ISA_FIELDS
+} IsaFieldId;
+
+typedef struct {
+    uint8_t shift;
+    uint8_t width; // 0 if the instruction has no such field
+} IsaField;
+
+// Bits of IsaEntry.sizes
+#define ISA_SIZE_B 0x01
+#define ISA_SIZE_W 0x02
+#define ISA_SIZE_L 0x04
+
+typedef struct {
+    const char* mnemonic;
+    uint16_t mask;        // Bits fixed by the pattern
+    uint16_t value;       // Their value
+    uint8_t form;         // OperandForm
+    uint8_t flags;        // OPF_* bits
+    uint8_t sizes;        // ISA_SIZE_* bits the assembler accepts
+    uint8_t first_size;   // Size code of the first size listed, or 0
+    uint8_t cycles;       // Clock periods for B/W operands, see timing.c
+    uint8_t cycles_long;  // Clock periods for L operands
+    IsaField fields[NUM_ISA_FIELDS];
+} IsaEntry;
+
+extern const IsaEntry isa_table[NUM_INSTRUCTION_KINDS];
+
+// The first entry whose pattern matches 'opcode', or NULL
+const IsaEntry* isa_match(uint16_t opcode);
+
+static inline bool isa_has_field(const IsaEntry* entry, IsaFieldId field) {
+    return entry->fields[field].width != 0;
+}
+
+static inline uint32_t isa_get_field(const IsaEntry* entry, uint16_t opcode, IsaFieldId field) {
+    IsaField f = entry->fields[field];
+    return (opcode >> f.shift) & ((1u << f.width) - 1);
+}
+
+static inline uint16_t isa_set_field(const IsaEntry* entry, uint16_t opcode, IsaFieldId field, uint32_t value) {
+    IsaField f = entry->fields[field];
+    uint16_t mask = (uint16_t)(((1u << f.width) - 1) << f.shift);
+    return (uint16_t)((opcode & ~mask) | ((value << f.shift) & mask));
+}
+
+// Operand size of an opcode: its size field, else its only size. MOVE sizes
+// are fixed by their patterns. 0=Byte, 1=Word, 2=Long.
+int isa_size_code(const IsaEntry* entry, uint16_t opcode);
+
+// Finds the entry for an assembler mnemonic such as "ADDQ" or "BNE" and a
+// size code, or -1 if the source gave no size. On success '*size_code' is
+// the size used and '*condition' the branch condition, if any.
+const IsaEntry* isa_lookup(const char* mnemonic, int* size_code, int* condition);
+
+// Name of a branch condition, such as "NE", or NULL for BSR
+const char* isa_condition_name(int condition);
+
+#endif // ISA_H
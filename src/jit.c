@@ -0,0 +1,362 @@
+#define _DEFAULT_SOURCE
+#include "jit.h"
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Per-machine translation state
+struct JitState {
+    uint8_t* code_cache;
+    size_t code_used;
+    JitStats stats;
+};
+
+#if defined(__x86_64__)
+#include <sys/mman.h>
+
+// The translated code keeps the CPU pointer in RDI (first SysV argument) and
+// addresses every register as [rdi + disp8]. RAX, RCX and RDX are scratch.
+#define OFF_D(n) ((uint8_t)(offsetof(CPU, d) + 4 * (n)))
+#define OFF_A(n) ((uint8_t)(offsetof(CPU, a) + 4 * (n)))
+#define OFF_PC   ((uint8_t)offsetof(CPU, pc))
+#define OFF_SR   ((uint8_t)offsetof(CPU, sr))
+
+#define MAX_NATIVE_BLOCK_BYTES 4096 // Generous upper bound for one block
+
+// Lookup tables shared by all machines; constant once built.
+// SR bits for each AH value after LAHF (AH = SF:ZF:0:AF:0:PF:1:CF)
+static uint8_t arith_flags[256]; // X, N, Z and C; V is added from OF
+static uint8_t logic_flags[256]; // N and Z only
+// Bit k is set if the condition holds when SR's NZVC bits equal k
+static uint16_t condition_masks[16];
+static bool tables_ready = false;
+
+typedef struct {
+    uint8_t* p;
+    uint8_t* end;
+} Emitter;
+
+static void emit8(Emitter* e, uint8_t byte) {
+    if (e->p < e->end) *e->p = byte;
+    e->p++; // Overflow is detected by the caller comparing p against end
+}
+
+static void emit16(Emitter* e, uint16_t value) {
+    emit8(e, value & 0xFF);
+    emit8(e, value >> 8);
+}
+
+static void emit32(Emitter* e, uint32_t value) {
+    emit16(e, value & 0xFFFF);
+    emit16(e, value >> 16);
+}
+
+static void emit64(Emitter* e, uint64_t value) {
+    emit32(e, value & 0xFFFFFFFF);
+    emit32(e, value >> 32);
+}
+
+// ModRM + disp8 for the operand [rdi + disp] with 'reg' in the reg field
+static void emit_cpu_operand(Emitter* e, int reg, uint8_t disp) {
+    emit8(e, 0x40 | (reg << 3) | 7);
+    emit8(e, disp);
+}
+
+// Emits the opcode for an operand size: the byte form, or the word/long form
+// with an operand-size prefix for words
+static void emit_sized(Emitter* e, int size_code, uint8_t byte_opcode, uint8_t wide_opcode) {
+    if (size_code == 1) emit8(e, 0x66);
+    emit8(e, size_code == 0 ? byte_opcode : wide_opcode);
+}
+
+// <op> [cpu+disp], imm -- group 1 extension: 0=ADD, 4=AND, 5=SUB
+static void emit_alu_imm(Emitter* e, int ext, int size_code, uint8_t disp, uint32_t imm) {
+    emit_sized(e, size_code, 0x80, 0x81);
+    emit_cpu_operand(e, ext, disp);
+    if (size_code == 0) emit8(e, imm);
+    else if (size_code == 1) emit16(e, imm);
+    else emit32(e, imm);
+}
+
+// <op> [cpu+disp], al/ax/eax -- 0x00=ADD, 0x28=SUB
+static void emit_alu_reg(Emitter* e, uint8_t byte_opcode, int size_code, uint8_t disp) {
+    emit_sized(e, size_code, byte_opcode, byte_opcode + 1);
+    emit_cpu_operand(e, 0, disp);
+}
+
+static void emit_load_eax(Emitter* e, uint8_t disp) {
+    emit8(e, 0x8B); // mov eax, [cpu+disp]
+    emit_cpu_operand(e, 0, disp);
+}
+
+static void emit_store_eax(Emitter* e, int size_code, uint8_t disp) {
+    emit_sized(e, size_code, 0x88, 0x89); // mov [cpu+disp], al/ax/eax
+    emit_cpu_operand(e, 0, disp);
+}
+
+static void emit_set_pc(Emitter* e, uint32_t pc) {
+    emit8(e, 0xC7); // mov dword [cpu+pc], imm32
+    emit_cpu_operand(e, 0, OFF_PC);
+    emit32(e, pc);
+}
+
+// Folds the host flags of the last ALU instruction into SR. Logic results
+// clear V and C and leave X alone; arithmetic results set X from C.
+static void emit_update_sr(Emitter* e, bool logic) {
+    emit8(e, 0x9F); // lahf
+    if (!logic) {
+        emit8(e, 0x0F); emit8(e, 0x90); emit8(e, 0xC2); // seto dl
+    }
+    emit8(e, 0x0F); emit8(e, 0xB6); emit8(e, 0xCC); // movzx ecx, ah
+    emit8(e, 0x48); emit8(e, 0xB8);                 // mov rax, table
+    emit64(e, (uintptr_t)(logic ? logic_flags : arith_flags));
+    emit8(e, 0x0F); emit8(e, 0xB6); emit8(e, 0x0C); emit8(e, 0x08); // movzx ecx, byte [rax+rcx]
+    if (!logic) {
+        emit8(e, 0x0F); emit8(e, 0xB6); emit8(e, 0xD2); // movzx edx, dl
+        emit8(e, 0x8D); emit8(e, 0x0C); emit8(e, 0x51); // lea ecx, [rcx+rdx*2]
+    }
+    emit8(e, 0x66); emit8(e, 0x81); // and word [cpu+sr], mask
+    emit_cpu_operand(e, 4, OFF_SR);
+    emit16(e, logic ? 0xFFF0 : 0xFFE0);
+    emit8(e, 0x66); emit8(e, 0x09); // or word [cpu+sr], cx
+    emit_cpu_operand(e, 1, OFF_SR);
+}
+
+// BTST/BCHG/BCLR/BSET #n,Dn map onto BT/BTC/BTR/BTS, whose CF is the old bit
+static void emit_bit_op(Emitter* e, int ext, uint8_t disp, uint8_t bit) {
+    emit8(e, 0x0F); emit8(e, 0xBA); // bt* dword [cpu+disp], imm8
+    emit_cpu_operand(e, ext, disp);
+    emit8(e, bit);
+    emit8(e, 0x0F); emit8(e, 0x93); emit8(e, 0xC0); // setnc al
+    emit8(e, 0xC0); emit8(e, 0xE0); emit8(e, SR_Z); // shl al, SR_Z
+    emit8(e, 0x80);                                  // and byte [cpu+sr], ~Z
+    emit_cpu_operand(e, 4, OFF_SR);
+    emit8(e, (uint8_t)~(1 << SR_Z));
+    emit8(e, 0x08);                                  // or byte [cpu+sr], al
+    emit_cpu_operand(e, 0, OFF_SR);
+}
+
+// Ends the block at a Bcc: picks the target or the fall-through address
+static void emit_branch(Emitter* e, const DecodedOp* op) {
+    int condition = (op->opcode >> 8) & 0xF;
+    uint16_t mask = condition_masks[condition];
+
+    if (mask == 0xFFFF || mask == 0) { // BRA, or a condition that never holds
+        emit_set_pc(e, mask ? op->imm : op->next_pc);
+        emit8(e, 0xC3); // ret
+        return;
+    }
+    emit8(e, 0x0F); emit8(e, 0xB7); // movzx eax, word [cpu+sr]
+    emit_cpu_operand(e, 0, OFF_SR);
+    emit8(e, 0x83); emit8(e, 0xE0); emit8(e, 0x0F); // and eax, 0xF
+    emit8(e, 0xB9); emit32(e, mask);                // mov ecx, mask
+    emit8(e, 0x0F); emit8(e, 0xA3); emit8(e, 0xC1); // bt ecx, eax
+    emit8(e, 0x73); emit8(e, 8);                    // jnc not_taken
+    emit_set_pc(e, op->imm);                        // 7 bytes
+    emit8(e, 0xC3);                                 // ret
+    emit_set_pc(e, op->next_pc);                    // not_taken:
+    emit8(e, 0xC3);
+}
+
+static int move_size(const DecodedOp* op) {
+    return (op->kind == INSN_MOVE_B) ? 0 : (op->kind == INSN_MOVE_W) ? 1 : 2;
+}
+
+// Only register-to-register forms are translated, so native code never
+// touches guest memory.
+static bool is_supported(const DecodedOp* op) {
+    switch (op->kind) {
+        case INSN_ADDQ: case INSN_SUBQ:
+        case INSN_ADDI: case INSN_SUBI: case INSN_ANDI:
+        case INSN_ADD: case INSN_SUB:
+        case INSN_BTST: case INSN_BCHG: case INSN_BCLR: case INSN_BSET:
+        case INSN_BCC: case INSN_NOP:
+            return true;
+        case INSN_MOVE_B: case INSN_MOVE_W: case INSN_MOVE_L: {
+            int src_mode = op->src_ea >> 3;
+            int dst_mode = op->dst_ea >> 3;
+            bool src_ok = src_mode == 0 || src_mode == 1 || op->src_ea == 0x3C;
+            bool dst_ok = dst_mode == 0 || (dst_mode == 1 && op->kind != INSN_MOVE_B);
+            return src_ok && dst_ok;
+        }
+        default:
+            return false;
+    }
+}
+
+static void translate_move(Emitter* e, const DecodedOp* op) {
+    int size = move_size(op);
+    int src_mode = op->src_ea >> 3;
+    int src_reg = op->src_ea & 7;
+    int dst_reg = op->dst_ea & 7;
+
+    if (src_mode == 0) {
+        emit_load_eax(e, OFF_D(src_reg));
+    } else if (src_mode == 1) {
+        emit_load_eax(e, OFF_A(src_reg));
+    } else { // Immediate, as read_from_ea returns it
+        uint32_t value = op->ext[op->src_ext];
+        if (size == 2) value = (value << 16) | op->ext[op->src_ext + 1];
+        emit8(e, 0xB8); emit32(e, value); // mov eax, imm32
+    }
+
+    if ((op->dst_ea >> 3) == 1) { // MOVEA, flags unaffected
+        if (size == 1) emit8(e, 0x98); // cwde
+        emit_store_eax(e, 2, OFF_A(dst_reg));
+    } else {
+        emit_store_eax(e, size, OFF_D(dst_reg));
+        emit_sized(e, size, 0x84, 0x85); emit8(e, 0xC0); // test al/ax/eax, same
+        emit_update_sr(e, true);
+    }
+}
+
+static void translate_op(Emitter* e, const DecodedOp* op) {
+    int size = (op->size_code > 2) ? 2 : op->size_code; // Handlers treat 3 as Long
+
+    switch (op->kind) {
+        case INSN_ADDQ: case INSN_ADDI:
+            emit_alu_imm(e, 0, size, OFF_D(op->ry), op->imm);
+            emit_update_sr(e, false);
+            break;
+        case INSN_SUBQ: case INSN_SUBI:
+            emit_alu_imm(e, 5, size, OFF_D(op->ry), op->imm);
+            emit_update_sr(e, false);
+            break;
+        case INSN_ANDI:
+            emit_alu_imm(e, 4, size, OFF_D(op->ry), op->imm);
+            emit_update_sr(e, true);
+            break;
+        case INSN_ADD: case INSN_SUB:
+            emit_load_eax(e, OFF_D(op->ry));
+            emit_alu_reg(e, op->kind == INSN_ADD ? 0x00 : 0x28, size, OFF_D(op->rx));
+            emit_update_sr(e, false);
+            break;
+        case INSN_BTST: emit_bit_op(e, 4, OFF_D(op->ry), __builtin_ctz(op->imm)); break;
+        case INSN_BSET: emit_bit_op(e, 5, OFF_D(op->ry), __builtin_ctz(op->imm)); break;
+        case INSN_BCLR: emit_bit_op(e, 6, OFF_D(op->ry), __builtin_ctz(op->imm)); break;
+        case INSN_BCHG: emit_bit_op(e, 7, OFF_D(op->ry), __builtin_ctz(op->imm)); break;
+        case INSN_MOVE_B: case INSN_MOVE_W: case INSN_MOVE_L:
+            translate_move(e, op);
+            break;
+        case INSN_BCC:
+            emit_branch(e, op);
+            break;
+        default: // INSN_NOP
+            break;
+    }
+}
+
+static void init_tables(void) {
+    if (tables_ready) return;
+    for (int ah = 0; ah < 256; ++ah) {
+        int cf = ah & 1;
+        int zf = (ah >> 6) & 1;
+        int sf = (ah >> 7) & 1;
+        logic_flags[ah] = (sf << SR_N) | (zf << SR_Z);
+        arith_flags[ah] = logic_flags[ah] | (cf << SR_C) | (cf << SR_X);
+    }
+    for (int condition = 0; condition < 16; ++condition) {
+        condition_masks[condition] = 0;
+        for (int nzvc = 0; nzvc < 16; ++nzvc) {
+            if (executor_test_condition(condition, nzvc)) {
+                condition_masks[condition] |= 1 << nzvc;
+            }
+        }
+    }
+    tables_ready = true;
+}
+
+bool jit_init(Machine* m) {
+    if (m->jit) return true;
+    init_tables();
+
+    struct JitState* jit = (struct JitState*)calloc(1, sizeof(struct JitState));
+    if (!jit) {
+        perror("Failed to allocate JIT state");
+        return false;
+    }
+    jit->code_cache = mmap(NULL, JIT_CACHE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (jit->code_cache == MAP_FAILED) {
+        perror("Failed to map JIT code cache");
+        free(jit);
+        return false;
+    }
+    m->jit = jit;
+    return true;
+}
+
+void jit_shutdown(Machine* m) {
+    if (!m->jit) return;
+    munmap(m->jit->code_cache, JIT_CACHE_SIZE);
+    free(m->jit);
+    m->jit = NULL;
+}
+
+bool jit_translate(Machine* m, Block* block) {
+    struct JitState* jit = m->jit;
+    if (!jit) return true; // Nothing to translate with
+    if (JIT_CACHE_SIZE - jit->code_used < MAX_NATIVE_BLOCK_BYTES) return false;
+
+    block->jit_tried = true;
+    int count = 0;
+    while (count < block->num_ops && is_supported(&block->ops[count])) count++;
+    if (count == 0) return true;
+
+    Emitter e = { jit->code_cache + jit->code_used, jit->code_cache + JIT_CACHE_SIZE };
+    uint8_t* start = e.p;
+    uint32_t cycles = 0;
+    for (int i = 0; i < count; ++i) {
+        translate_op(&e, &block->ops[i]);
+        cycles += block->ops[i].cycles;
+    }
+    if (block->ops[count - 1].kind != INSN_BCC) { // Hand over to the interpreter
+        emit_set_pc(&e, block->ops[count - 1].next_pc);
+        emit8(&e, 0xC3); // ret
+    }
+    if (e.p > e.end) return false;
+
+    jit->code_used += e.p - start;
+    block->native = (NativeBlock)(void*)start;
+    block->native_ops = count;
+    block->native_cycles = cycles;
+    jit->stats.blocks_translated++;
+    jit->stats.ops_translated += count;
+    return true;
+}
+
+void jit_reset(Machine* m) {
+    if (!m->jit) return;
+    m->jit->code_used = 0;
+    m->jit->stats.cache_flushes++;
+}
+
+#else // No native backend for this host
+
+bool jit_init(Machine* m) {
+    (void)m; // Silence unused parameter warning
+    return false;
+}
+
+void jit_shutdown(Machine* m) {
+    (void)m; // Silence unused parameter warning
+}
+
+bool jit_translate(Machine* m, Block* block) {
+    (void)m; // Silence unused parameter warning
+    block->jit_tried = true;
+    return true;
+}
+
+void jit_reset(Machine* m) {
+    (void)m; // Silence unused parameter warning
+}
+
+#endif
+
+// Counters of the machine's JIT, all zero when it has none
+const JitStats* jit_stats(Machine* m) {
+    static const JitStats none = {0};
+    return m->jit ? &m->jit->stats : &none;
+}
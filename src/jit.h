@@ -0,0 +1,33 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include "block_cache.h"
+#include <stdbool.h>
+
+// Optional x86-64 translation tier. Hot blocks are translated up to the first
+// instruction the translator does not support; the executor runs the native
+// prefix and continues with the interpreter from there. Native code reads and
+// writes cpu->sr directly, so lazy flags must be materialised before entry.
+
+#define JIT_HOT_THRESHOLD 16             // Block executions before translating
+#define JIT_CACHE_SIZE (4 * 1024 * 1024) // Executable code cache in bytes
+
+typedef struct {
+    unsigned long blocks_translated;
+    unsigned long ops_translated;
+    unsigned long cache_flushes;
+} JitStats;
+
+// Returns false if native code cannot be generated on this host
+bool jit_init(Machine* m);
+void jit_shutdown(Machine* m);
+
+// Translates the longest supported prefix of 'block' into block->native.
+// Returns false if the code cache is full; the caller must then drop all
+// blocks and call jit_reset() before translating again.
+bool jit_translate(Machine* m, Block* block);
+void jit_reset(Machine* m);
+
+const JitStats* jit_stats(Machine* m);
+
+#endif // JIT_H
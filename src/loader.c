@@ -2,6 +2,7 @@
 #include "loader.h"
 #include "memory.h"
 #include "disassembler.h"
+#include "isa.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -13,7 +14,6 @@
 
 #define HASH_TABLE_SIZE 1024
 
-static HashTable* symbol_table = NULL;
 
 // --- Symbol Table and File I/O Functions (mostly unchanged) ---
 
@@ -82,10 +82,11 @@ char* trim(char* str) {
     end[1] = '\0';
     return str;
 }
+// Splits "ADDQ.W" into "ADDQ" and 'W'. 'size' is 0 if there is no suffix.
 void parse_instruction_mnemonic(const char* opcode_str, char* base, char* size) {
-    *size = 'W';
+    *size = 0;
     const char* dot = strrchr(opcode_str, '.');
-    if (dot && (tolower(dot[1]) == 'b' || tolower(dot[1]) == 'w' || tolower(dot[1]) == 'l')) {
+    if (dot && dot[1] && strchr("bwlsBWLS", dot[1])) {
         strncpy(base, opcode_str, dot - opcode_str);
         base[dot - opcode_str] = '\0';
         *size = toupper(dot[1]);
@@ -179,22 +180,79 @@ int get_operand_extension_size(Operand* op) {
     }
 }
 
+// --- Instruction Set Lookup ---
+
+// The isa.def entry for a mnemonic and size suffix, see isa_lookup(). MOVEA
+// is MOVE to an address register and .S only names a short branch.
+static const IsaEntry* lookup_instruction(const char* base, char suffix, int* size_code, int* condition) {
+    *size_code = (suffix == 'B' || suffix == 'S') ? 0 : suffix == 'W' ? 1 : suffix == 'L' ? 2 : -1;
+    const IsaEntry* entry = isa_lookup(strcasecmp(base, "MOVEA") == 0 ? "MOVE" : base, size_code, condition);
+    if (entry && suffix == 'S' && entry->form != FORM_BRANCH) return NULL;
+    return entry;
+}
+
+// Parses "src,dest" into the operands that are present and valid
+static void parse_operands(const char* operands_str, Operand* src, bool* src_ok, Operand* dest, bool* dest_ok) {
+    *src_ok = *dest_ok = false;
+    if (!operands_str) return;
+    char temp[256];
+    strncpy(temp, operands_str, 255);
+    temp[255] = '\0';
+    char* comma = strchr(temp, ',');
+    if (comma) {
+        *comma = '\0';
+        *dest_ok = parse_operand(comma + 1, dest) == 0;
+    }
+    *src_ok = parse_operand(temp, src) == 0;
+}
+
+static void free_operand_label(Operand* op) {
+    free(op->label);
+    op->label = NULL;
+}
+
+// Immediate data takes a long for .L operations and a word otherwise
+static int immediate_size(int size_code) {
+    return size_code == 2 ? 4 : 2;
+}
+
+static int ea_extension_size(Operand* op, int size_code) {
+    return op->mode == IMMEDIATE ? immediate_size(size_code) : get_operand_extension_size(op);
+}
+
+// Size in bytes of an instruction of 'entry', laid out by its form
+static int isa_instruction_size(const IsaEntry* entry, int size_code, const char* operands_str) {
+    switch (entry->form) {
+        case FORM_IMM: return 2 + immediate_size(size_code);
+        case FORM_BIT_IMM: return 4;
+        case FORM_BRANCH: return size_code == 0 ? 2 : 4;
+        case FORM_MOVE: {
+            Operand src = {0}, dest = {0};
+            bool src_ok, dest_ok;
+            parse_operands(operands_str, &src, &src_ok, &dest, &dest_ok);
+            int size = 2;
+            if (src_ok) size += ea_extension_size(&src, size_code);
+            if (dest_ok) size += ea_extension_size(&dest, size_code);
+            free_operand_label(&src);
+            free_operand_label(&dest);
+            return size;
+        }
+        default: return 2;
+    }
+}
+
 // Calculates the total size of an instruction including opcode and all operands
 int get_instruction_size(const char* opcode_str, const char* operands_str) {
     char base_mnemonic[10];
     char size_suffix;
     parse_instruction_mnemonic(opcode_str, base_mnemonic, &size_suffix);
 
-    // Instructions with no operands or fixed size
-    if (strcasecmp(base_mnemonic, "NOP") == 0) return 2;
-    if (strcasecmp(base_mnemonic, "RTS") == 0) return 2;
-    if (strncasecmp(base_mnemonic, "B", 1) == 0 && strlen(base_mnemonic) > 1) {
-         if (strcasecmp(base_mnemonic, "BTST") != 0 && strcasecmp(base_mnemonic, "BCHG") != 0 &&
-             strcasecmp(base_mnemonic, "BCLR") != 0 && strcasecmp(base_mnemonic, "BSET") != 0) {
-            return 2; // All branch instructions are 2 bytes (short branch)
-        }
-    }
-    
+    if (strcasecmp(base_mnemonic, "DC") == 0) return size_suffix == 'B' ? 1 : size_suffix == 'L' ? 4 : 2;
+    int size_code, condition;
+    const IsaEntry* entry = lookup_instruction(base_mnemonic, size_suffix, &size_code, &condition);
+    if (entry) return isa_instruction_size(entry, size_code, operands_str);
+
+    // Not in the instruction set: an estimate from the operands
     int total_size = 2; // Base opcode size
     if (!operands_str) return total_size;
 
@@ -310,12 +368,12 @@ uint16_t build_full_format_extension(Operand* op) {
 }
 
 // Writes all necessary extension words and displacements for an operand
-void write_operand_extensions(uint32_t* address, Operand* op, char size_suffix, uint32_t current_pc) {
+void write_operand_extensions(Machine* m, uint32_t* address, Operand* op, char size_suffix, uint32_t current_pc) {
     if (!op) return;
 
     // Handle label resolution first
     if (op->label) {
-        Symbol* sym = find_symbol(symbol_table, op->label);
+        Symbol* sym = find_symbol(m->symbols, op->label);
         uint32_t value = sym ? sym->address : 0;
         if (!sym) fprintf(stderr, "WARN: Undefined symbol '%s' in second pass.\n", op->label);
 
@@ -330,18 +388,18 @@ void write_operand_extensions(uint32_t* address, Operand* op, char size_suffix,
 
     switch (op->mode) {
         case IMMEDIATE:
-            if (size_suffix == 'L' || op->value > 0xFFFF) { mem_write_long(*address, op->value); *address += 4; }
-            else { mem_write_word(*address, op->value); *address += 2; }
+            if (size_suffix == 'L') { mem_write_long(m, *address, op->value); *address += 4; }
+            else { mem_write_word(m, *address, op->value); *address += 2; }
             break;
         case ABSOLUTE_SHORT:
-            mem_write_word(*address, op->value); *address += 2;
+            mem_write_word(m, *address, op->value); *address += 2;
             break;
         case ABSOLUTE_LONG:
-            mem_write_long(*address, op->value); *address += 4;
+            mem_write_long(m, *address, op->value); *address += 4;
             break;
         case ARI_DISPLACEMENT:
         case PC_RELATIVE_DISPLACEMENT:
-            mem_write_word(*address, op->base_displacement); *address += 2;
+            mem_write_word(m, *address, op->base_displacement); *address += 2;
             break;
         case ARI_INDEX_8_BIT_DISP:
         case PC_RELATIVE_INDEX_8_BIT:
@@ -351,7 +409,7 @@ void write_operand_extensions(uint32_t* address, Operand* op, char size_suffix,
             ext |= (op->index_reg_num & 7) << 12;
             ext |= (op->index_size == 'L' ? 1 : 0) << 11;
             ext |= ((uint8_t)op->base_displacement);
-            mem_write_word(*address, ext); *address += 2;
+            mem_write_word(m, *address, ext); *address += 2;
             break;
         }
 
@@ -367,19 +425,19 @@ void write_operand_extensions(uint32_t* address, Operand* op, char size_suffix,
             uint32_t extension_word_address = *address;
             
             uint16_t ext = build_full_format_extension(op);
-            mem_write_word(*address, ext); *address += 2;
+            mem_write_word(m, *address, ext); *address += 2;
 
             if (op->is_pc_relative_label) {
-                Symbol* sym = find_symbol(symbol_table, op->label);
+                Symbol* sym = find_symbol(m->symbols, op->label);
                 uint32_t target_addr = sym ? sym->address : 0;
                 // The displacement is relative to the extension word's address.
                 op->base_displacement = target_addr - extension_word_address;
             }
 
-            if (op->base_disp_size == 2) { mem_write_word(*address, op->base_displacement); *address += 2; }
-            if (op->base_disp_size == 4) { mem_write_long(*address, op->base_displacement); *address += 4; }
-            if (op->outer_disp_size == 2) { mem_write_word(*address, op->outer_displacement); *address += 2; }
-            if (op->outer_disp_size == 4) { mem_write_long(*address, op->outer_displacement); *address += 4; }
+            if (op->base_disp_size == 2) { mem_write_word(m, *address, op->base_displacement); *address += 2; }
+            if (op->base_disp_size == 4) { mem_write_long(m, *address, op->base_displacement); *address += 4; }
+            if (op->outer_disp_size == 2) { mem_write_word(m, *address, op->outer_displacement); *address += 2; }
+            if (op->outer_disp_size == 4) { mem_write_long(m, *address, op->outer_displacement); *address += 4; }
             break;
         }
 
@@ -388,10 +446,91 @@ void write_operand_extensions(uint32_t* address, Operand* op, char size_suffix,
      if (op->label) { free(op->label); op->label = NULL; }
 }
 
+// --- Table-Driven Encoding ---
+
+static bool is_data_register(const Operand* op) {
+    return op && op->mode == DATA_REGISTER_DIRECT;
+}
+
+static bool is_immediate(const Operand* op) {
+    return op && op->mode == IMMEDIATE;
+}
+
+// Address of a branch target, a label or a number
+static uint32_t branch_target(Machine* m, const Operand* op) {
+    if (!op->label) return op->value;
+    Symbol* sym = find_symbol(m->symbols, op->label);
+    if (!sym) fprintf(stderr, "WARN: Undefined symbol '%s' in second pass.\n", op->label);
+    return sym ? sym->address : 0;
+}
+
+// Encodes an instruction of 'entry' at 'address' from its form and the
+// opcode fields isa.def gives. 'src' and 'dest' are NULL if missing or
+// unparsable. Returns NULL, or what is wrong with the operands.
+static const char* encode_instruction(Machine* m, const IsaEntry* entry, int size_code, int condition,
+                                      Operand* src, Operand* dest, uint32_t address) {
+    uint16_t opcode = entry->value;
+    if (isa_has_field(entry, ISA_FIELD_SIZE)) opcode = isa_set_field(entry, opcode, ISA_FIELD_SIZE, size_code);
+    char size_suffix = size_code == 2 ? 'L' : 'W';
+    uint32_t ext_address = address + 2;
+
+    switch (entry->form) {
+        case FORM_NONE:
+            break;
+        case FORM_QUICK:
+            if (!is_immediate(src) || !is_data_register(dest)) return "Invalid operands";
+            if (src->label || src->value < 1 || src->value > 8) return "Quick data must be 1 to 8";
+            opcode = isa_set_field(entry, opcode, ISA_FIELD_QUICK, src->value); // 8 is stored as 0
+            opcode = isa_set_field(entry, opcode, ISA_FIELD_DN, dest->reg_num);
+            break;
+        case FORM_IMM:
+        case FORM_BIT_IMM:
+            if (!is_immediate(src) || !is_data_register(dest)) return "Invalid operands";
+            opcode = isa_set_field(entry, opcode, ISA_FIELD_DN, dest->reg_num);
+            write_operand_extensions(m, &ext_address, src, entry->form == FORM_IMM ? size_suffix : 'W', address);
+            break;
+        case FORM_REG:
+            if (!is_data_register(src) || !is_data_register(dest)) return "Invalid operands";
+            opcode = isa_set_field(entry, opcode, ISA_FIELD_DM, src->reg_num);
+            opcode = isa_set_field(entry, opcode, ISA_FIELD_DN, dest->reg_num);
+            break;
+        case FORM_MOVE: {
+            if (!src || !dest) return "Invalid operands";
+            // Sets the displacement sizes write_operand_extensions() uses
+            get_operand_extension_size(src);
+            get_operand_extension_size(dest);
+            uint8_t dest_ea = encode_ea(dest);
+            opcode = isa_set_field(entry, opcode, ISA_FIELD_SRC_EA, encode_ea(src));
+            opcode = isa_set_field(entry, opcode, ISA_FIELD_DST_EA, ((dest_ea & 7) << 3) | (dest_ea >> 3));
+            write_operand_extensions(m, &ext_address, src, size_suffix, address);
+            write_operand_extensions(m, &ext_address, dest, size_suffix, address);
+            break;
+        }
+        case FORM_BRANCH: {
+            if (!src || dest || (src->mode != ABSOLUTE_SHORT && src->mode != ABSOLUTE_LONG)) return "Invalid operands";
+            int32_t displacement = (int32_t)(branch_target(m, src) - (address + 2));
+            opcode = isa_set_field(entry, opcode, ISA_FIELD_CONDITION, condition);
+            if (size_code == 0) {
+                // A zero displacement would mean a word follows
+                if (displacement < -128 || displacement > 127 || displacement == 0) return "Target out of range";
+                opcode = isa_set_field(entry, opcode, ISA_FIELD_DISPLACEMENT, (uint8_t)displacement);
+            } else {
+                if (displacement < -32768 || displacement > 32767) return "Target out of range";
+                mem_write_word(m, ext_address, (uint16_t)displacement);
+            }
+            break;
+        }
+        default:
+            return "Unsupported operand form";
+    }
+    mem_write_word(m, address, opcode);
+    return NULL;
+}
+
 
 // --- Main Assembler Passes (First Pass is now simplified) ---
 
-void perform_first_pass(FILE* f, uint32_t* start_address) {
+void perform_first_pass(Machine* m, FILE* f, uint32_t* start_address) {
     char* line;
     uint32_t current_address = *start_address;
     int symbol_count = 0;
@@ -408,7 +547,7 @@ void perform_first_pass(FILE* f, uint32_t* start_address) {
         if (colon) {
             *colon = '\0';
             char* label = trim(trimmed_line);
-            add_symbol(symbol_table, label, current_address);
+            add_symbol(m->symbols, label, current_address);
             symbol_count++;
             instruction_part = trim(colon + 1);
         }
@@ -435,11 +574,11 @@ void perform_first_pass(FILE* f, uint32_t* start_address) {
         }
         free(original_line);
     }
-    printf("INFO: First pass complete. Found %d symbols.\n", symbol_count);
+    if (!m->quiet) printf("INFO: First pass complete. Found %d symbols.\n", symbol_count);
 }
 
 
-void perform_second_pass(FILE* f, uint32_t start_address) {
+void perform_second_pass(Machine* m, FILE* f, uint32_t start_address) {
     char* line;
     uint32_t current_address = start_address;
     int line_number = 0;
@@ -451,7 +590,7 @@ void perform_second_pass(FILE* f, uint32_t start_address) {
         char* colon = strchr(instruction_part, ':'); if (colon) instruction_part = trim(colon + 1);
         if (strlen(instruction_part) == 0 || instruction_part[0] == '*') { free(original_line); continue; }
 
-        disassembler_add_mapping(current_address, line_number, instruction_part);
+        disassembler_add_mapping(m->source_map, current_address, line_number, instruction_part);
         
         char temp_instruction_part[256];
         strcpy(temp_instruction_part, instruction_part);
@@ -470,73 +609,32 @@ void perform_second_pass(FILE* f, uint32_t start_address) {
         char base_mnemonic[10]; char size_suffix;
         parse_instruction_mnemonic(opcode_str, base_mnemonic, &size_suffix);
         char* operands_str = saveptr;
-        
-        char temp_src_str[256];
-        char temp_dest_str[256];
-        char* src_str = NULL;
-        char* dest_str = NULL;
-
-        if (operands_str) {
-            char* comma = strchr(operands_str, ',');
-            if (comma) {
-                size_t len = comma - operands_str;
-                strncpy(temp_src_str, operands_str, len);
-                temp_src_str[len] = '\0';
-                strcpy(temp_dest_str, comma + 1);
-                src_str = temp_src_str;
-                dest_str = temp_dest_str;
-            } else {
-                strcpy(temp_src_str, operands_str);
-                src_str = temp_src_str;
-            }
-        }
-        
+
         // --- Instruction Encoding ---
-        if (strcasecmp(base_mnemonic, "MOVE") == 0 || strcasecmp(base_mnemonic, "MOVEA") == 0) {
-            Operand src_op = {0}, dest_op = {0};
-            bool src_ok = src_str ? parse_operand(trim(src_str), &src_op) == 0 : false;
-            bool dest_ok = dest_str ? parse_operand(trim(dest_str), &dest_op) == 0 : false;
-
-            if (src_ok && dest_ok) {
-                // Manually run the size calculation again to populate the disp_size fields
-                // This is needed because the operand from the first pass is not saved.
-                get_operand_extension_size(&src_op);
-                get_operand_extension_size(&dest_op);
-
-                uint16_t size_bits = (size_suffix == 'B') ? 1 : (size_suffix == 'L') ? 2 : 3;
-                uint16_t dest_ea_field = encode_ea(&dest_op);
-                uint16_t src_ea_field = encode_ea(&src_op);
-                uint16_t machine_code = (size_bits << 12) | ((dest_ea_field & 7) << 9) | ((dest_ea_field >> 3) << 6) | src_ea_field;
-                mem_write_word(current_address, machine_code);
-                
-                uint32_t addr = current_address + 2;
-                write_operand_extensions(&addr, &src_op, size_suffix, instruction_start_address);
-                write_operand_extensions(&addr, &dest_op, size_suffix, instruction_start_address);
-
-                if (src_op.label) free(src_op.label);
-                if (dest_op.label) free(dest_op.label);
-
-            } else { fprintf(stderr, "L%d: Error: Invalid operands for MOVE\n", line_number); }
-        }
-        // ... (other instruction handlers like ADD, SUB, etc. would go here, following the same pattern)
-        else if (strcasecmp(base_mnemonic, "DC") == 0) {
-            uint32_t value = strtoul(trim(operands_str) + 1, NULL, 16); // Simple parsing for now
+        int size_code, condition;
+        const IsaEntry* entry = lookup_instruction(base_mnemonic, size_suffix, &size_code, &condition);
+        if (strcasecmp(base_mnemonic, "DC") == 0) {
+            uint32_t value = operands_str ? strtoul(trim(operands_str) + 1, NULL, 16) : 0; // Simple parsing for now
             if (size_suffix == 'B') {
-                mem_write_byte(current_address, value);
-            } else if (size_suffix == 'W') {
-                mem_write_word(current_address, value);
-            } else { // '.L'
-                mem_write_long(current_address, value);
+                mem_write_byte(m, current_address, value);
+            } else if (size_suffix == 'L') {
+                mem_write_long(m, current_address, value);
+            } else { // '.W' or no suffix
+                mem_write_word(m, current_address, value);
             }
         }
-        else if (strcasecmp(base_mnemonic, "RTS") == 0) { // existing RTS
-            mem_write_word(current_address, 0x4E75);
-        }
-        else if (strcasecmp(base_mnemonic, "NOP") == 0) {
-            mem_write_word(current_address, 0x4E71);
+        else if (entry) {
+            Operand src_op = {0}, dest_op = {0};
+            bool src_ok, dest_ok;
+            parse_operands(operands_str, &src_op, &src_ok, &dest_op, &dest_ok);
+            const char* error = encode_instruction(m, entry, size_code, condition, src_ok ? &src_op : NULL,
+                                                   dest_ok ? &dest_op : NULL, instruction_start_address);
+            if (error) fprintf(stderr, "L%d: Error: %s for %s\n", line_number, error, base_mnemonic);
+            free_operand_label(&src_op);
+            free_operand_label(&dest_op);
         }
         else {
-             fprintf(stderr, "L%d: WARN: Assembler does not yet support instruction '%s'\n", line_number, base_mnemonic);
+             fprintf(stderr, "L%d: WARN: Assembler does not yet support instruction '%s'\n", line_number, opcode_str);
         }
         
         current_address += get_instruction_size(opcode_str, operands_str);
@@ -545,21 +643,44 @@ void perform_second_pass(FILE* f, uint32_t start_address) {
 }
 
 
-int load_file(const char* filename, uint32_t* start_address) {
-    symbol_table = create_symbol_table(HASH_TABLE_SIZE);
-    if (!symbol_table) return -1;
+int load_file(Machine* m, const char* filename, uint32_t* start_address) {
+    // Symbols stay with the machine after loading
+    destroy_symbol_table(m->symbols);
+    m->symbols = create_symbol_table(HASH_TABLE_SIZE);
+    if (!m->symbols) return -1;
     FILE* f = fopen(filename, "r");
-    if (!f) { perror("Failed to open assembly file"); destroy_symbol_table(symbol_table); return -1; }
+    if (!f) { perror("Failed to open assembly file"); return -1; }
     
-    printf("INFO: Starting first pass...\n");
-    perform_first_pass(f, start_address);
+    if (!m->quiet) printf("INFO: Starting first pass...\n");
+    perform_first_pass(m, f, start_address);
     rewind(f);
     
-    printf("INFO: Starting second pass...\n");
-    perform_second_pass(f, start_address);
+    if (!m->quiet) printf("INFO: Starting second pass...\n");
+    perform_second_pass(m, f, *start_address);
     fclose(f);
-    
-    destroy_symbol_table(symbol_table);
-    symbol_table = NULL;
     return 0;
-}
\ No newline at end of file
+}
+
+int load_image(Machine* m, const char* filename, uint32_t address) {
+    FILE* f = fopen(filename, "rb");
+    if (!f) { perror("Failed to open image file"); return -1; }
+
+    uint8_t buffer[65536];
+    size_t count;
+    while ((count = fread(buffer, 1, sizeof(buffer), f)) > 0) {
+        mem_write_block(m, address, buffer, (uint32_t)count);
+        address += (uint32_t)count;
+    }
+    bool failed = ferror(f);
+    fclose(f);
+    if (failed) { fprintf(stderr, "ERROR: Could not read image file '%s'.\n", filename); return -1; }
+    return 0;
+}
+
+int load_program(Machine* m, const char* filename, uint32_t* start_address) {
+    const char* extension = strrchr(filename, '.');
+    if (extension && (strcmp(extension, ".bin") == 0 || strcmp(extension, ".img") == 0)) {
+        return load_image(m, filename, *start_address);
+    }
+    return load_file(m, filename, start_address);
+}
@@ -1,6 +1,7 @@
 #ifndef LOADER_H
 #define LOADER_H
 
+#include "machine.h"
 #include <stdint.h>
 #include <stdio.h>
 #include <stdbool.h>
@@ -72,7 +73,14 @@ typedef struct {
 } Operand;
 
 
-// Loads an assembly file into memory
-int load_file(const char* filename, uint32_t* start_address);
+// Assembles a file into the machine's memory and records its source mappings
+// and symbols. 'start_address' is updated by the first ORG directive.
+int load_file(Machine* m, const char* filename, uint32_t* start_address);
+
+// Copies a raw big-endian memory image to 'address'
+int load_image(Machine* m, const char* filename, uint32_t address);
+
+// Loads '.bin' and '.img' files as images and anything else as assembly
+int load_program(Machine* m, const char* filename, uint32_t* start_address);
 
 #endif // LOADER_H
@@ -0,0 +1,103 @@
+#include "machine.h"
+#include "memory.h"
+#include "bus.h"
+#include "disassembler.h"
+#include "loader.h"
+#include "block_cache.h"
+#include "jit.h"
+#include "trace.h"
+#include "debug.h"
+#include "history.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+Machine* machine_create(void) {
+    Machine* m = (Machine*)calloc(1, sizeof(Machine));
+    if (!m) {
+        perror("Failed to allocate machine");
+        exit(EXIT_FAILURE);
+    }
+    mem_init(m);
+    m->source_map = disassembler_create();
+    if (!m->source_map) {
+        perror("Failed to allocate source map");
+        exit(EXIT_FAILURE);
+    }
+    cpu_init(&m->cpu);
+    return m;
+}
+
+void machine_destroy(Machine* m) {
+    if (!m) return;
+    trace_close(m);
+    block_cache_shutdown(m);
+    jit_shutdown(m);
+    free(m->session);
+    disassembler_cleanup(m->source_map);
+    destroy_symbol_table(m->symbols);
+    history_stop(m); // Its snapshots hold pages and device state
+    debug_shutdown(m);
+    bus_shutdown(m);
+    mem_shutdown(m);
+    free(m);
+}
+
+void machine_reset(Machine* m) {
+    trace_close(m);
+    block_cache_shutdown(m);
+    jit_shutdown(m);
+    disassembler_cleanup(m->source_map);
+    m->source_map = disassembler_create();
+    if (!m->source_map) {
+        perror("Failed to allocate source map");
+        exit(EXIT_FAILURE);
+    }
+    destroy_symbol_table(m->symbols);
+    m->symbols = NULL;
+    history_stop(m);
+    debug_shutdown(m);
+    bus_shutdown(m);
+    mem_reset(m);
+    cpu_init(&m->cpu);
+    m->exec_break = false;
+}
+
+// --- Snapshots ---
+
+struct MachineSnapshot {
+    CPU cpu;
+    MemSnapshot* memory;
+    BusState* devices;
+};
+
+MachineSnapshot* machine_snapshot(Machine* m) {
+    MachineSnapshot* s = (MachineSnapshot*)malloc(sizeof(MachineSnapshot));
+    if (!s) {
+        perror("Failed to allocate machine snapshot");
+        exit(EXIT_FAILURE);
+    }
+    s->cpu = m->cpu;
+    s->memory = mem_snapshot(m);
+    s->devices = bus_save_state(m);
+    return s;
+}
+
+int machine_restore(Machine* m, const MachineSnapshot* s) {
+    // Devices first, they are the part that can refuse
+    if (!bus_restore_state(m, s->devices)) {
+        fprintf(stderr, "ERROR: Snapshot does not match the mapped regions.\n");
+        return -1;
+    }
+    m->cpu = s->cpu;
+    int pages = mem_restore(m, s->memory);
+    m->exec_break = false;
+    m->watch_hit = false;
+    return pages;
+}
+
+void machine_snapshot_free(MachineSnapshot* s) {
+    if (!s) return;
+    mem_snapshot_free(s->memory);
+    bus_state_free(s->devices);
+    free(s);
+}
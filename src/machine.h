@@ -0,0 +1,72 @@
+#ifndef MACHINE_H
+#define MACHINE_H
+
+#include "cpu.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+// One complete simulated system. Everything a simulation touches lives here
+// rather than in globals, so independent machines can run side by side, one
+// per thread. Memory fields are kept inline since every access uses them;
+// the other modules keep their state behind a pointer.
+
+typedef struct Machine Machine;
+
+// Memory is a two-level table of pages, see memory.h for the layout
+#define MEM_DIR_ENTRIES 1024
+
+// Called after a store lands in memory that holds decoded code, with its bounds
+typedef void (*CodeWriteHook)(Machine* m, uint32_t start, uint32_t end);
+// Called for each byte read or written in a watched page
+typedef void (*WatchHook)(Machine* m, uint32_t address, uint8_t value, bool write);
+
+struct Machine {
+    CPU cpu; // First, so handlers reach registers without an offset
+
+    // Memory, see memory.c
+    struct MemPage** page_dir[MEM_DIR_ENTRIES]; // Page tables, allocated on first write
+    int pages_used;
+    CodeWriteHook code_write_hook;
+    WatchHook watch_hook;
+    uint64_t* dirty_pages;          // One bit per page written since the last clear
+    struct Bus* bus;                // ROM and device regions, NULL if all RAM, see bus.h
+    struct MemJournal* journal;     // Write journal, NULL while it is off
+    struct MemMapping* mappings;    // Files pages are used from in place, see state.h
+
+    struct SourceMap* source_map;   // Address to source line, see disassembler.h
+    struct HashTable* symbols;      // Labels of the loaded program, see loader.h
+
+    struct BlockCache* blocks;      // Decoded blocks, see block_cache.c
+    struct JitState* jit;           // Native code cache, see jit.c
+    struct TraceWriter* trace;      // Binary trace output, see trace.c
+    struct ExecSession* session;    // Run state between executor calls
+    struct Debugger* debug;         // Breakpoints and watchpoints, see debug.h
+    struct History* history;        // Checkpoints for going back, see history.h
+    bool exec_break;                // A store hit decoded code, leave the block
+    bool watch_hit;                 // A watchpoint fired, stop after this instruction
+    bool quiet;                     // No INFO output from loader and executor
+};
+
+// Allocates a machine with cleared memory and a reset CPU. Exits on failure,
+// like mem_init() always has.
+Machine* machine_create(void);
+void machine_destroy(Machine* m);
+
+// Returns a machine to the state machine_create() left it in, keeping its
+// allocations, so one machine can run many programs in turn
+void machine_reset(Machine* m);
+
+// The full state of a machine between runs: CPU registers, SR and cycle
+// count, memory (see mem_snapshot) and device state (see bus.h). Taking one
+// costs a pointer copy per allocated page; restoring rewrites only the pages
+// changed since. Breakpoints, watchpoints, symbols and the journal are not
+// part of it. Restoring fails, changing nothing, if regions were mapped
+// since the snapshot.
+typedef struct MachineSnapshot MachineSnapshot;
+
+MachineSnapshot* machine_snapshot(Machine* m);
+// Returns the number of memory pages put back, or -1 on failure
+int machine_restore(Machine* m, const MachineSnapshot* snapshot);
+void machine_snapshot_free(MachineSnapshot* snapshot);
+
+#endif // MACHINE_H
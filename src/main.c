@@ -1,27 +1,200 @@
 #define _POSIX_C_SOURCE 200809L
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h> // for getopt
 
 #include "cpu.h"
+#include "machine.h"
 #include "memory.h"
 #include "loader.h"
 #include "executor.h"
 #include "disassembler.h"
+#include "batch.h"
+#include "devices.h"
+#include "debug.h"
+#include "state.h"
+#include "history.h"
+
+#define DEFAULT_BUDGET 5000 // Instructions, keeps runaway programs from tracing forever
+
+// Going back after the run, see history.h
+typedef struct {
+    unsigned long interval; // 0 for no history
+    unsigned long step_back;
+    bool find_write;
+    uint32_t write_address;
+} HistoryOptions;
+
+// Breakpoints and watchpoints from the command line, set once loaded
+typedef struct {
+    uint32_t breakpoints[DEBUG_MAX_BREAKPOINTS];
+    int num_breakpoints;
+    const char* watchpoints[DEBUG_MAX_WATCHPOINTS];
+    int num_watchpoints;
+} DebugOptions;
 
 void print_usage(const char* prog_name) {
     fprintf(stderr, "Usage: %s [options] <assembly_file>\n", prog_name);
+    fprintf(stderr, "       %s -b <list_file> [options] [programs...]\n", prog_name);
     fprintf(stderr, "Options:\n");
     fprintf(stderr, "  -a <address>  Load program at the specified hex address (default: 0x10000)\n");
+    fprintf(stderr, "  -n <count>    Stop after this many instructions, 0 for no limit (default: %d)\n", DEFAULT_BUDGET);
+    fprintf(stderr, "  -u <address>  Stop when execution reaches the specified hex address\n");
+    fprintf(stderr, "  -c <cycles>   Stop once this many clock cycles have run\n");
+    fprintf(stderr, "  -j            Translate hot blocks to native code (x86-64 only)\n");
+    fprintf(stderr, "  -J            Like -j, and check every native block against the interpreter\n");
+    fprintf(stderr, "  -t <file>     Write a binary execution trace, render it with 68k_tracedump\n");
+    fprintf(stderr, "  -P <file>     Add instruction sequence counts to <file>, see README.md\n");
+    fprintf(stderr, "  -I            Attach a UART at 0x%X and a timer at 0x%X\n", DEVICE_UART_BASE, DEVICE_TIMER_BASE);
+    fprintf(stderr, "  -M <file>     Journal memory writes to <file>, one line per byte written\n");
+    fprintf(stderr, "  -B <address>  Stop before the instruction at the hex address, may be repeated\n");
+    fprintf(stderr, "  -W <address>[,<length>[,r|w|rw]]\n");
+    fprintf(stderr, "                Stop after an access to the watched bytes (default: 1 byte, w)\n");
+    fprintf(stderr, "  -S <file>     Save the machine state to <file> after the run\n");
+    fprintf(stderr, "  -L <file>     Resume from a saved state instead of loading a program\n");
+    fprintf(stderr, "  -R <runs>     Run the program this many times, restoring a snapshot before each\n");
+    fprintf(stderr, "  -k <count>    Keep history, a checkpoint every <count> instructions (default: %d)\n", HISTORY_DEFAULT_INTERVAL);
+    fprintf(stderr, "  -p <count>    After the run, step back <count> instructions\n");
+    fprintf(stderr, "  -w <address>  After the run, go back to the last instruction that wrote the hex address\n");
+    fprintf(stderr, "  -q            Headless run: no per-instruction trace, only the final state\n");
+    fprintf(stderr, "  -F            Run idle and countdown loops in full instead of skipping them\n");
+    fprintf(stderr, "  -b <file>     Batch mode: run every program listed in <file>, one path per line\n");
+    fprintf(stderr, "  -T <threads>  Worker threads for batch mode (default: one per CPU)\n");
+    fprintf(stderr, "  -o <file>     Write batch results to <file> instead of stdout\n");
+    fprintf(stderr, "  -V            Verify the opcode dispatch table and exit\n");
     fprintf(stderr, "  -h            Show this help message\n");
 }
 
+// Runs the programs of a list file plus any given on the command line
+static int run_batch(const char* list_file, const char* const* extra, int num_extra, int threads,
+                     uint32_t start_address, bool devices, const ExecOptions* options, const char* output) {
+    int num_listed = 0;
+    char** listed = batch_read_list(list_file, &num_listed);
+    if (!listed) return EXIT_FAILURE;
+
+    const char** files = (const char**)malloc((num_listed + num_extra + 1) * sizeof(char*));
+    if (!files) {
+        perror("Failed to allocate file list");
+        batch_free_list(listed, num_listed);
+        return EXIT_FAILURE;
+    }
+    for (int i = 0; i < num_listed; ++i) files[i] = listed[i];
+    for (int i = 0; i < num_extra; ++i) files[num_listed + i] = extra[i];
+
+    FILE* out = output ? fopen(output, "w") : stdout;
+    int failures = -1;
+    if (!out) {
+        perror("Could not open batch output file");
+    } else {
+        if (options->trace_file) fprintf(stderr, "WARN: Binary traces are not written in batch mode.\n");
+        if (options->profile_file) fprintf(stderr, "WARN: Instruction profiles are not written in batch mode.\n");
+        BatchConfig config = {files, num_listed + num_extra, threads, start_address, devices, *options};
+        failures = batch_run(&config, out);
+        if (out != stdout) fclose(out);
+    }
+
+    free(files);
+    batch_free_list(listed, num_listed);
+    if (failures > 0) fprintf(stderr, "WARN: %d programs could not be loaded.\n", failures);
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// Parses "<address>[,<length>[,r|w|rw]]", all numbers in hex
+static bool set_watchpoint(Machine* m, const char* spec) {
+    char* end;
+    uint32_t address = strtoul(spec, &end, 16);
+    uint32_t length = 1;
+    int kind = WATCH_WRITE;
+    if (*end == ',') {
+        length = strtoul(end + 1, &end, 16);
+        if (*end == ',') {
+            const char* mode = end + 1;
+            kind = 0;
+            if (strchr(mode, 'r')) kind |= WATCH_READ;
+            if (strchr(mode, 'w')) kind |= WATCH_WRITE;
+            end += strlen(end);
+        }
+    }
+    if (end == spec || *end != '\0') {
+        fprintf(stderr, "ERROR: Bad watchpoint '%s'.\n", spec);
+        return false;
+    }
+    return debug_add_watchpoint(m, address, length, kind);
+}
+
+// Runs the loaded program 'runs' times from the same state
+static void run_repeated(Machine* m, const ExecOptions* options, int runs) {
+    MachineSnapshot* snapshot = machine_snapshot(m);
+    for (int run = 0; run < runs; ++run) {
+        if (run > 0) {
+            struct timespec start, end;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            int pages = machine_restore(m, snapshot);
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            double us = (end.tv_sec - start.tv_sec) * 1e6 + (end.tv_nsec - start.tv_nsec) / 1e3;
+            printf("\nINFO: Run %d of %d: restored snapshot in %.1f us (%d pages rewritten).\n", run + 1, runs, us, pages);
+        }
+        execute_program(m, options);
+    }
+    machine_snapshot_free(snapshot);
+}
+
+// Runs the program with history on, then goes back as asked
+static void run_with_history(Machine* m, const ExecOptions* options, const HistoryOptions* history) {
+    executor_start(m, options);
+    history_start(m, history->interval, HISTORY_DEFAULT_CHECKPOINTS);
+    StopReason reason = history_run(m, options->budget ? options->budget : ULONG_MAX, &options->stop);
+    executor_report_stop(m, options, reason);
+    if (history->find_write) {
+        if (history_find_write(m, history->write_address)) {
+            printf("INFO: Last write to 0x%X: instruction %llu at 0x%X.\n", history->write_address,
+                   (unsigned long long)history_position(m) + 1, m->cpu.pc);
+        } else {
+            printf("INFO: No write to 0x%X found.\n", history->write_address);
+        }
+    }
+    if (history->step_back) {
+        history_step_back(m, history->step_back);
+        printf("INFO: Stepped back to instruction %llu.\n", (unsigned long long)history_position(m));
+    }
+    if (history->find_write || history->step_back) {
+        printf("%-26s | ", "State");
+        cpu_dump_registers(&m->cpu);
+    }
+    history_stop(m);
+    executor_finish(m);
+}
+
+static bool set_debug_options(Machine* m, const DebugOptions* debug) {
+    for (int i = 0; i < debug->num_breakpoints; ++i) {
+        if (!debug_add_breakpoint(m, debug->breakpoints[i])) return false;
+    }
+    for (int i = 0; i < debug->num_watchpoints; ++i) {
+        if (!set_watchpoint(m, debug->watchpoints[i])) return false;
+    }
+    return true;
+}
+
 int main(int argc, char* argv[]) {
     uint32_t start_address = 0x10000;
+    ExecOptions options = {0};
+    options.budget = DEFAULT_BUDGET;
+    const char* journal_file = NULL;
+    bool devices = false;
+    DebugOptions debug = {0};
+    const char* batch_list = NULL;
+    const char* batch_output = NULL;
+    int batch_threads = 0;
+    int runs = 1;
+    const char* save_file = NULL;
+    const char* state_file = NULL;
+    HistoryOptions history = {0};
     int opt;
 
-    while ((opt = getopt(argc, argv, "ha:")) != -1) {
+    while ((opt = getopt(argc, argv, "ha:n:u:c:jJB:W:R:S:L:k:p:w:qFt:P:IM:b:T:o:V")) != -1) {
         switch (opt) {
             case 'h':
                 print_usage(argv[0]);
@@ -29,46 +202,168 @@ int main(int argc, char* argv[]) {
             case 'a':
                 start_address = strtoul(optarg, NULL, 16);
                 break;
+            case 'n':
+                options.budget = strtoul(optarg, NULL, 0);
+                break;
+            case 'u':
+                options.stop.use_address = true;
+                options.stop.address = strtoul(optarg, NULL, 16);
+                break;
+            case 'c':
+                options.stop.max_cycles = strtoull(optarg, NULL, 0);
+                break;
+            case 'j':
+                options.use_jit = true;
+                break;
+            case 'J':
+                options.use_jit = true;
+                options.jit_lockstep = true;
+                break;
+            case 'B':
+                if (debug.num_breakpoints == DEBUG_MAX_BREAKPOINTS) {
+                    fprintf(stderr, "ERROR: Too many breakpoints.\n");
+                    return EXIT_FAILURE;
+                }
+                debug.breakpoints[debug.num_breakpoints++] = strtoul(optarg, NULL, 16);
+                break;
+            case 'W':
+                if (debug.num_watchpoints == DEBUG_MAX_WATCHPOINTS) {
+                    fprintf(stderr, "ERROR: Too many watchpoints.\n");
+                    return EXIT_FAILURE;
+                }
+                debug.watchpoints[debug.num_watchpoints++] = optarg;
+                break;
+            case 'R':
+                runs = atoi(optarg);
+                if (runs < 1) {
+                    fprintf(stderr, "ERROR: Bad run count '%s'.\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'S':
+                save_file = optarg;
+                break;
+            case 'L':
+                state_file = optarg;
+                break;
+            case 'k':
+                history.interval = strtoul(optarg, NULL, 0);
+                if (history.interval == 0) {
+                    fprintf(stderr, "ERROR: Bad checkpoint interval '%s'.\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'p':
+                history.step_back = strtoul(optarg, NULL, 0);
+                break;
+            case 'w':
+                history.find_write = true;
+                history.write_address = strtoul(optarg, NULL, 16);
+                break;
+            case 'q':
+                options.headless = true;
+                break;
+            case 'F':
+                options.no_idle_skip = true;
+                break;
+            case 't':
+                options.trace_file = optarg;
+                break;
+            case 'P':
+                options.profile_file = optarg;
+                break;
+            case 'I':
+                devices = true;
+                break;
+            case 'M':
+                journal_file = optarg;
+                break;
+            case 'b':
+                batch_list = optarg;
+                break;
+            case 'T':
+                batch_threads = atoi(optarg);
+                break;
+            case 'o':
+                batch_output = optarg;
+                break;
+            case 'V':
+                return executor_verify_dispatch() == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
             default: /* '?' */
                 print_usage(argv[0]);
                 return EXIT_FAILURE;
         }
     }
 
-    mem_init();
+    if (batch_list) {
+        return run_batch(batch_list, (const char* const*)&argv[optind], argc - optind,
+                         batch_threads, start_address, devices, &options, batch_output);
+    }
 
-    if (optind < argc) {
+    Machine* m = machine_create();
+    // Started before loading, so the program image is journaled too
+    if (journal_file && !mem_journal_start(m, MEM_JOURNAL_DEFAULT_RUNS, journal_file)) {
+        machine_destroy(m);
+        return EXIT_FAILURE;
+    }
+    if (devices && !devices_attach_standard(m, stdout)) {
+        machine_destroy(m);
+        return EXIT_FAILURE;
+    }
+
+    if (state_file) {
+        if (!state_load(m, state_file)) {
+            machine_destroy(m);
+            return EXIT_FAILURE;
+        }
+    } else if (optind < argc) {
         char* filename = argv[optind];
-        printf("INFO: Loading assembly file: %s\n", filename);
-        if (load_file(filename, &start_address) != 0) {
+        printf("INFO: Loading program: %s\n", filename);
+        if (load_program(m, filename, &start_address) != 0) {
             fprintf(stderr, "Error: Failed to load file '%s'.\n", filename);
-            mem_shutdown();
+            machine_destroy(m);
             return EXIT_FAILURE;
         }
     } else {
         // No file provided, use a default hardcoded program.
         printf("INFO: No assembly file provided, using hardcoded program.\n");
-        mem_write_word(start_address, 0x303C);      // MOVE.W #3,D0
-        mem_write_word(start_address + 2, 0x0003);
-        mem_write_word(start_address + 4, 0x5340);      // SUBQ.W #1,D0
-        mem_write_word(start_address + 6, 0x66FC);      // BNE -4 (to 0x10004)
-        mem_write_word(start_address + 8, 0x4E75);      // RTS
+        static const uint8_t program[] = {
+            0x30, 0x3C, 0x00, 0x03, // MOVE.W #3,D0
+            0x53, 0x40,             // SUBQ.W #1,D0
+            0x66, 0xFC,             // BNE -4 (to 0x10004)
+            0x4E, 0x75,             // RTS
+        };
+        mem_write_block(m, start_address, program, sizeof(program));
 
-        disassembler_add_mapping(start_address, 1, "MOVE.W #3,D0");
-        disassembler_add_mapping(start_address + 4, 2, "SUBQ.W #1,D0");
-        disassembler_add_mapping(start_address + 6, 3, "BNE LOOP");
-        disassembler_add_mapping(start_address + 8, 4, "RTS");
+        disassembler_add_mapping(m->source_map, start_address, 1, "MOVE.W #3,D0");
+        disassembler_add_mapping(m->source_map, start_address + 4, 2, "SUBQ.W #1,D0");
+        disassembler_add_mapping(m->source_map, start_address + 6, 3, "BNE LOOP");
+        disassembler_add_mapping(m->source_map, start_address + 8, 4, "RTS");
     }
 
-    CPU cpu;
-    cpu_pulse_reset(&cpu);
-    cpu.pc = start_address;
+    if (!set_debug_options(m, &debug)) {
+        machine_destroy(m);
+        return EXIT_FAILURE;
+    }
+    if (!state_file) {
+        cpu_pulse_reset(&m->cpu);
+        m->cpu.pc = start_address;
+    }
 
-    execute_program(&cpu);
+    if ((history.step_back || history.find_write) && !history.interval) history.interval = HISTORY_DEFAULT_INTERVAL;
+    if (history.interval) {
+        if (runs > 1) fprintf(stderr, "WARN: -R is ignored while keeping history.\n");
+        run_with_history(m, &options, &history);
+    } else if (runs > 1) {
+        run_repeated(m, &options, runs);
+    } else {
+        execute_program(m, &options);
+    }
+    bool saved = !save_file || state_save(m, save_file);
 
-    mem_dump_changes("memory_dump.txt");
-    disassembler_cleanup();
-    mem_shutdown();
+    mem_journal_stop(m);
+    mem_dump_dirty_pages(m, "memory_dump.txt");
+    machine_destroy(m);
 
-    return EXIT_SUCCESS;
+    return saved ? EXIT_SUCCESS : EXIT_FAILURE;
 }
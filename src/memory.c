@@ -1,89 +1,339 @@
+#define _POSIX_C_SOURCE 200809L
 #include "memory.h"
+#include "bus.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 
-static uint8_t* memory = NULL;
-static MemoryChange* changes = NULL;
-static int change_count = 0;
-static int change_capacity = 0;
+// A file mapped with mem_map_pages(), unmapped with the pages
+typedef struct MemMapping {
+    void* base;
+    size_t length;
+    struct MemMapping* next;
+} MemMapping;
 
-void mem_init() {
-    memory = (uint8_t*)malloc(MEMORY_SIZE);
-    if (!memory) {
-        perror("Failed to allocate memory");
+void mem_init(Machine* m) {
+    memset(m->page_dir, 0, sizeof(m->page_dir));
+    m->pages_used = 0;
+    m->journal = NULL;
+    m->code_write_hook = NULL;
+    m->watch_hook = NULL;
+    m->mappings = NULL;
+    m->dirty_pages = (uint64_t*)calloc(MEM_DIRTY_WORDS, sizeof(uint64_t));
+    if (!m->dirty_pages) {
+        perror("Failed to allocate dirty page bitmap");
         exit(EXIT_FAILURE);
     }
-    memset(memory, 0, MEMORY_SIZE);
-    change_capacity = 1024; // Initial capacity
-    changes = (MemoryChange*)malloc(change_capacity * sizeof(MemoryChange));
-    if (!changes) {
-        perror("Failed to allocate memory for changes");
-        free(memory);
+}
+
+// Drops one owner of a page, freeing it with the last. Mapped pages go with
+// their mapping instead.
+static void release_page(MemPage* page) {
+    if (page && --page->refs == 0 && !(page->flags & MEM_PAGE_MAPPED)) free(page);
+}
+
+static void free_pages(Machine* m) {
+    for (int dir = 0; dir < MEM_DIR_ENTRIES; ++dir) {
+        MemPage** table = m->page_dir[dir];
+        if (!table) continue;
+        for (int i = 0; i < MEM_TABLE_ENTRIES; ++i) release_page(table[MEM_HOME_SLOTS + i]);
+        free(table);
+        m->page_dir[dir] = NULL;
+    }
+    m->pages_used = 0;
+    while (m->mappings) {
+        MemMapping* mapping = m->mappings;
+        m->mappings = mapping->next;
+        munmap(mapping->base, mapping->length);
+        free(mapping);
+    }
+}
+
+void mem_shutdown(Machine* m) {
+    mem_journal_stop(m);
+    free_pages(m);
+    free(m->dirty_pages);
+    m->dirty_pages = NULL;
+}
+
+void mem_reset(Machine* m) {
+    mem_journal_stop(m);
+    free_pages(m);
+    mem_clear_dirty(m);
+    m->code_write_hook = NULL;
+    m->watch_hook = NULL;
+}
+
+int mem_pages_used(Machine* m) {
+    return m->pages_used;
+}
+
+// --- Page Table ---
+
+// The load slot of 'address', or NULL if there is no table. Its store and
+// home slots are MEM_STORE_SLOTS and MEM_HOME_SLOTS further on.
+static MemPage** page_slot(Machine* m, uint32_t address) {
+    MemPage** table = m->page_dir[address >> MEM_DIR_SHIFT];
+    return table ? &table[(address >> MEM_PAGE_SHIFT) & (MEM_TABLE_ENTRIES - 1)] : NULL;
+}
+
+// The page holding 'address', watched or not, or NULL
+static MemPage* home_page(Machine* m, uint32_t address) {
+    MemPage** slot = page_slot(m, address);
+    return slot ? slot[MEM_HOME_SLOTS] : NULL;
+}
+
+static void set_slots(MemPage** slot, MemPage* page, bool watched) {
+    slot[MEM_LOAD_SLOTS] = watched ? NULL : page;
+    slot[MEM_STORE_SLOTS] = (watched || !page || page->refs > 1) ? NULL : page;
+    slot[MEM_HOME_SLOTS] = page;
+}
+
+static bool is_watched(MemPage** slot) {
+    return slot[MEM_HOME_SLOTS] && !slot[MEM_LOAD_SLOTS];
+}
+
+// The load slot of 'address', allocating its table if needed
+static MemPage** get_table_slot(Machine* m, uint32_t address) {
+    MemPage*** table = &m->page_dir[address >> MEM_DIR_SHIFT];
+    if (!*table) {
+        *table = (MemPage**)calloc(MEM_TABLE_SLOTS, sizeof(MemPage*));
+        if (!*table) {
+            perror("Failed to allocate page table");
+            exit(EXIT_FAILURE);
+        }
+    }
+    return page_slot(m, address);
+}
+
+// The page holding 'address', allocated and cleared on first use
+static MemPage* get_page(Machine* m, uint32_t address) {
+    MemPage* page = home_page(m, address);
+    if (page) return page;
+
+    MemPage** slot = get_table_slot(m, address);
+    page = (MemPage*)calloc(1, sizeof(MemPage));
+    if (!page) {
+        perror("Failed to allocate memory page");
+        exit(EXIT_FAILURE);
+    }
+    page->refs = 1;
+    set_slots(slot, page, false);
+    m->pages_used++;
+    return page;
+}
+
+// The same, but never shared with a snapshot, so it may be written
+static MemPage* own_page(Machine* m, uint32_t address) {
+    MemPage* page = get_page(m, address);
+    if (page->refs == 1) {
+        // The snapshots that shared it are gone, so stores may go direct again
+        MemPage** slot = page_slot(m, address);
+        if (!slot[MEM_STORE_SLOTS]) set_slots(slot, page, is_watched(slot));
+        return page;
+    }
+
+    MemPage* copy = (MemPage*)malloc(sizeof(MemPage));
+    if (!copy) {
+        perror("Failed to allocate memory page");
         exit(EXIT_FAILURE);
     }
+    memcpy(copy, page, sizeof(MemPage));
+    copy->refs = 1;
+    copy->flags = 0;
+    page->refs--;
+    MemPage** slot = page_slot(m, address);
+    set_slots(slot, copy, is_watched(slot));
+    return copy;
 }
 
-void mem_shutdown() {
-    free(memory);
-    free(changes);
-    memory = NULL;
-    changes = NULL;
+// Puts 'page', or none, in place of the page at 'address', handing it the
+// reference the caller holds. A watched page stays watched.
+static void replace_page(Machine* m, uint32_t address, MemPage* page) {
+    MemPage** slot = get_table_slot(m, address);
+    MemPage* current = slot[MEM_HOME_SLOTS];
+    bool watched = is_watched(slot);
+    release_page(current);
+    if (current) m->pages_used--;
+    if (page) {
+        m->pages_used++;
+        set_slots(slot, page, watched);
+    } else {
+        set_slots(slot, NULL, false);
+        // A watched page must exist, an empty one reads the same as none
+        if (watched) set_slots(slot, get_page(m, address), true);
+    }
 }
 
-static void record_change(uint32_t address, uint8_t old_val, uint8_t new_val) {
-    if (change_count >= change_capacity) {
-        change_capacity *= 2;
-        changes = (MemoryChange*)realloc(changes, change_capacity * sizeof(MemoryChange));
-        if (!changes) {
-            perror("Failed to reallocate memory for changes");
-            // Not a fatal error, we just lose change tracking
-            return;
+// --- Write Journal ---
+
+// Runs are numbered from 0; run n lives in runs[n % capacity]
+typedef struct MemJournal {
+    MemoryChange* runs;
+    int capacity;
+    uint64_t first;   // Oldest run still held
+    uint64_t end;     // One past the newest run
+    uint64_t dropped; // Runs overwritten before anyone saw them
+    FILE* stream;     // NULL to keep runs in memory only
+    char* stream_name;
+} MemJournal;
+
+static void stream_runs(MemJournal* j, uint64_t end) {
+    for (; j->first < end; ++j->first) {
+        const MemoryChange* run = &j->runs[j->first % j->capacity];
+        for (int i = 0; i < run->length; ++i) {
+            fprintf(j->stream, "0x%08X: 0x%02X -> 0x%02X\n",
+                    run->address + i, run->old_value[i], run->new_value[i]);
         }
     }
-    changes[change_count].address = address;
-    changes[change_count].old_value = old_val;
-    changes[change_count].new_value = new_val;
-    change_count++;
 }
 
-uint8_t mem_read_byte(uint32_t address) {
-    return memory[address % MEMORY_SIZE];
+// Makes room for one more run. The newest run is never streamed or dropped,
+// as it may still grow.
+static void make_room(MemJournal* j) {
+    if (j->end - j->first < (uint64_t)j->capacity) return;
+    if (j->stream) {
+        stream_runs(j, j->first + j->capacity / 2);
+    } else {
+        j->first++;
+        j->dropped++;
+    }
 }
 
-uint16_t mem_read_word(uint32_t address) {
-    return (memory[address % MEMORY_SIZE] << 8) | memory[(address + 1) % MEMORY_SIZE];
+bool mem_journal_start(Machine* m, int capacity, const char* stream_file) {
+    mem_journal_stop(m);
+    if (capacity < 2) capacity = 2;
+    MemJournal* j = (MemJournal*)calloc(1, sizeof(MemJournal));
+    if (!j) {
+        perror("Failed to allocate memory journal");
+        exit(EXIT_FAILURE);
+    }
+    j->runs = (MemoryChange*)malloc(capacity * sizeof(MemoryChange));
+    if (!j->runs) {
+        perror("Failed to allocate memory journal");
+        exit(EXIT_FAILURE);
+    }
+    j->capacity = capacity;
+    if (stream_file) {
+        j->stream = fopen(stream_file, "w");
+        j->stream_name = strdup(stream_file);
+        if (!j->stream || !j->stream_name) {
+            perror("Could not open memory journal file");
+            if (j->stream) fclose(j->stream);
+            free(j->stream_name);
+            free(j->runs);
+            free(j);
+            return false;
+        }
+        fprintf(j->stream, "--- Memory Changes ---\n");
+    }
+    m->journal = j;
+    return true;
+}
+
+void mem_journal_stop(Machine* m) {
+    MemJournal* j = m->journal;
+    if (!j) return;
+    if (j->stream) {
+        stream_runs(j, j->end);
+        fclose(j->stream);
+        if (!m->quiet) printf("Memory changes written to %s\n", j->stream_name);
+    }
+    if (j->dropped && !m->quiet) {
+        printf("WARN: Memory journal dropped %llu runs.\n", (unsigned long long)j->dropped);
+    }
+    free(j->stream_name);
+    free(j->runs);
+    free(j);
+    m->journal = NULL;
+}
+
+uint64_t mem_journal_end(Machine* m) {
+    return m->journal ? m->journal->end : 0;
 }
 
-uint32_t mem_read_long(uint32_t address) {
-    return (memory[address % MEMORY_SIZE] << 24) |
-           (memory[(address + 1) % MEMORY_SIZE] << 16) |
-           (memory[(address + 2) % MEMORY_SIZE] << 8) |
-           memory[(address + 3) % MEMORY_SIZE];
+const MemoryChange* mem_journal_run(Machine* m, uint64_t run) {
+    MemJournal* j = m->journal;
+    if (!j || run < j->first || run >= j->end) return NULL;
+    return &j->runs[run % j->capacity];
 }
 
-void mem_write_byte(uint32_t address, uint8_t value) {
-    uint32_t addr = address % MEMORY_SIZE;
-    record_change(addr, memory[addr], value);
-    memory[addr] = value;
+// Adds a byte to the newest run, or starts a run with it
+static void journal_byte(MemJournal* j, uint32_t address, uint8_t old_value, uint8_t new_value) {
+    MemoryChange* run = j->end > j->first ? &j->runs[(j->end - 1) % j->capacity] : NULL;
+    if (!run || run->length == MEM_JOURNAL_RUN || run->address + run->length != address) {
+        make_room(j);
+        run = &j->runs[j->end % j->capacity];
+        j->end++;
+        run->address = address;
+        run->length = 0;
+    }
+    run->old_value[run->length] = old_value;
+    run->new_value[run->length] = new_value;
+    run->length++;
+}
+
+void mem_journal_record(Machine* m, uint32_t address, const uint8_t* bytes, uint32_t value, int size) {
+    for (int i = 0; i < size; ++i) {
+        journal_byte(m->journal, address + i, bytes[i], (value >> (8 * (size - 1 - i))) & 0xFF);
+    }
+}
+
+// --- Dirty Pages ---
+
+void mem_for_each_dirty_page(Machine* m, DirtyPageFn fn, void* context) {
+    for (uint32_t word = 0; word < MEM_DIRTY_WORDS; ++word) {
+        uint64_t bits = m->dirty_pages[word];
+        while (bits) {
+            uint32_t page = word * 64 + __builtin_ctzll(bits);
+            bits &= bits - 1;
+            uint32_t address = page << MEM_PAGE_SHIFT;
+            // A dirty page was written, so it exists until the next reset
+            fn(m, address, home_page(m, address)->data, context);
+        }
+    }
 }
 
-void mem_write_word(uint32_t address, uint16_t value) {
-    uint32_t addr = address % MEMORY_SIZE;
-    mem_write_byte(addr, (value >> 8) & 0xFF);
-    mem_write_byte(addr + 1, value & 0xFF);
+int mem_dirty_count(Machine* m) {
+    int count = 0;
+    for (uint32_t word = 0; word < MEM_DIRTY_WORDS; ++word) {
+        count += __builtin_popcountll(m->dirty_pages[word]);
+    }
+    return count;
 }
 
-void mem_write_long(uint32_t address, uint32_t value) {
-    uint32_t addr = address % MEMORY_SIZE;
-    mem_write_byte(addr, (value >> 24) & 0xFF);
-    mem_write_byte(addr + 1, (value >> 16) & 0xFF);
-    mem_write_byte(addr + 2, (value >> 8) & 0xFF);
-    mem_write_byte(addr + 3, value & 0xFF);
+void mem_clear_dirty(Machine* m) {
+    memset(m->dirty_pages, 0, MEM_DIRTY_WORDS * sizeof(uint64_t));
 }
 
-void mem_dump_changes(const char* filename) {
-    if (change_count == 0) {
+void mem_clear_page_dirty(Machine* m, uint32_t address) {
+    uint32_t page = address >> MEM_PAGE_SHIFT;
+    m->dirty_pages[page >> 6] &= ~(1ull << (page & 63));
+}
+
+static void dump_page(Machine* m, uint32_t address, const uint8_t* data, void* context) {
+    (void)m; // Silence unused parameter warning
+    FILE* f = (FILE*)context;
+    bool repeated = false;
+    for (int line = 0; line < MEM_PAGE_SIZE; line += 16) {
+        const uint8_t* bytes = data + line;
+        if (line > 0 && memcmp(bytes, bytes - 16, 16) == 0) {
+            if (!repeated) fprintf(f, "*\n");
+            repeated = true;
+            continue;
+        }
+        repeated = false;
+        fprintf(f, "0x%08X:", address + line);
+        for (int i = 0; i < 16; ++i) fprintf(f, " %02X", bytes[i]);
+        fprintf(f, "  ");
+        for (int i = 0; i < 16; ++i) fputc(bytes[i] >= 0x20 && bytes[i] < 0x7F ? bytes[i] : '.', f);
+        fputc('\n', f);
+    }
+}
+
+void mem_dump_dirty_pages(Machine* m, const char* filename) {
+    if (mem_dirty_count(m) == 0) {
         return;
     }
     FILE* f = fopen(filename, "w");
@@ -91,12 +341,333 @@ void mem_dump_changes(const char* filename) {
         perror("Could not open memory dump file");
         return;
     }
-    fprintf(f, "--- Memory Changes ---\n");
-    // Simple linear dump for now. A hexdump format would be better.
-    for (int i = 0; i < change_count; ++i) {
-        fprintf(f, "0x%08X: 0x%02X -> 0x%02X\n",
-                changes[i].address, changes[i].old_value, changes[i].new_value);
-    }
+    fprintf(f, "--- Changed Pages ---\n");
+    mem_for_each_dirty_page(m, dump_page, f);
     fclose(f);
     printf("Memory changes written to %s\n", filename);
 }
+
+// --- Slow Paths ---
+// See the accessors in memory.h for when these run
+
+// Reads through the page itself, for accesses that missed the fast paths.
+// 'watched' reports the read to the watch hook, if the page has one.
+static uint8_t read_byte(Machine* m, uint32_t address, bool watched) {
+    const MemPage* page = home_page(m, address);
+    if (page) {
+        uint8_t value = page->data[mem_page_offset(address)];
+        if (watched && m->watch_hook) m->watch_hook(m, address, value, false);
+        return value;
+    }
+    const BusRegion* region = bus_region_at(m, address);
+    if (region && region->kind == BUS_MMIO) {
+        return region->handlers->read(m, region->device, address - region->start);
+    }
+    return 0;
+}
+
+// Only reached for pages without direct access, so a page found is watched
+uint8_t mem_read_byte_slow(Machine* m, uint32_t address) {
+    return read_byte(m, address, true);
+}
+
+uint16_t mem_fetch_word_slow(Machine* m, uint32_t address) {
+    return (read_byte(m, address, false) << 8) | read_byte(m, address + 1, false);
+}
+
+uint16_t mem_read_word_slow(Machine* m, uint32_t address) {
+    return (mem_read_byte(m, address) << 8) | mem_read_byte(m, address + 1);
+}
+
+uint32_t mem_read_long_slow(Machine* m, uint32_t address) {
+    return ((uint32_t)mem_read_byte(m, address) << 24) |
+           ((uint32_t)mem_read_byte(m, address + 1) << 16) |
+           ((uint32_t)mem_read_byte(m, address + 2) << 8) |
+           mem_read_byte(m, address + 3);
+}
+
+// Clears the granule before reporting it, so the hook may re-mark it
+static void notify_code_write(Machine* m, MemPage* page, uint32_t addr) {
+    page->code_granules &= ~mem_granule_bit(addr);
+    if (m->code_write_hook) {
+        uint32_t start = addr & ~((1u << MEM_CODE_GRANULE_SHIFT) - 1);
+        m->code_write_hook(m, start, start + (1u << MEM_CODE_GRANULE_SHIFT));
+    }
+}
+
+static void write_byte(Machine* m, uint32_t address, uint8_t value) {
+    const BusRegion* region = bus_region_at(m, address);
+    if (region) {
+        // ROM and unmapped pages drop the store
+        if (region->kind == BUS_MMIO) region->handlers->write(m, region->device, address - region->start, value);
+        return;
+    }
+    MemPage* page = own_page(m, address);
+    uint8_t* byte = &page->data[mem_page_offset(address)];
+    if (m->journal) mem_journal_record(m, address, byte, value, 1);
+    mem_set_dirty(m, address);
+    *byte = value;
+    if (page->code_granules & mem_granule_bit(address)) {
+        notify_code_write(m, page, address);
+    }
+    if (m->watch_hook && !mem_find_page(m, address)) m->watch_hook(m, address, value, true);
+}
+
+// Stores most significant byte first, as the bus would
+void mem_write_slow(Machine* m, uint32_t address, uint32_t value, int size) {
+    for (int i = 0; i < size; ++i) {
+        write_byte(m, address + i, (value >> (8 * (size - 1 - i))) & 0xFF);
+    }
+}
+
+// --- Blocks ---
+
+// Bytes from 'address' to the end of its page, at most 'length'
+static uint32_t page_chunk(uint32_t address, uint32_t length) {
+    uint32_t left = MEM_PAGE_SIZE - mem_page_offset(address);
+    return length < left ? length : left;
+}
+
+void mem_read_block(Machine* m, uint32_t address, void* out, uint32_t length) {
+    uint8_t* dest = (uint8_t*)out;
+    while (length > 0) {
+        uint32_t n = page_chunk(address, length);
+        const MemPage* page = mem_find_page(m, address);
+        if (page) {
+            memcpy(dest, &page->data[mem_page_offset(address)], n);
+        } else if (!home_page(m, address) && !bus_region_at(m, address)) {
+            memset(dest, 0, n); // Never written
+        } else {
+            for (uint32_t i = 0; i < n; ++i) dest[i] = read_byte(m, address + i, true);
+        }
+        address += n;
+        dest += n;
+        length -= n;
+    }
+}
+
+// Stores 'n' bytes inside one page, from 'data' or all 'value' if NULL
+static void write_chunk(Machine* m, uint32_t address, const uint8_t* data, uint8_t value, uint32_t n) {
+    MemPage** slot = page_slot(m, address);
+    if (bus_region_at(m, address) || (slot && is_watched(slot))) {
+        for (uint32_t i = 0; i < n; ++i) write_byte(m, address + i, data ? data[i] : value);
+        return;
+    }
+    MemPage* page = own_page(m, address);
+    uint8_t* dest = &page->data[mem_page_offset(address)];
+    if (m->journal) {
+        for (uint32_t i = 0; i < n; ++i) journal_byte(m->journal, address + i, dest[i], data ? data[i] : value);
+    }
+    mem_set_dirty(m, address);
+    if (data) {
+        memcpy(dest, data, n);
+    } else {
+        memset(dest, value, n);
+    }
+    // Granules first to last, a shift of 64 would be undefined
+    uint32_t first = mem_page_offset(address) >> MEM_CODE_GRANULE_SHIFT;
+    uint32_t last = mem_page_offset(address + n - 1) >> MEM_CODE_GRANULE_SHIFT;
+    uint64_t touched = (~0ull >> (63 - last)) & (~0ull << first);
+    uint64_t code = page->code_granules & touched;
+    while (code) {
+        uint32_t granule = __builtin_ctzll(code);
+        code &= code - 1;
+        notify_code_write(m, page, (address & ~(uint32_t)(MEM_PAGE_SIZE - 1)) | (granule << MEM_CODE_GRANULE_SHIFT));
+    }
+}
+
+void mem_write_block(Machine* m, uint32_t address, const void* data, uint32_t length) {
+    const uint8_t* src = (const uint8_t*)data;
+    while (length > 0) {
+        uint32_t n = page_chunk(address, length);
+        write_chunk(m, address, src, 0, n);
+        address += n;
+        src += n;
+        length -= n;
+    }
+}
+
+void mem_fill(Machine* m, uint32_t address, uint8_t value, uint32_t length) {
+    while (length > 0) {
+        uint32_t n = page_chunk(address, length);
+        write_chunk(m, address, NULL, value, n);
+        address += n;
+        length -= n;
+    }
+}
+
+// Pages holding code are allocated here, so a later store finds the mark
+void mem_mark_code(Machine* m, uint32_t start, uint32_t end) {
+    uint32_t granule = 1u << MEM_CODE_GRANULE_SHIFT;
+    uint32_t first = start & ~(granule - 1);
+    for (uint32_t offset = 0; offset < end - first; offset += granule) {
+        uint32_t addr = first + offset;
+        const BusRegion* region = bus_region_at(m, addr);
+        if (region && region->kind != BUS_ROM) continue; // Never put RAM under a device
+        get_page(m, addr)->code_granules |= mem_granule_bit(addr);
+    }
+}
+
+void mem_set_code_write_hook(Machine* m, CodeWriteHook hook) {
+    m->code_write_hook = hook;
+}
+
+void mem_watch_page(Machine* m, uint32_t address, bool watch) {
+    const BusRegion* region = bus_region_at(m, address);
+    if (region && region->kind != BUS_ROM) return;
+    MemPage* page = watch ? get_page(m, address) : home_page(m, address);
+    if (page) set_slots(page_slot(m, address), page, watch);
+}
+
+void mem_set_watch_hook(Machine* m, WatchHook hook) {
+    m->watch_hook = hook;
+}
+
+void mem_release_pages(Machine* m, uint32_t start, uint32_t size) {
+    for (uint32_t offset = 0; offset < size; offset += MEM_PAGE_SIZE) {
+        uint32_t addr = start + offset;
+        MemPage** slot = page_slot(m, addr);
+        if (!slot || !slot[MEM_HOME_SLOTS]) continue;
+        bool had_code = slot[MEM_HOME_SLOTS]->code_granules != 0;
+        release_page(slot[MEM_HOME_SLOTS]);
+        set_slots(slot, NULL, false);
+        m->pages_used--;
+        mem_clear_page_dirty(m, addr); // Dirty pages must exist
+        // Blocks decoded from the page must not outlive it
+        if (had_code && m->code_write_hook) m->code_write_hook(m, addr, addr + MEM_PAGE_SIZE);
+    }
+}
+
+void mem_install_rom(Machine* m, uint32_t start, uint32_t size, const uint8_t* data, uint32_t length) {
+    for (uint32_t offset = 0; offset < size; offset += MEM_PAGE_SIZE) {
+        MemPage* page = own_page(m, start + offset);
+        uint32_t count = 0;
+        if (offset < length) count = length - offset < MEM_PAGE_SIZE ? length - offset : MEM_PAGE_SIZE;
+        memcpy(page->data, data + offset, count);
+        memset(page->data + count, 0, MEM_PAGE_SIZE - count);
+        page->code_granules = ~0ull;
+    }
+}
+
+// --- Snapshots ---
+
+// Dirty bits of the pages of one table. Pages only exist in tables, so the
+// bits outside them are all clear and need no copying.
+#define DIRTY_WORDS_PER_TABLE (MEM_TABLE_ENTRIES / 64)
+
+struct MemSnapshot {
+    MemPage** tables[MEM_DIR_ENTRIES]; // Page pointers, one owner each
+    uint64_t* dirty_pages;             // Words of allocated tables only
+};
+
+MemSnapshot* mem_snapshot(Machine* m) {
+    MemSnapshot* s = (MemSnapshot*)calloc(1, sizeof(MemSnapshot));
+    if (!s || !(s->dirty_pages = (uint64_t*)malloc(MEM_DIRTY_WORDS * sizeof(uint64_t)))) {
+        perror("Failed to allocate memory snapshot");
+        exit(EXIT_FAILURE);
+    }
+    for (int dir = 0; dir < MEM_DIR_ENTRIES; ++dir) {
+        MemPage** table = m->page_dir[dir];
+        if (!table) continue;
+        s->tables[dir] = (MemPage**)malloc(MEM_TABLE_ENTRIES * sizeof(MemPage*));
+        if (!s->tables[dir]) {
+            perror("Failed to allocate memory snapshot");
+            exit(EXIT_FAILURE);
+        }
+        memcpy(&s->dirty_pages[dir * DIRTY_WORDS_PER_TABLE], &m->dirty_pages[dir * DIRTY_WORDS_PER_TABLE],
+               DIRTY_WORDS_PER_TABLE * sizeof(uint64_t));
+        for (int i = 0; i < MEM_TABLE_ENTRIES; ++i) {
+            MemPage* page = table[MEM_HOME_SLOTS + i];
+            s->tables[dir][i] = page;
+            if (!page) continue;
+            page->refs++;
+            table[MEM_STORE_SLOTS + i] = NULL; // Shared now, copy on the next store
+        }
+    }
+    return s;
+}
+
+int mem_restore(Machine* m, const MemSnapshot* s) {
+    int restored = 0;
+    for (int dir = 0; dir < MEM_DIR_ENTRIES; ++dir) {
+        MemPage** saved = s->tables[dir];
+        if (!saved && !m->page_dir[dir]) continue;
+        uint64_t* dirty = &m->dirty_pages[dir * DIRTY_WORDS_PER_TABLE];
+        if (saved) {
+            memcpy(dirty, &s->dirty_pages[dir * DIRTY_WORDS_PER_TABLE], DIRTY_WORDS_PER_TABLE * sizeof(uint64_t));
+        } else {
+            memset(dirty, 0, DIRTY_WORDS_PER_TABLE * sizeof(uint64_t));
+        }
+        for (int i = 0; i < MEM_TABLE_ENTRIES; ++i) {
+            uint32_t address = ((uint32_t)dir << MEM_DIR_SHIFT) | ((uint32_t)i << MEM_PAGE_SHIFT);
+            MemPage* page = saved ? saved[i] : NULL;
+            MemPage* current = home_page(m, address);
+            if (current == page) continue;
+
+            // Blocks decoded from the page no longer match it
+            bool had_code = current && current->code_granules;
+            if (page) page->refs++;
+            replace_page(m, address, page);
+            restored++;
+            if (had_code && m->code_write_hook) m->code_write_hook(m, address, address + MEM_PAGE_SIZE);
+        }
+    }
+    return restored;
+}
+
+void mem_snapshot_free(MemSnapshot* s) {
+    if (!s) return;
+    for (int dir = 0; dir < MEM_DIR_ENTRIES; ++dir) {
+        if (!s->tables[dir]) continue;
+        for (int i = 0; i < MEM_TABLE_ENTRIES; ++i) release_page(s->tables[dir][i]);
+        free(s->tables[dir]);
+    }
+    free(s->dirty_pages);
+    free(s);
+}
+
+// --- Mapped Pages ---
+
+void mem_for_each_page(Machine* m, DirtyPageFn fn, void* context) {
+    for (int dir = 0; dir < MEM_DIR_ENTRIES; ++dir) {
+        MemPage** table = m->page_dir[dir];
+        if (!table) continue;
+        for (int i = 0; i < MEM_TABLE_ENTRIES; ++i) {
+            MemPage* page = table[MEM_HOME_SLOTS + i];
+            uint32_t address = ((uint32_t)dir << MEM_DIR_SHIFT) | ((uint32_t)i << MEM_PAGE_SHIFT);
+            if (page) fn(m, address, page->data, context);
+        }
+    }
+}
+
+void mem_map_pages(Machine* m, void* base, size_t length, const uint32_t* addresses, int count) {
+    if (base) {
+        MemMapping* mapping = (MemMapping*)malloc(sizeof(MemMapping));
+        if (!mapping) {
+            perror("Failed to allocate page mapping");
+            exit(EXIT_FAILURE);
+        }
+        mapping->base = base;
+        mapping->length = length;
+        mapping->next = m->mappings;
+        m->mappings = mapping;
+    }
+
+    for (int dir = 0; dir < MEM_DIR_ENTRIES; ++dir) {
+        MemPage** table = m->page_dir[dir];
+        if (!table) continue;
+        for (int i = 0; i < MEM_TABLE_ENTRIES; ++i) {
+            uint32_t address = ((uint32_t)dir << MEM_DIR_SHIFT) | ((uint32_t)i << MEM_PAGE_SHIFT);
+            if (!table[MEM_HOME_SLOTS + i] || bus_region_at(m, address)) continue;
+            replace_page(m, address, NULL);
+            mem_clear_page_dirty(m, address);
+        }
+    }
+    MemPage* pages = (MemPage*)base;
+    for (int i = 0; i < count; ++i) {
+        uint32_t address = addresses[i] & ~(uint32_t)(MEM_PAGE_SIZE - 1);
+        if (bus_region_at(m, address)) continue;
+        replace_page(m, address, &pages[i]);
+        mem_set_dirty(m, address);
+    }
+}
@@ -1,29 +1,308 @@
 #ifndef MEMORY_H
 #define MEMORY_H
 
+#include "machine.h"
+#include <stddef.h>
 #include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
 
-// 68000 has a 24-bit address bus, but we use a smaller size for practical simulation
-#define MEMORY_SIZE (16 * 1024 * 1024) // 16MB
+// Memory covers the full 32-bit address space of the 68020. It is a
+// two-level table: the top 10 address bits pick a page table, the next 10 a
+// 4 KB page. Pages are allocated on their first write and reads of a missing
+// page return zero, so a machine only pays for the memory it uses.
+#define MEM_PAGE_SHIFT 12
+#define MEM_PAGE_SIZE (1 << MEM_PAGE_SHIFT)
+#define MEM_TABLE_BITS 10
+#define MEM_TABLE_ENTRIES (1 << MEM_TABLE_BITS)
+#define MEM_DIR_SHIFT (MEM_PAGE_SHIFT + MEM_TABLE_BITS)
 
-// A structure to track changes
-typedef struct {
-    uint32_t address;
-    uint8_t old_value;
-    uint8_t new_value;
+#if MEM_DIR_ENTRIES != (1 << (32 - MEM_DIR_SHIFT))
+#error "MEM_DIR_ENTRIES in machine.h does not match the page layout"
+#endif
+
+// Each page table holds three pointers per page, in consecutive arrays of
+// MEM_TABLE_ENTRIES: the page for loads, the page for stores and the page
+// itself. A load or store pointer is NULL where that access must miss the
+// fast paths below: a watched page has neither, so every access reaches the
+// watch hook, and a page shared with a snapshot has no store pointer until
+// its first store gives the machine a copy of its own.
+#define MEM_LOAD_SLOTS 0
+#define MEM_STORE_SLOTS MEM_TABLE_ENTRIES
+#define MEM_HOME_SLOTS (2 * MEM_TABLE_ENTRIES)
+#define MEM_TABLE_SLOTS (3 * MEM_TABLE_ENTRIES)
+
+// Code tracking: each page keeps one bit per granule that holds decoded code
+#define MEM_CODE_GRANULE_SHIFT 6 // 64-byte granules, 64 per page
+
+#define MEM_PAGE_MAPPED 0x01 // Lives in a mapped file, see mem_map_pages()
+
+typedef struct MemPage {
+    uint8_t data[MEM_PAGE_SIZE];
+    uint64_t code_granules;
+    uint32_t refs; // Owners: the machine and the snapshots holding the page
+    uint32_t flags;
+} MemPage;
+
+// --- Write Journal ---
+// Off by default. While it is on, stores are recorded as runs of consecutive
+// bytes with their old and new values; a store that continues the newest run
+// is merged into it. Runs are kept in a ring and numbered from 0 in the order
+// they were started. When the ring is full the oldest half is streamed to a
+// file, if one was given, and otherwise the oldest run is dropped.
+
+#define MEM_JOURNAL_RUN 28 // Bytes per run, so a run fills 64 bytes
+#define MEM_JOURNAL_DEFAULT_RUNS 65536
+
+typedef struct MemoryChange {
+    uint32_t address; // First byte of the run
+    uint16_t length;
+    uint8_t old_value[MEM_JOURNAL_RUN];
+    uint8_t new_value[MEM_JOURNAL_RUN];
 } MemoryChange;
 
-void mem_init();
-void mem_shutdown();
+// Starts journaling with room for 'capacity' runs. 'stream_file' may be NULL
+// to keep the journal in memory only. Returns false if it cannot be opened.
+bool mem_journal_start(Machine* m, int capacity, const char* stream_file);
+// Streams whatever is still held, if streaming, and turns the journal off
+void mem_journal_stop(Machine* m);
+
+// One past the number of the newest run
+uint64_t mem_journal_end(Machine* m);
+// A run by number, or NULL if it was dropped, streamed or not started yet.
+// The newest run may still grow.
+const MemoryChange* mem_journal_run(Machine* m, uint64_t run);
+
+// --- Dirty Pages ---
+// Every store sets the bit of its page in a bitmap covering the whole
+// address space. Bits stay set until cleared, so a caller can find the pages
+// written since any point it chooses, without a journal.
+
+#define MEM_PAGE_COUNT (1u << (32 - MEM_PAGE_SHIFT))
+#define MEM_DIRTY_WORDS (MEM_PAGE_COUNT / 64)
+
+typedef void (*DirtyPageFn)(Machine* m, uint32_t address, const uint8_t* data, void* context);
+
+// Calls 'fn' for each dirty page in address order, with its first address
+void mem_for_each_dirty_page(Machine* m, DirtyPageFn fn, void* context);
+int mem_dirty_count(Machine* m);
+void mem_clear_dirty(Machine* m);
+void mem_clear_page_dirty(Machine* m, uint32_t address);
+
+// Hex dump of the dirty pages only, 16 bytes a line. Lines repeating the one
+// before them, up to the end of their page, are shown as a single '*'.
+// Writes nothing if no page is dirty.
+void mem_dump_dirty_pages(Machine* m, const char* filename);
+
+void mem_init(Machine* m);
+void mem_shutdown(Machine* m);
+// Frees all pages, turns the journal off and clears code tracking
+void mem_reset(Machine* m);
+
+// --- Snapshots ---
+// A snapshot shares the machine's pages rather than copying them. Taking
+// one clears every store pointer, so the first store to a page copies it.
+// Restoring compares page pointers and puts back only the pages that
+// differ, which are exactly those stored to or allocated since. Neither is
+// journaled. A snapshot belongs to the thread of its machine.
+
+typedef struct MemSnapshot MemSnapshot;
+
+MemSnapshot* mem_snapshot(Machine* m);
+// Returns the number of pages put back
+int mem_restore(Machine* m, const MemSnapshot* snapshot);
+void mem_snapshot_free(MemSnapshot* snapshot);
+
+// --- Mapped Pages ---
+// Pages can be used in place from a file mapped MAP_PRIVATE, see state.h.
+// The file holds complete MemPage records, one owner each and marked
+// MEM_PAGE_MAPPED, so installing them writes nothing: a page is read from
+// the file when first touched and copied by the host when first stored to.
+// The mapping goes with the machine's memory, so snapshots holding mapped
+// pages must be freed before the machine is reset or destroyed.
+
+// Calls 'fn' for every allocated page in address order, ROM pages included
+void mem_for_each_page(Machine* m, DirtyPageFn fn, void* context);
+// Replaces every RAM page with the records at 'base', one per address.
+// Pages of bus regions are kept. The machine takes over the mapping.
+void mem_map_pages(Machine* m, void* base, size_t length, const uint32_t* addresses, int count);
+
+// Allocated pages, MEM_PAGE_SIZE bytes each
+int mem_pages_used(Machine* m);
+
+void mem_mark_code(Machine* m, uint32_t start, uint32_t end);
+void mem_set_code_write_hook(Machine* m, CodeWriteHook hook);
+
+// Watched pages report every data access, byte by byte, to the watch hook.
+// Watching allocates the page. Device pages cannot be watched.
+void mem_watch_page(Machine* m, uint32_t address, bool watch);
+void mem_set_watch_hook(Machine* m, WatchHook hook);
+
+// For the bus: frees the pages in a range, or fills them with ROM contents
+// (zero past 'length') and sends every store to them down the slow path by
+// marking all their granules as code. Ranges are whole pages.
+void mem_release_pages(Machine* m, uint32_t start, uint32_t size);
+void mem_install_rom(Machine* m, uint32_t start, uint32_t size, const uint8_t* data, uint32_t length);
+
+// --- Blocks ---
+// Bulk transfers for loaders and devices, one memcpy or memset per page.
+// The result is that of the same bytes accessed one by one: device and
+// watched pages still see every byte, and stores are journaled, mark their
+// page dirty and invalidate decoded code, only per page rather than per byte.
+
+void mem_read_block(Machine* m, uint32_t address, void* out, uint32_t length);
+void mem_write_block(Machine* m, uint32_t address, const void* data, uint32_t length);
+void mem_fill(Machine* m, uint32_t address, uint8_t value, uint32_t length);
+
+// --- Accessors ---
+// An access that stays inside one allocated page is a single host load or
+// store, swapped from big-endian. A store also needs no decoded code in its
+// granules. Everything else, page crossings, missing pages, code writes and
+// the device pages of bus.h, takes the out-of-line path in memory.c.
+
+uint8_t mem_read_byte_slow(Machine* m, uint32_t address);
+uint16_t mem_fetch_word_slow(Machine* m, uint32_t address);
+uint16_t mem_read_word_slow(Machine* m, uint32_t address);
+uint32_t mem_read_long_slow(Machine* m, uint32_t address);
+void mem_write_slow(Machine* m, uint32_t address, uint32_t value, int size);
+// Journals a store, before 'bytes' in memory are overwritten
+void mem_journal_record(Machine* m, uint32_t address, const uint8_t* bytes, uint32_t value, int size);
+
+// The page holding 'address' for direct loads, or NULL if it was never
+// written or is watched
+static inline MemPage* mem_find_page(const Machine* m, uint32_t address) {
+    MemPage** table = m->page_dir[address >> MEM_DIR_SHIFT];
+    return table ? table[MEM_LOAD_SLOTS + ((address >> MEM_PAGE_SHIFT) & (MEM_TABLE_ENTRIES - 1))] : NULL;
+}
+
+// The same for direct stores, also NULL while the page is shared
+static inline MemPage* mem_find_store_page(const Machine* m, uint32_t address) {
+    MemPage** table = m->page_dir[address >> MEM_DIR_SHIFT];
+    return table ? table[MEM_STORE_SLOTS + ((address >> MEM_PAGE_SHIFT) & (MEM_TABLE_ENTRIES - 1))] : NULL;
+}
+
+static inline uint32_t mem_page_offset(uint32_t address) {
+    return address & (MEM_PAGE_SIZE - 1);
+}
+
+static inline uint64_t mem_granule_bit(uint32_t address) {
+    return 1ULL << ((address >> MEM_CODE_GRANULE_SHIFT) & 63);
+}
+
+static inline uint16_t mem_load_be16(const uint8_t* p) {
+    uint16_t value;
+    memcpy(&value, p, 2);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    value = __builtin_bswap16(value);
+#endif
+    return value;
+}
+
+static inline uint32_t mem_load_be32(const uint8_t* p) {
+    uint32_t value;
+    memcpy(&value, p, 4);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    value = __builtin_bswap32(value);
+#endif
+    return value;
+}
+
+static inline void mem_store_be16(uint8_t* p, uint16_t value) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    value = __builtin_bswap16(value);
+#endif
+    memcpy(p, &value, 2);
+}
+
+static inline void mem_store_be32(uint8_t* p, uint32_t value) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    value = __builtin_bswap32(value);
+#endif
+    memcpy(p, &value, 4);
+}
+
+static inline bool mem_page_dirty(const Machine* m, uint32_t address) {
+    uint32_t page = address >> MEM_PAGE_SHIFT;
+    return (m->dirty_pages[page >> 6] >> (page & 63)) & 1;
+}
+
+static inline void mem_set_dirty(Machine* m, uint32_t address) {
+    uint32_t page = address >> MEM_PAGE_SHIFT;
+    m->dirty_pages[page >> 6] |= 1ull << (page & 63);
+}
+
+// The page a 'size' byte store at 'address' may take the fast path into, or NULL
+static inline MemPage* mem_fast_store_page(const Machine* m, uint32_t address, int size) {
+    MemPage* page = mem_find_store_page(m, address);
+    if (!page || mem_page_offset(address) > (uint32_t)(MEM_PAGE_SIZE - size)) return NULL;
+    if (page->code_granules & (mem_granule_bit(address) | mem_granule_bit(address + size - 1))) return NULL;
+    return page;
+}
+
+static inline uint8_t mem_read_byte(Machine* m, uint32_t address) {
+    const MemPage* page = mem_find_page(m, address);
+    return page ? page->data[mem_page_offset(address)] : mem_read_byte_slow(m, address);
+}
+
+static inline uint16_t mem_read_word(Machine* m, uint32_t address) {
+    const MemPage* page = mem_find_page(m, address);
+    if (page && mem_page_offset(address) <= MEM_PAGE_SIZE - 2) {
+        return mem_load_be16(&page->data[mem_page_offset(address)]);
+    }
+    return mem_read_word_slow(m, address);
+}
+
+// Instruction fetch, which unlike mem_read_word() never fires a watchpoint
+static inline uint16_t mem_fetch_word(Machine* m, uint32_t address) {
+    const MemPage* page = mem_find_page(m, address);
+    if (page && mem_page_offset(address) <= MEM_PAGE_SIZE - 2) {
+        return mem_load_be16(&page->data[mem_page_offset(address)]);
+    }
+    return mem_fetch_word_slow(m, address);
+}
+
+static inline uint32_t mem_read_long(Machine* m, uint32_t address) {
+    const MemPage* page = mem_find_page(m, address);
+    if (page && mem_page_offset(address) <= MEM_PAGE_SIZE - 4) {
+        return mem_load_be32(&page->data[mem_page_offset(address)]);
+    }
+    return mem_read_long_slow(m, address);
+}
 
-uint8_t mem_read_byte(uint32_t address);
-uint16_t mem_read_word(uint32_t address);
-uint32_t mem_read_long(uint32_t address);
+static inline void mem_write_byte(Machine* m, uint32_t address, uint8_t value) {
+    MemPage* page = mem_fast_store_page(m, address, 1);
+    if (!page) {
+        mem_write_slow(m, address, value, 1);
+        return;
+    }
+    uint8_t* p = &page->data[mem_page_offset(address)];
+    if (m->journal) mem_journal_record(m, address, p, value, 1);
+    mem_set_dirty(m, address);
+    *p = value;
+}
 
-void mem_write_byte(uint32_t address, uint8_t value);
-void mem_write_word(uint32_t address, uint16_t value);
-void mem_write_long(uint32_t address, uint32_t value);
+static inline void mem_write_word(Machine* m, uint32_t address, uint16_t value) {
+    MemPage* page = mem_fast_store_page(m, address, 2);
+    if (!page) {
+        mem_write_slow(m, address, value, 2);
+        return;
+    }
+    uint8_t* p = &page->data[mem_page_offset(address)];
+    if (m->journal) mem_journal_record(m, address, p, value, 2);
+    mem_set_dirty(m, address);
+    mem_store_be16(p, value);
+}
 
-void mem_dump_changes(const char* filename);
+static inline void mem_write_long(Machine* m, uint32_t address, uint32_t value) {
+    MemPage* page = mem_fast_store_page(m, address, 4);
+    if (!page) {
+        mem_write_slow(m, address, value, 4);
+        return;
+    }
+    uint8_t* p = &page->data[mem_page_offset(address)];
+    if (m->journal) mem_journal_record(m, address, p, value, 4);
+    mem_set_dirty(m, address);
+    mem_store_be32(p, value);
+}
 
 #endif // MEMORY_H
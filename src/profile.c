@@ -0,0 +1,177 @@
+#define _DEFAULT_SOURCE
+#include "profile.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PROFILE_INITIAL_CAPACITY 1024 // Entries, a power of two
+
+typedef struct {
+    uint16_t ids[PROFILE_MAX_LENGTH];
+    uint8_t length; // 0 for a free entry
+    uint64_t count;
+} Sequence;
+
+struct Profile {
+    Sequence* entries; // Open addressing, linear probing
+    size_t capacity;
+    size_t used;
+};
+
+static Sequence* allocate_entries(size_t capacity) {
+    Sequence* entries = (Sequence*)calloc(capacity, sizeof(Sequence));
+    if (!entries) {
+        perror("Failed to allocate profile");
+        exit(EXIT_FAILURE);
+    }
+    return entries;
+}
+
+Profile* profile_create(void) {
+    Profile* p = (Profile*)calloc(1, sizeof(Profile));
+    if (!p) {
+        perror("Failed to allocate profile");
+        exit(EXIT_FAILURE);
+    }
+    p->capacity = PROFILE_INITIAL_CAPACITY;
+    p->entries = allocate_entries(p->capacity);
+    return p;
+}
+
+void profile_free(Profile* p) {
+    if (!p) return;
+    free(p->entries);
+    free(p);
+}
+
+static size_t hash(const uint16_t* ids, int length) {
+    size_t h = (size_t)length;
+    for (int i = 0; i < length; ++i) h = h * 0x9E3779B1u + ids[i];
+    return h ^ (h >> 15);
+}
+
+static bool same_sequence(const Sequence* s, const uint16_t* ids, int length) {
+    return s->length == length && memcmp(s->ids, ids, length * sizeof(uint16_t)) == 0;
+}
+
+static void add(Profile* p, const uint16_t* ids, int length, uint64_t count);
+
+// Doubles the table once it is three quarters full
+static void grow(Profile* p) {
+    Sequence* old = p->entries;
+    size_t old_capacity = p->capacity;
+    p->capacity *= 2;
+    p->entries = allocate_entries(p->capacity);
+    p->used = 0;
+    for (size_t i = 0; i < old_capacity; ++i) {
+        if (old[i].length) add(p, old[i].ids, old[i].length, old[i].count);
+    }
+    free(old);
+}
+
+static void add(Profile* p, const uint16_t* ids, int length, uint64_t count) {
+    size_t mask = p->capacity - 1;
+    size_t i = hash(ids, length) & mask;
+    while (p->entries[i].length && !same_sequence(&p->entries[i], ids, length)) i = (i + 1) & mask;
+    Sequence* s = &p->entries[i];
+    if (!s->length) {
+        memcpy(s->ids, ids, length * sizeof(uint16_t));
+        s->length = (uint8_t)length;
+        if (++p->used * 4 > p->capacity * 3) {
+            s->count = count;
+            grow(p);
+            return;
+        }
+    }
+    s->count += count;
+}
+
+void profile_record(Profile* p, const DecodedOp* ops, int count) {
+    for (int i = 0; i + 1 < count; ++i) {
+        uint16_t ids[PROFILE_MAX_LENGTH];
+        for (int length = 1; length <= PROFILE_MAX_LENGTH && i + length <= count; ++length) {
+            ids[length - 1] = ops[i + length - 1].handler_id;
+            if (length >= 2) add(p, ids, length, 1);
+        }
+    }
+}
+
+// --- Saving ---
+
+static int find_name(const char* name, const char* const* names, int num_names) {
+    for (int i = 0; i < num_names; ++i) {
+        if (strcmp(names[i], name) == 0) return i;
+    }
+    return -1;
+}
+
+// Adds the sequences of an earlier profile file; a missing file adds none
+static void add_file(Profile* p, const char* filename, const char* const* names, int num_names) {
+    FILE* f = fopen(filename, "r");
+    if (!f) return;
+    char line[512];
+    int dropped = 0;
+    while (fgets(line, sizeof(line), f)) {
+        if (line[0] == '#') continue;
+        char* saveptr = NULL;
+        char* token = strtok_r(line, " \t\r\n", &saveptr);
+        if (!token) continue;
+        uint64_t count = strtoull(token, NULL, 10);
+        uint16_t ids[PROFILE_MAX_LENGTH];
+        int length = 0;
+        bool known = true;
+        while ((token = strtok_r(NULL, " \t\r\n", &saveptr)) && length < PROFILE_MAX_LENGTH) {
+            int id = find_name(token, names, num_names);
+            if (id < 0) known = false;
+            ids[length++] = (uint16_t)id;
+        }
+        if (known && length >= 2) {
+            add(p, ids, length, count);
+        } else {
+            dropped++;
+        }
+    }
+    fclose(f);
+    if (dropped) fprintf(stderr, "WARN: Dropped %d unknown sequences from profile '%s'.\n", dropped, filename);
+}
+
+static int by_count(const void* a, const void* b) {
+    const Sequence* x = (const Sequence*)a;
+    const Sequence* y = (const Sequence*)b;
+    if (x->count != y->count) return x->count < y->count ? 1 : -1;
+    return x->length - y->length;
+}
+
+bool profile_save(const Profile* p, const char* filename, const char* const* names, int num_names) {
+    Profile* sum = profile_create();
+    for (size_t i = 0; i < p->capacity; ++i) {
+        const Sequence* s = &p->entries[i];
+        if (s->length) add(sum, s->ids, s->length, s->count);
+    }
+    add_file(sum, filename, names, num_names);
+
+    // Compact the table in place, then sort it
+    size_t n = 0;
+    for (size_t i = 0; i < sum->capacity; ++i) {
+        if (sum->entries[i].length) sum->entries[n++] = sum->entries[i];
+    }
+    qsort(sum->entries, n, sizeof(Sequence), by_count);
+
+    FILE* f = fopen(filename, "w");
+    if (!f) {
+        fprintf(stderr, "ERROR: Could not open profile file '%s'.\n", filename);
+        profile_free(sum);
+        return false;
+    }
+    fprintf(f, "# Instruction sequence profile: count, then the handlers run in a row\n");
+    for (size_t i = 0; i < n; ++i) {
+        const Sequence* s = &sum->entries[i];
+        fprintf(f, "%llu", (unsigned long long)s->count);
+        for (int k = 0; k < s->length; ++k) fprintf(f, " %s", names[s->ids[k]]);
+        fprintf(f, "\n");
+    }
+    bool ok = fclose(f) == 0;
+    if (!ok) fprintf(stderr, "ERROR: Could not write profile file '%s'.\n", filename);
+    profile_free(sum);
+    return ok;
+}
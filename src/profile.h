@@ -0,0 +1,35 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include "executor.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+// Instruction sequence profile, the input for picking superinstructions.
+//
+// While a run profiles, each block it runs adds one to the count of every
+// sequence of two and three adjacent ops it ran, named by their handlers.
+// Sequences never cross a block, since only ops of one block run back to
+// back without a lookup. gen_isa reads the file and fuses the sequences that
+// save the most dispatches, see README.md.
+//
+// The file is text, one sequence per line, most frequent first:
+//   <count> <handler> <handler> [<handler>]
+// Lines starting with '#' are comments.
+
+#define PROFILE_MAX_LENGTH 3
+
+typedef struct Profile Profile;
+
+Profile* profile_create(void);
+void profile_free(Profile* p);
+
+// Counts the sequences in ops [0, count), all run once in a row
+void profile_record(Profile* p, const DecodedOp* ops, int count);
+
+// Adds the counts of the profile already in 'filename', if any, and writes
+// the sum back, so one file can collect several runs. 'names' maps the
+// handler ids to names; lines naming other handlers are dropped.
+bool profile_save(const Profile* p, const char* filename, const char* const* names, int num_names);
+
+#endif // PROFILE_H
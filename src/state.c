@@ -0,0 +1,242 @@
+#define _POSIX_C_SOURCE 200809L
+#include "state.h"
+#include "memory.h"
+#include "bus.h"
+#include "loader.h"
+#include "disassembler.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// --- Saving ---
+
+typedef struct {
+    FILE* file;
+    bool ok;
+    uint32_t count;
+    uint32_t* addresses; // Pages to save, see collect_page
+    const uint8_t** data;
+} StateWriter;
+
+static void put(StateWriter* w, const void* bytes, size_t length) {
+    if (w->ok && length > 0 && fwrite(bytes, 1, length, w->file) != length) w->ok = false;
+}
+
+static void put32(StateWriter* w, uint32_t value) {
+    put(w, &value, sizeof(value));
+}
+
+// Device pages come from their regions when the state is loaded
+static void collect_page(Machine* m, uint32_t address, const uint8_t* data, void* context) {
+    StateWriter* w = (StateWriter*)context;
+    if (bus_region_at(m, address)) return;
+    w->addresses[w->count] = address;
+    w->data[w->count] = data;
+    w->count++;
+}
+
+static void count_mapping(const SourceMapping* mapping, void* context) {
+    (void)mapping; // Silence unused parameter warning
+    (*(uint32_t*)context)++;
+}
+
+static void put_mapping(const SourceMapping* mapping, void* context) {
+    StateWriter* w = (StateWriter*)context;
+    const char* text = mapping->instruction_text ? mapping->instruction_text : "";
+    put32(w, mapping->address);
+    put32(w, (uint32_t)mapping->line_number);
+    put32(w, (uint32_t)strlen(text));
+    put(w, text, strlen(text));
+}
+
+bool state_save(Machine* m, const char* filename) {
+    StateWriter w = {0};
+    w.ok = true;
+    w.addresses = (uint32_t*)malloc((m->pages_used + 1) * sizeof(uint32_t));
+    w.data = (const uint8_t**)malloc((m->pages_used + 1) * sizeof(uint8_t*));
+    if (!w.addresses || !w.data) {
+        perror("Failed to allocate state page list");
+        exit(EXIT_FAILURE);
+    }
+    mem_for_each_page(m, collect_page, &w);
+
+    StateHeader header = {0};
+    memcpy(header.magic, STATE_MAGIC, sizeof(header.magic));
+    header.version = STATE_VERSION;
+    header.cpu_size = sizeof(CPU);
+    header.page_size = sizeof(MemPage);
+    header.num_pages = w.count;
+    if (m->source_map) disassembler_for_each(m->source_map, count_mapping, &header.num_mappings);
+    const HashTable* symbols = m->symbols;
+    if (symbols) {
+        header.symbol_table_size = symbols->size;
+        for (unsigned int i = 0; i < symbols->size; ++i) {
+            for (const Symbol* s = symbols->table[i]; s; s = s->next) header.num_symbols++;
+        }
+    }
+
+    w.file = fopen(filename, "wb");
+    if (!w.file) {
+        perror("Could not open state file");
+        free(w.addresses);
+        free(w.data);
+        return false;
+    }
+    put(&w, &header, sizeof(header)); // Again once pages_offset is known
+    put(&w, &m->cpu, sizeof(CPU));
+    put(&w, w.addresses, w.count * sizeof(uint32_t));
+    if (m->source_map) disassembler_for_each(m->source_map, put_mapping, &w);
+    for (unsigned int i = 0; symbols && i < symbols->size; ++i) {
+        for (const Symbol* s = symbols->table[i]; s; s = s->next) {
+            put32(&w, s->address);
+            put32(&w, (uint32_t)strlen(s->name));
+            put(&w, s->name, strlen(s->name));
+        }
+    }
+
+    long position = ftell(w.file);
+    header.pages_offset = ((uint64_t)position + STATE_PAGE_ALIGN - 1) / STATE_PAGE_ALIGN * STATE_PAGE_ALIGN;
+    static const uint8_t zeros[256];
+    for (uint64_t left = header.pages_offset - position; left > 0;) {
+        size_t n = left < sizeof(zeros) ? (size_t)left : sizeof(zeros);
+        put(&w, zeros, n);
+        left -= n;
+    }
+    // Records are written as they will be used: one owner, nothing decoded
+    MemPage* record = (MemPage*)malloc(sizeof(MemPage));
+    if (!record) {
+        perror("Failed to allocate state page");
+        exit(EXIT_FAILURE);
+    }
+    for (uint32_t i = 0; i < w.count; ++i) {
+        memset(record, 0, sizeof(MemPage));
+        memcpy(record->data, w.data[i], MEM_PAGE_SIZE);
+        record->refs = 1;
+        record->flags = MEM_PAGE_MAPPED;
+        put(&w, record, sizeof(MemPage));
+    }
+    free(record);
+
+    if (w.ok && fseek(w.file, 0, SEEK_SET) != 0) w.ok = false;
+    put(&w, &header, sizeof(header));
+    if (fclose(w.file) != 0) w.ok = false;
+    free(w.addresses);
+    free(w.data);
+    if (!w.ok) {
+        fprintf(stderr, "ERROR: Could not write state file '%s'.\n", filename);
+        return false;
+    }
+    if (!m->quiet) printf("INFO: Saved state to %s (%u pages).\n", filename, header.num_pages);
+    return true;
+}
+
+// --- Loading ---
+
+static bool get(FILE* f, void* bytes, size_t length) {
+    return length == 0 || fread(bytes, 1, length, f) == length;
+}
+
+// Reads a u32 length and that many bytes as a string
+static char* get_string(FILE* f) {
+    uint32_t length;
+    if (!get(f, &length, sizeof(length)) || length > 0xFFFF) return NULL;
+    char* text = (char*)malloc(length + 1);
+    if (!text) {
+        perror("Failed to allocate state string");
+        exit(EXIT_FAILURE);
+    }
+    if (!get(f, text, length)) {
+        free(text);
+        return NULL;
+    }
+    text[length] = '\0';
+    return text;
+}
+
+// Reads everything but the pages into fresh tables, changing nothing in 'm'
+static bool read_tables(FILE* f, const StateHeader* header, CPU* cpu, uint32_t* addresses,
+                        SourceMap* source_map, HashTable* symbols) {
+    if (!get(f, cpu, sizeof(CPU)) || !get(f, addresses, header->num_pages * sizeof(uint32_t))) return false;
+    for (uint32_t i = 0; i < header->num_mappings; ++i) {
+        uint32_t fields[2];
+        if (!get(f, fields, sizeof(fields))) return false;
+        char* text = get_string(f);
+        if (!text) return false;
+        disassembler_add_mapping(source_map, fields[0], (int)fields[1], text);
+        free(text);
+    }
+    for (uint32_t i = 0; i < header->num_symbols; ++i) {
+        uint32_t address;
+        if (!get(f, &address, sizeof(address))) return false;
+        char* name = get_string(f);
+        if (!name || !symbols) {
+            free(name);
+            return false;
+        }
+        add_symbol(symbols, name, address);
+        free(name);
+    }
+    return true;
+}
+
+bool state_load(Machine* m, const char* filename) {
+    FILE* f = fopen(filename, "rb");
+    if (!f) {
+        perror("Could not open state file");
+        return false;
+    }
+    StateHeader header;
+    struct stat st;
+    if (!get(f, &header, sizeof(header)) || memcmp(header.magic, STATE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != STATE_VERSION || header.cpu_size != sizeof(CPU) || header.page_size != sizeof(MemPage)) {
+        fprintf(stderr, "ERROR: '%s' is not a state file of this simulator build.\n", filename);
+        fclose(f);
+        return false;
+    }
+    uint64_t pages_length = (uint64_t)header.num_pages * sizeof(MemPage);
+    if (fstat(fileno(f), &st) != 0 || header.pages_offset % STATE_PAGE_ALIGN != 0 ||
+        (uint64_t)st.st_size < header.pages_offset + pages_length) {
+        fprintf(stderr, "ERROR: State file '%s' is truncated.\n", filename);
+        fclose(f);
+        return false;
+    }
+
+    CPU cpu;
+    uint32_t* addresses = (uint32_t*)malloc((header.num_pages + 1) * sizeof(uint32_t));
+    SourceMap* source_map = disassembler_create();
+    HashTable* symbols = header.symbol_table_size ? create_symbol_table(header.symbol_table_size) : NULL;
+    if (!addresses || !source_map || (header.symbol_table_size && !symbols)) {
+        perror("Failed to allocate state tables");
+        exit(EXIT_FAILURE);
+    }
+    void* pages = NULL;
+    bool ok = read_tables(f, &header, &cpu, addresses, source_map, symbols);
+    if (!ok) {
+        fprintf(stderr, "ERROR: State file '%s' is truncated.\n", filename);
+    } else if (header.num_pages > 0) {
+        pages = mmap(NULL, pages_length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fileno(f), (off_t)header.pages_offset);
+        if (pages == MAP_FAILED) {
+            perror("Could not map state file");
+            ok = false;
+        }
+    }
+    fclose(f); // The mapping stays
+    if (!ok) {
+        free(addresses);
+        disassembler_cleanup(source_map);
+        destroy_symbol_table(symbols);
+        return false;
+    }
+
+    m->cpu = cpu;
+    disassembler_cleanup(m->source_map);
+    m->source_map = source_map;
+    destroy_symbol_table(m->symbols);
+    m->symbols = symbols;
+    mem_map_pages(m, pages, pages_length, addresses, header.num_pages);
+    free(addresses);
+    if (!m->quiet) printf("INFO: Loaded state from %s (%u pages).\n", filename, header.num_pages);
+    return true;
+}
@@ -0,0 +1,47 @@
+#ifndef STATE_H
+#define STATE_H
+
+#include "machine.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+// Saved machine state: the CPU, RAM, source map and symbols of a machine
+// between runs. Loading maps the pages of the file MAP_PRIVATE and uses them
+// in place, see mem_map_pages(), so a state resumes at once however much
+// memory it holds: nothing is parsed or copied until a page is stored to.
+//
+// The file is written in host byte order and only read back by the same
+// build of the simulator; anything else fails the version check. Layout:
+//   StateHeader
+//   CPU, as the struct
+//   u32 address per page
+//   per mapping: u32 address, i32 line, u32 length, text
+//   per symbol: u32 address, u32 length, name
+//   zeros up to pages_offset, a multiple of STATE_PAGE_ALIGN
+//   one MemPage record per page
+// Pages of bus regions and device state are not saved; attach the same
+// devices before loading.
+
+#define STATE_MAGIC "M68STATE"
+#define STATE_VERSION 1
+#define STATE_PAGE_ALIGN 65536 // Covers the page size of any host
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t cpu_size;         // sizeof(CPU), differs without cycle timing
+    uint32_t page_size;        // sizeof(MemPage)
+    uint32_t num_pages;
+    uint32_t num_mappings;
+    uint32_t num_symbols;
+    uint32_t symbol_table_size; // 0 if the machine had no symbol table
+    uint32_t reserved;
+    uint64_t pages_offset;
+} StateHeader;
+
+bool state_save(Machine* m, const char* filename);
+// Replaces the state of 'm' with the saved one. Breakpoints, watchpoints
+// and devices are kept.
+bool state_load(Machine* m, const char* filename);
+
+#endif // STATE_H
@@ -0,0 +1,78 @@
+#include "timing.h"
+
+// Column of the tables below: byte/word or long operands
+static int size_column(int size_code) {
+    return size_code >= 2 ? 1 : 0;
+}
+
+// Row of the tables below for an EA field. Mode 7 is split by register;
+// unused encodings fall back to the immediate row.
+static int ea_row(uint8_t ea) {
+    int mode = ea >> 3;
+    if (mode < 7) return mode;
+    int reg = ea & 7;
+    return reg <= 4 ? 7 + reg : 11;
+}
+
+// Effective address calculation time. The 68020 full format modes have no
+// 68000 timing and are charged like d8(An,Xn).
+static const uint8_t ea_time[12][2] = {
+    {  0,  0 }, // Dn
+    {  0,  0 }, // An
+    {  4,  8 }, // (An)
+    {  4,  8 }, // (An)+
+    {  6, 10 }, // -(An)
+    {  8, 12 }, // d16(An)
+    { 10, 14 }, // d8(An,Xn)
+    {  8, 12 }, // xxx.W
+    { 12, 16 }, // xxx.L
+    {  8, 12 }, // d16(PC)
+    { 10, 14 }, // d8(PC,Xn)
+    {  4,  8 }, // #<data>
+};
+
+// Destination part of the MOVE table: total time minus 4 and the source EA
+static const uint8_t move_dst_time[12][2] = {
+    {  0,  0 }, // Dn
+    {  0,  0 }, // An
+    {  4,  8 }, // (An)
+    {  4,  8 }, // (An)+
+    {  4,  8 }, // -(An)
+    {  8, 12 }, // d16(An)
+    { 10, 14 }, // d8(An,Xn)
+    {  8, 12 }, // xxx.W
+    { 12, 16 }, // xxx.L
+    {  0,  0 }, // Not a valid destination
+    {  0,  0 },
+    {  0,  0 },
+};
+
+void timing_decode(DecodedOp* op) {
+    int size = size_column(op->size_code);
+    const IsaEntry* entry = &isa_table[op->kind];
+    int cycles = size ? entry->cycles_long : entry->cycles; // Operands on Dn
+    int taken = 0;
+
+    switch (op->kind) {
+        case INSN_MOVE_B:
+        case INSN_MOVE_W:
+        case INSN_MOVE_L:
+            cycles += ea_time[ea_row(op->src_ea)][size] + move_dst_time[ea_row(op->dst_ea)][size];
+            break;
+        case INSN_ADD:
+        case INSN_SUB: {
+            int row = ea_row(op->src_ea);
+            if (size && (row <= 1 || row == 11)) cycles += 2; // Register direct and #<data> take 8
+            cycles += ea_time[row][size];
+            break;
+        }
+        case INSN_BCC:
+            // Not taken depends on the displacement size, taken is always 10
+            if ((op->opcode & 0xFF) == 0) cycles += 4;
+            taken = 10;
+            break;
+    }
+
+    op->cycles = cycles;
+    op->taken_cycles = taken;
+}
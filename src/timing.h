@@ -0,0 +1,23 @@
+#ifndef TIMING_H
+#define TIMING_H
+
+#include "executor.h"
+
+// 68000 instruction timing in clock periods, from the execution time tables
+// of the M68000 User's Manual. Each DecodedOp carries its cycle count, set
+// once at decode time, so the executor only adds it up.
+//
+// Build with 'make TIMING=0' to compile the accounting out entirely.
+
+#define TIMING_CLOCK_MHZ 8 // Reference clock for reporting run times
+
+#ifdef CYCLE_TIMING
+#define TIMING_ADD(cpu, n) ((cpu)->cycles += (n))
+#else
+#define TIMING_ADD(cpu, n) ((void)0)
+#endif
+
+// Fills in op->cycles and op->taken_cycles for a decoded instruction
+void timing_decode(DecodedOp* op);
+
+#endif // TIMING_H
@@ -0,0 +1,226 @@
+#include "trace.h"
+#include "memory.h"
+#include "disassembler.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TRACE_BUFFER_SIZE (64 * 1024)
+// Longest record before its memory writes: header, all registers and SR
+#define TRACE_MAX_FIXED (9 + (NUM_DATA_REGISTERS + NUM_ADDRESS_REGISTERS) * 4 + 2)
+
+struct TraceWriter {
+    FILE* file;
+    size_t used;
+    CPU last;           // State at the previous record, for register deltas
+    uint64_t mark_run;  // First journal run not yet traced in full
+    int mark_offset;    // Bytes of that run already traced
+    bool own_journal;   // Journal started by the trace, stopped with it
+    uint8_t buffer[TRACE_BUFFER_SIZE];
+};
+
+static void flush_buffer(TraceWriter* t) {
+    if (t->used > 0 && fwrite(t->buffer, 1, t->used, t->file) != t->used) {
+        perror("Failed to write trace");
+    }
+    t->used = 0;
+}
+
+static inline void reserve(TraceWriter* t, size_t bytes) {
+    if (t->used + bytes > TRACE_BUFFER_SIZE) flush_buffer(t);
+}
+
+static inline void put8(TraceWriter* t, uint8_t value) {
+    t->buffer[t->used++] = value;
+}
+
+static inline void put16(TraceWriter* t, uint16_t value) {
+    t->buffer[t->used++] = value & 0xFF;
+    t->buffer[t->used++] = value >> 8;
+}
+
+static inline void put32(TraceWriter* t, uint32_t value) {
+    put16(t, value & 0xFFFF);
+    put16(t, value >> 16);
+}
+
+static void put_mapping(const SourceMapping* mapping, void* context) {
+    TraceWriter* t = (TraceWriter*)context;
+    size_t length = strlen(mapping->instruction_text);
+    if (length > 0xFFFF) length = 0xFFFF;
+    reserve(t, 10 + length);
+    put32(t, mapping->address);
+    put32(t, (uint32_t)mapping->line_number);
+    put16(t, (uint16_t)length);
+    memcpy(t->buffer + t->used, mapping->instruction_text, length);
+    t->used += length;
+}
+
+static void count_mapping(const SourceMapping* mapping, void* context) {
+    (void)mapping; // Silence unused parameter warning
+    (*(uint32_t*)context)++;
+}
+
+// Moves the mark past every byte journaled so far. The newest run may still
+// grow, so the mark sits at its end rather than after it.
+static void mark_end(Machine* m, TraceWriter* t) {
+    uint64_t end = mem_journal_end(m);
+    const MemoryChange* newest = end > 0 ? mem_journal_run(m, end - 1) : NULL;
+    t->mark_run = newest ? end - 1 : end;
+    t->mark_offset = newest ? newest->length : 0;
+}
+
+// Steps through the journaled bytes after the mark, one byte per call.
+// Returns false once every byte has been seen.
+static bool next_write(Machine* m, uint64_t* run, int* offset, uint32_t* address, uint8_t* value) {
+    uint64_t end = mem_journal_end(m);
+    for (; *run < end; ++*run, *offset = 0) {
+        const MemoryChange* change = mem_journal_run(m, *run);
+        if (!change || *offset >= change->length) continue; // Dropped or done
+        *address = change->address + *offset;
+        *value = change->new_value[*offset];
+        ++*offset;
+        return true;
+    }
+    return false;
+}
+
+static bool has_writes(Machine* m, const TraceWriter* t) {
+    uint64_t run = t->mark_run;
+    int offset = t->mark_offset;
+    uint32_t address;
+    uint8_t value;
+    return next_write(m, &run, &offset, &address, &value);
+}
+
+bool trace_open(Machine* m, const char* filename) {
+    trace_close(m);
+    TraceWriter* t = (TraceWriter*)malloc(sizeof(TraceWriter));
+    if (!t) {
+        perror("Failed to allocate trace buffer");
+        return false;
+    }
+    t->file = fopen(filename, "wb");
+    if (!t->file) {
+        perror("Could not open trace file");
+        free(t);
+        return false;
+    }
+    m->trace = t;
+    const CPU* cpu = &m->cpu;
+
+    memcpy(t->buffer, TRACE_MAGIC, 4);
+    t->used = 4;
+    put16(t, TRACE_VERSION);
+    put16(t, 0);
+
+    uint32_t num_mappings = 0;
+    if (m->source_map) disassembler_for_each(m->source_map, count_mapping, &num_mappings);
+    put32(t, num_mappings);
+    if (m->source_map) disassembler_for_each(m->source_map, put_mapping, t);
+
+    reserve(t, 16 * 4 + 6);
+    for (int i = 0; i < NUM_DATA_REGISTERS; ++i) put32(t, cpu->d[i]);
+    for (int i = 0; i < NUM_ADDRESS_REGISTERS; ++i) put32(t, cpu->a[i]);
+    put32(t, cpu->pc);
+    put16(t, cpu_get_sr(cpu));
+
+    t->last = *cpu;
+    t->last.sr = cpu_get_sr(cpu);
+    // Writes are taken from the memory journal, kept in RAM if not on already
+    t->own_journal = !m->journal;
+    if (t->own_journal) mem_journal_start(m, MEM_JOURNAL_DEFAULT_RUNS, NULL);
+    mark_end(m, t);
+    return true;
+}
+
+// Appends the bytes written since the previous record as runs of
+// consecutive addresses, and moves the mark past them
+static void put_memory_writes(Machine* m, TraceWriter* t) {
+    uint32_t address, previous = 0;
+    uint8_t value;
+
+    // Count the runs first, the decoder needs the total up front
+    uint64_t run = t->mark_run;
+    int offset = t->mark_offset;
+    int runs = 0, length = 0;
+    while (next_write(m, &run, &offset, &address, &value)) {
+        if (length == 0 || length == TRACE_MAX_RUN || address != previous + 1) {
+            runs++;
+            length = 0;
+        }
+        length++;
+        previous = address;
+    }
+    if (runs > 0xFF) runs = 0xFF; // Anything beyond is dropped, no instruction writes that much
+
+    reserve(t, 1);
+    put8(t, (uint8_t)runs);
+    uint8_t bytes[TRACE_MAX_RUN];
+    uint32_t start = 0;
+    length = 0;
+    while (runs > 0) {
+        bool more = next_write(m, &t->mark_run, &t->mark_offset, &address, &value);
+        if (length > 0 && (!more || length == TRACE_MAX_RUN || address != start + length)) {
+            reserve(t, 5 + length);
+            put32(t, start);
+            put8(t, (uint8_t)length);
+            for (int i = 0; i < length; ++i) put8(t, bytes[i]);
+            length = 0;
+            runs--;
+        }
+        if (!more) break;
+        if (length == 0) start = address;
+        bytes[length++] = value;
+    }
+    mark_end(m, t); // Writes past the last run are skipped
+}
+
+void trace_record(Machine* m, uint32_t pc, uint16_t opcode, uint8_t flags) {
+    TraceWriter* t = m->trace;
+    if (!t) return;
+    const CPU* cpu = &m->cpu;
+
+    uint16_t mask = 0;
+    for (int i = 0; i < NUM_DATA_REGISTERS; ++i) {
+        if (cpu->d[i] != t->last.d[i]) mask |= 1 << i;
+    }
+    for (int i = 0; i < NUM_ADDRESS_REGISTERS; ++i) {
+        if (cpu->a[i] != t->last.a[i]) mask |= 1 << (8 + i);
+    }
+    uint16_t sr = cpu_get_sr(cpu);
+    if (sr != t->last.sr) flags |= TRACE_SR;
+
+    if (has_writes(m, t)) flags |= TRACE_MEM;
+
+    reserve(t, TRACE_MAX_FIXED);
+    put8(t, flags);
+    put32(t, pc);
+    put16(t, opcode);
+    put16(t, mask);
+    for (int i = 0; i < NUM_DATA_REGISTERS; ++i) {
+        if (mask & (1 << i)) put32(t, cpu->d[i]);
+    }
+    for (int i = 0; i < NUM_ADDRESS_REGISTERS; ++i) {
+        if (mask & (1 << (8 + i))) put32(t, cpu->a[i]);
+    }
+    if (flags & TRACE_SR) put16(t, sr);
+    if (flags & TRACE_MEM) put_memory_writes(m, t);
+
+    memcpy(t->last.d, cpu->d, sizeof(t->last.d));
+    memcpy(t->last.a, cpu->a, sizeof(t->last.a));
+    t->last.sr = sr;
+}
+
+void trace_close(Machine* m) {
+    TraceWriter* t = m->trace;
+    if (!t) return;
+    reserve(t, 5);
+    put8(t, TRACE_END);
+    put32(t, m->cpu.pc);
+    flush_buffer(t);
+    fclose(t->file);
+    if (t->own_journal) mem_journal_stop(m);
+    free(t);
+    m->trace = NULL;
+}
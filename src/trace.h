@@ -0,0 +1,41 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "machine.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+// Binary execution trace, rendered as text by 68k_tracedump.
+//
+// All values are little-endian. The file starts with a header:
+//   char[4] magic "M68T", u16 version, u16 reserved
+//   u32 mapping count, then per mapping: u32 address, u32 line, u16 length, text
+//   initial state: u32 d[8], u32 a[8], u32 pc, u16 sr
+// followed by one record per trace line:
+//   u8 flags, u32 pc, u16 opcode, u16 register mask (bit 0-7 Dn, 8-15 An)
+//   u32 value per register in the mask, u16 sr if TRACE_SR
+//   if TRACE_MEM: u8 run count, then per run: u32 address, u8 length, bytes
+// and ends with a TRACE_END record holding only flags and the final pc.
+// The pc of a record is the address of the instruction it traces; the pc
+// after it is the pc of the next record.
+
+#define TRACE_MAGIC "M68T"
+#define TRACE_VERSION 1
+
+// Record flags
+#define TRACE_SR      0x01 // SR changed
+#define TRACE_MEM     0x02 // Memory writes follow
+#define TRACE_UNKNOWN 0x04 // Opcode could not be executed
+#define TRACE_END     0x80 // Last record, holds the final pc
+
+#define TRACE_MAX_RUN 255  // Longest run of consecutive bytes in one write entry
+
+typedef struct TraceWriter TraceWriter;
+
+// Starts a trace of 'm' from its current state. Records hold m->cpu after the
+// traced instruction.
+bool trace_open(Machine* m, const char* filename);
+void trace_record(Machine* m, uint32_t pc, uint16_t opcode, uint8_t flags);
+void trace_close(Machine* m);
+
+#endif // TRACE_H
@@ -0,0 +1,244 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h> // for getopt
+
+#include "cpu.h"
+#include "disassembler.h"
+#include "trace.h"
+
+// Renders a binary trace written by 68k_sim -t in the simulator's text format
+
+typedef struct {
+    const uint8_t* data;
+    size_t size;
+    size_t pos;
+} Reader;
+
+static bool has(const Reader* r, size_t bytes) {
+    return r->size - r->pos >= bytes;
+}
+
+static uint8_t get8(Reader* r) {
+    return r->data[r->pos++];
+}
+
+static uint16_t get16(Reader* r) {
+    uint16_t value = r->data[r->pos] | (r->data[r->pos + 1] << 8);
+    r->pos += 2;
+    return value;
+}
+
+static uint32_t get32(Reader* r) {
+    uint32_t low = get16(r);
+    return low | ((uint32_t)get16(r) << 16);
+}
+
+static uint8_t* read_file(const char* filename, size_t* size) {
+    FILE* f = fopen(filename, "rb");
+    if (!f) {
+        perror("Could not open trace file");
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    long length = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t* data = (length > 0) ? (uint8_t*)malloc(length) : NULL;
+    if (!data || fread(data, 1, length, f) != (size_t)length) {
+        fprintf(stderr, "ERROR: Could not read trace file '%s'.\n", filename);
+        free(data);
+        fclose(f);
+        return NULL;
+    }
+    fclose(f);
+    *size = length;
+    return data;
+}
+
+static bool read_header(Reader* r, SourceMap* map, CPU* cpu) {
+    if (!has(r, 12) || memcmp(r->data, TRACE_MAGIC, 4) != 0) {
+        fprintf(stderr, "ERROR: Not a trace file.\n");
+        return false;
+    }
+    r->pos = 4;
+    uint16_t version = get16(r);
+    if (version != TRACE_VERSION) {
+        fprintf(stderr, "ERROR: Unsupported trace version %u.\n", version);
+        return false;
+    }
+    get16(r); // Reserved
+
+    uint32_t num_mappings = get32(r);
+    for (uint32_t i = 0; i < num_mappings; ++i) {
+        if (!has(r, 10)) return false;
+        uint32_t address = get32(r);
+        int line_number = (int)get32(r);
+        uint16_t length = get16(r);
+        if (!has(r, length)) return false;
+        char* text = (char*)malloc(length + 1);
+        if (!text) return false;
+        memcpy(text, r->data + r->pos, length);
+        text[length] = '\0';
+        r->pos += length;
+        disassembler_add_mapping(map, address, line_number, text);
+        free(text);
+    }
+
+    if (!has(r, 16 * 4 + 6)) return false;
+    cpu_init(cpu);
+    for (int i = 0; i < NUM_DATA_REGISTERS; ++i) cpu->d[i] = get32(r);
+    for (int i = 0; i < NUM_ADDRESS_REGISTERS; ++i) cpu->a[i] = get32(r);
+    cpu->pc = get32(r);
+    cpu_set_sr(cpu, get16(r));
+    return true;
+}
+
+// Same layout as the executor's trace lines. Only the opcode word is
+// recorded, so extension words show as "?".
+static void print_trace_line(CPU* cpu, const SourceMapping* map, uint32_t pc, uint16_t opcode) {
+    if (map) {
+        printf("L%-3d: %-20s | ", map->line_number, map->instruction_text);
+    } else {
+        char text[64];
+        disassembler_format(&opcode, 1, pc, text, sizeof(text));
+        printf("??:   %-20s | ", text);
+    }
+    cpu_dump_registers(cpu);
+}
+
+// Reads one record and applies it to 'cpu'. Memory writes are printed after
+// the trace line, so their position in the file is remembered.
+static bool read_record(Reader* r, CPU* cpu, uint8_t* flags, uint32_t* pc, uint16_t* opcode, size_t* writes) {
+    if (!has(r, 5)) return false;
+    *flags = get8(r);
+    *pc = get32(r);
+    if (*flags & TRACE_END) return true;
+
+    if (!has(r, 4)) return false;
+    *opcode = get16(r);
+    uint16_t mask = get16(r);
+    for (int i = 0; i < NUM_DATA_REGISTERS + NUM_ADDRESS_REGISTERS; ++i) {
+        if (!(mask & (1 << i))) continue;
+        if (!has(r, 4)) return false;
+        uint32_t value = get32(r);
+        if (i < NUM_DATA_REGISTERS) cpu->d[i] = value;
+        else cpu->a[i - NUM_DATA_REGISTERS] = value;
+    }
+    if (*flags & TRACE_SR) {
+        if (!has(r, 2)) return false;
+        cpu_set_sr(cpu, get16(r));
+    }
+
+    *writes = r->pos;
+    if (*flags & TRACE_MEM) {
+        if (!has(r, 1)) return false;
+        int runs = get8(r);
+        for (int run = 0; run < runs; ++run) {
+            if (!has(r, 5)) return false;
+            r->pos += 4;
+            uint8_t length = get8(r);
+            if (!has(r, length)) return false;
+            r->pos += length;
+        }
+    }
+    return true;
+}
+
+static void print_memory_writes(Reader* r, size_t pos) {
+    Reader w = *r;
+    w.pos = pos;
+    int runs = get8(&w);
+    for (int run = 0; run < runs; ++run) {
+        uint32_t address = get32(&w);
+        uint8_t length = get8(&w);
+        printf("%-26s | %08X:", "", address);
+        for (int i = 0; i < length; ++i) printf(" %02X", get8(&w));
+        printf("\n");
+    }
+}
+
+static void print_usage(const char* prog_name) {
+    fprintf(stderr, "Usage: %s [options] <trace_file>\n", prog_name);
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  -m            Show the memory written by each instruction\n");
+    fprintf(stderr, "  -h            Show this help message\n");
+}
+
+int main(int argc, char* argv[]) {
+    bool show_writes = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "hm")) != -1) {
+        switch (opt) {
+            case 'h':
+                print_usage(argv[0]);
+                return EXIT_SUCCESS;
+            case 'm':
+                show_writes = true;
+                break;
+            default: /* '?' */
+                print_usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (optind >= argc) {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    size_t size;
+    uint8_t* data = read_file(argv[optind], &size);
+    if (!data) return EXIT_FAILURE;
+
+    Reader r = {data, size, 0};
+    SourceMap* map = disassembler_create();
+    CPU cpu;
+    if (!map || !read_header(&r, map, &cpu)) {
+        fprintf(stderr, "ERROR: Trace header is damaged.\n");
+        free(data);
+        disassembler_cleanup(map);
+        return EXIT_FAILURE;
+    }
+    printf("%-26s | ", "Initial State");
+    cpu_dump_registers(&cpu);
+
+    // A record holds the state after its instruction, but the pc after it
+    // is that of the next record, so each line is printed one record late.
+    bool pending = false;
+    uint8_t flags = 0, pending_flags = 0;
+    uint32_t pc = 0, pending_pc = 0;
+    uint16_t opcode = 0, pending_opcode = 0;
+    size_t writes = 0, pending_writes = 0;
+    CPU pending_cpu;
+    int status = EXIT_SUCCESS;
+
+    while (true) {
+        CPU next = pending ? pending_cpu : cpu;
+        if (!read_record(&r, &next, &flags, &pc, &opcode, &writes)) {
+            fprintf(stderr, "ERROR: Trace is truncated at offset %zu.\n", r.pos);
+            status = EXIT_FAILURE;
+            break;
+        }
+        if (pending) {
+            if (pending_flags & TRACE_UNKNOWN) {
+                printf("WARN: Unknown or unimplemented opcode: %04X\n", pending_opcode);
+            }
+            pending_cpu.pc = pc;
+            print_trace_line(&pending_cpu, disassembler_get_mapping(map, pending_pc), pending_pc, pending_opcode);
+            if (show_writes && (pending_flags & TRACE_MEM)) print_memory_writes(&r, pending_writes);
+        }
+        if (flags & TRACE_END) break;
+        pending = true;
+        pending_cpu = next;
+        pending_flags = flags;
+        pending_pc = pc;
+        pending_opcode = opcode;
+        pending_writes = writes;
+    }
+
+    free(data);
+    disassembler_cleanup(map);
+    return status;
+}
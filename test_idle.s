@@ -0,0 +1,34 @@
+* Idle loops the executor fast-forwards, see README.md. Run with -I, and
+* with -F to run every instruction; both end in the same state and cycle
+* count. D0, D2 and D3 end at 0, D7 counts the timer expiries seen and ends at 2.
+START:
+    MOVE.L #100000,D0
+DELAY:
+    SUBQ.L #1,D0              ; Countdown loop
+    BNE DELAY
+    MOVE.W #$1000,D1
+PADDED:
+    NOP
+    SUBQ.W #4,D1              ; Countdown with padding
+    NOP
+    BNE PADDED
+    MOVE.B #$F0,D2
+UP:
+    ADDQ.B #2,D2              ; Counting up to zero
+    BNE UP
+    MOVE.L #20000,D0
+    MOVE.L D0,$FFFF1004.L     ; Timer RELOAD
+    MOVE.L #3,D0
+    MOVE.L D0,$FFFF1008.L     ; CONTROL: enable, periodic
+    MOVE.W #2,D3
+POLL:
+    MOVE.L $FFFF100C.L,D1     ; Spin loop on STATUS
+    ANDI.L #1,D1
+    BEQ POLL
+    ADDQ.W #1,D7
+    MOVE.L D1,$FFFF100C.L     ; Clear EXPIRED
+    SUBQ.W #1,D3
+    BNE POLL
+    MOVE.L #0,D0
+    MOVE.L D0,$FFFF1008.L     ; Stop the timer
+    RTS
@@ -0,0 +1,9 @@
+* A poll of memory nothing ever writes, so the loop never ends. Run with
+* -q -n 0 -c 100000000; the idle loop is fast-forwarded a chunk at a time
+* up to the cycle limit, and -F ends in the same state and cycle count.
+START:
+    MOVE.L #0,D1
+POLL:
+    MOVE.L $2000,D1           ; Reads 0 forever
+    BEQ POLL
+    RTS
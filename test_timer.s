@@ -0,0 +1,35 @@
+* Timer polling, run with -I. Waits for two one-shot expiries, clearing
+* STATUS and rewriting RELOAD in between, then for two periodic ones.
+* D7 counts the expiries seen and ends at 4.
+START:
+    MOVE.L #2000,D0
+    MOVE.L D0,$FFFF1004.L     ; RELOAD
+    MOVE.L #1,D0
+    MOVE.L D0,$FFFF1008.L     ; CONTROL: enable, one-shot
+WAIT1:
+    MOVE.L $FFFF100C.L,D1     ; STATUS
+    BEQ WAIT1
+    ADDQ.W #1,D7
+    MOVE.L #1,D0
+    MOVE.L D0,$FFFF100C.L     ; Clear EXPIRED
+    MOVE.L #3000,D0
+    MOVE.L D0,$FFFF1004.L     ; Rewriting RELOAD starts the count again
+WAIT2:
+    MOVE.L $FFFF100C.L,D1
+    BEQ WAIT2
+    ADDQ.W #1,D7
+    MOVE.L #1,D0
+    MOVE.L D0,$FFFF100C.L
+    MOVE.L #3,D0
+    MOVE.L D0,$FFFF1008.L     ; CONTROL: enable, periodic
+    MOVE.W #2,D6
+WAIT3:
+    MOVE.L $FFFF100C.L,D1
+    BEQ WAIT3
+    ADDQ.W #1,D7
+    MOVE.L #1,D0
+    MOVE.L D0,$FFFF100C.L
+    SUBQ.W #1,D6
+    BNE WAIT3
+    MOVE.L $FFFF1000.L,D5     ; COUNT, still running
+    RTS